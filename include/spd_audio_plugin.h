@@ -23,6 +23,13 @@
 
 #define SPD_AUDIO_PLUGIN_ENTRY_STR "spd_audio_plugin_get"
 
+/* Plugins whose table has members after end() also provide this entry
+   point, returning the SPD_AUDIO_PLUGIN_ABI they were built with.  Those
+   of a later version are not looked at in the table of an older plugin,
+   and plugins without it have none. */
+#define SPD_AUDIO_PLUGIN_ABI_STR "spd_audio_plugin_abi"
+#define SPD_AUDIO_PLUGIN_ABI 2
+
 /* *INDENT-OFF* */
 #ifdef __cplusplus
 extern "C" {
@@ -48,11 +55,14 @@ typedef struct {
 	AudioFormat format;
 
 	struct spd_audio_plugin const *function;
-	void *private_data;
+	void *private_data;	/* used by spd_audio, not by plugins */
 
 	int working;
 } AudioID;
 
+/* Given to submit(), to be called with its cookie */
+typedef void (*spd_audio_done_t) (AudioID *id, void *cookie);
+
 typedef struct spd_audio_plugin {
 	const char *name;
 	AudioID *(*open) (void **pars);
@@ -80,6 +90,21 @@ typedef struct spd_audio_plugin {
 	/* Clean up audio after playback. Needs to drain the audio if this
 	   wasn't done already. */
 	int (*end)  (AudioID *id);
+
+	/* Since SPD_AUDIO_PLUGIN_ABI 1 */
+	/* Return how long, in microseconds, the audio fed so far will take to
+	   be heard, or a negative value if that is not known.  Called from the
+	   thread feeding the audio, between begin() and end(). */
+	int (*get_delay) (AudioID *id);
+
+	/* Since SPD_AUDIO_PLUGIN_ABI 2 */
+	/* Queue track after the tracks submitted before, between begin() and
+	   end(), and return without waiting.  The samples have to be copied.
+	   Once the track is handed to the device, or dropped by stop(), call
+	   done(id, cookie), from any thread.  end() waits for the submitted
+	   tracks to be played. */
+	int (*submit) (AudioID *id, AudioTrack track, spd_audio_done_t done,
+		       void *cookie);
 } spd_audio_plugin_t;
 
 /* *INDENT-OFF* */
@@ -0,0 +1,60 @@
+/*
+ * spd_dsp.h - Sample processing kernels shared by the audio backends
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The kernels work on signed 8bit or native-endian signed 16bit samples.
+ * They pick an SSE2, AVX2 or NEON implementation the first time they are
+ * called, depending on what the CPU supports.
+ *
+ * Counts are in samples, except for the channel conversions which count
+ * frames.  Kernels that make the data smaller can work in place (out ==
+ * in), the others need out not to overlap in.
+ */
+
+#ifndef SPD_DSP_H
+#define SPD_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Apply the spd_audio volume (-100..100, the level of the samples being
+   100) to n samples */
+void spd_dsp_gain_s16(const int16_t * in, int16_t * out, size_t n, int volume);
+void spd_dsp_gain_s8(const int8_t * in, int8_t * out, size_t n, int volume);
+
+/* Swap the bytes of n samples in place */
+void spd_dsp_swap_s16(int16_t * buf, size_t n);
+
+/* Convert n samples between 8 and 16 bits */
+void spd_dsp_s8_to_s16(const int8_t * in, int16_t * out, size_t n);
+void spd_dsp_s16_to_s8(const int16_t * in, int8_t * out, size_t n);
+
+/* Convert n frames between mono and stereo, stereo is downmixed by
+   averaging the channels */
+void spd_dsp_mono_to_stereo_s16(const int16_t * in, int16_t * out, size_t n);
+void spd_dsp_stereo_to_mono_s16(const int16_t * in, int16_t * out, size_t n);
+
+/* Sum of the n products a[i] * b[i].  The caller makes sure the sum
+   cannot overflow, e.g. by keeping the sum of |b[i]| below 1 << 16 */
+int32_t spd_dsp_dot_s16(const int16_t * a, const int16_t * b, size_t n);
+
+/* Name of the implementation in use, e.g. "avx2" */
+const char *spd_dsp_implementation(void);
+
+#endif /* SPD_DSP_H */
@@ -0,0 +1,76 @@
+/*
+ * spd_probes.h - Static tracepoints for Speech Dispatcher
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * When configured with --enable-usdt, these expand to sys/sdt.h probes of the
+ * "speechd" provider, which are a single nop until a tracer attaches, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/speech-dispatcher:speechd:message_queued
+ *                { @t[arg0] = nsecs; }'
+ *
+ * Otherwise they expand to nothing, and their arguments are not evaluated.
+ * Arguments must be integers or pointers; strings are passed as pointers.
+ *
+ * Probes currently placed:
+ *   message_queued(id, priority, uid)        server.c
+ *   message_dequeued(id, priority, uid)      speaking.c
+ *   message_preprocessed(id)                 speaking.c, symbols and marks done
+ *   message_sent(id, module)                 speaking.c, output_speak done
+ *   index_mark(id, mark)                     speaking.c, reported to client
+ *   module_cmd_sent(module, cmd, wait)       output.c
+ *   module_cmd_replied(module, reply)        output.c
+ *   audio_received(samples, channels, rate, bits)  output.c
+ *   stop_requested(module), stop_completed(module)    output.c
+ *   pause_requested(module), pause_completed(module)  output.c
+ *   module_restart(module)                   module.c
+ *   speak_queue_mark(mark)                   speak_queue.c, mark played
+ *   speak_queue_stopped(paused)              speak_queue.c
+ *   audio_fed(plugin, samples, rate)         spd_audio.c
+ *   audio_stop(plugin)                       spd_audio.c
+ *   null_first_sound(sec, nsec)              null.c, CLOCK_MONOTONIC time
+ */
+
+#ifndef SPD_PROBES_H
+#define SPD_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define SPD_PROBE(name) DTRACE_PROBE(speechd, name)
+#define SPD_PROBE1(name, a1) DTRACE_PROBE1(speechd, name, a1)
+#define SPD_PROBE2(name, a1, a2) DTRACE_PROBE2(speechd, name, a1, a2)
+#define SPD_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(speechd, name, a1, a2, a3)
+#define SPD_PROBE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(speechd, name, a1, a2, a3, a4)
+
+#else /* ENABLE_USDT */
+
+#define SPD_PROBE(name) do { } while (0)
+#define SPD_PROBE1(name, a1) do { } while (0)
+#define SPD_PROBE2(name, a1, a2) do { } while (0)
+#define SPD_PROBE3(name, a1, a2, a3) do { } while (0)
+#define SPD_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+
+#endif /* ENABLE_USDT */
+
+#endif /* SPD_PROBES_H */
@@ -31,6 +31,8 @@
 #include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <glib.h>
 
@@ -38,7 +40,9 @@
 #include <alsa/pcm.h>
 
 #define SPD_AUDIO_PLUGIN_ENTRY spd_alsa_LTX_spd_audio_plugin_get
+#define SPD_AUDIO_PLUGIN_ABI_ENTRY spd_alsa_LTX_spd_audio_plugin_abi
 #include <spd_audio_plugin.h>
+#include <spd_dsp.h>
 
 typedef struct {
 	AudioID id;
@@ -46,6 +50,7 @@ typedef struct {
 	snd_pcm_hw_params_t *alsa_hw_params;	/* parameters of sound */
 	snd_pcm_sw_params_t *alsa_sw_params;	/* parameters of playback */
 	snd_pcm_uframes_t alsa_buffer_size;
+	snd_pcm_uframes_t alsa_avail_min;	/* default avail_min of sw_params */
 	pthread_mutex_t alsa_pcm_mutex;	/* mutex to guard the state of the device */
 	pthread_mutex_t alsa_pipe_mutex;	/* mutex to guard the stop pipes */
 	pthread_cond_t alsa_pipe_cond;	/* mutex to guard the stop pipes */
@@ -53,12 +58,31 @@ typedef struct {
 	int stop_requested;	/* Whether we want to stop */
 	int alsa_fd_count;	/* Counter of descriptors to poll */
 	struct pollfd *alsa_poll_fds;	/* Descriptors to poll */
-	int alsa_opened;	/* 1 between snd_pcm_open and _close, 0 otherwise */
+	int alsa_opened;	/* 1 between alsa_begin and alsa_end, 0 otherwise */
+	int alsa_configured;	/* 1 while the hw_params, stop pipe and poll
+				   descriptors are set up, they are kept
+				   between playbacks */
+	snd_pcm_format_t alsa_format;	/* the track format they are set up for */
+	unsigned int alsa_rate;	/* 0 if setting them up failed */
+	unsigned int alsa_hw_rate;	/* the rate the device agreed to */
+	int alsa_channels;
+	pthread_t alsa_idle_thread;	/* closes the device when not used */
+	pthread_cond_t alsa_idle_cond;	/* wakes up alsa_idle_thread */
+	time_t alsa_idle_since;	/* end of the last playback */
+	int alsa_quit;		/* asks alsa_idle_thread to terminate */
 	char *alsa_device_name;	/* the name of the device to open */
+	void *alsa_scratch;	/* samples with the volume applied */
+	size_t alsa_scratch_size;
 } spd_alsa_id_t;
 
+/* How long the device is kept open and configured after a playback, so
+   that the next one can start without setting it up again (seconds) */
+#define ALSA_IDLE_TIMEOUT 10
+
 static int _alsa_close(spd_alsa_id_t * id);
 static int _alsa_open(spd_alsa_id_t * id);
+static void _alsa_release(spd_alsa_id_t * id);
+static void _alsa_unconfigure(spd_alsa_id_t * id);
 
 static int xrun(spd_alsa_id_t * id);
 static int suspend(spd_alsa_id_t * id);
@@ -193,6 +217,7 @@ static int _alsa_open(spd_alsa_id_t * id)
 				SND_PCM_NONBLOCK)) < 0) {
 		ERR("Cannot open audio device %s (%s)", id->alsa_device_name,
 		    snd_strerror(err));
+		id->alsa_pcm = NULL;
 		return -1;
 	}
 
@@ -202,6 +227,8 @@ static int _alsa_open(spd_alsa_id_t * id)
 	if ((err = snd_pcm_sw_params_malloc(&id->alsa_sw_params)) < 0) {
 		ERR("Cannot allocate hardware parameter structure (%s)",
 		    snd_strerror(err));
+		snd_pcm_close(id->alsa_pcm);
+		id->alsa_pcm = NULL;
 		return -1;
 	}
 
@@ -216,33 +243,89 @@ static int _alsa_open(spd_alsa_id_t * id)
 
 static int _alsa_close(spd_alsa_id_t * id)
 {
-	int err;
-
 	MSG(1, "Closing ALSA device");
 
 	pthread_mutex_lock(&id->alsa_pipe_mutex);
+	_alsa_release(id);
+	pthread_mutex_unlock(&id->alsa_pipe_mutex);
 
-	if (id->alsa_opened == 0) {
-		pthread_mutex_unlock(&id->alsa_pipe_mutex);
-		return 0;
-	}
+	MSG(1, "Closing ALSA device ... success");
+
+	return 0;
+}
+
+/* Free what alsa_begin set up for playing tracks of a given format.
+   Called with alsa_pipe_mutex held. */
+static void _alsa_unconfigure(spd_alsa_id_t * id)
+{
+	if (!id->alsa_configured)
+		return;
+
+	MSG(2, "Freeing HW parameters");
+	snd_pcm_drop(id->alsa_pcm);
+	snd_pcm_hw_free(id->alsa_pcm);
+	snd_pcm_hw_params_free(id->alsa_hw_params);
+
+	if (id->alsa_stop_pipe[0] >= 0)
+		close(id->alsa_stop_pipe[0]);
+	if (id->alsa_stop_pipe[1] >= 0)
+		close(id->alsa_stop_pipe[1]);
+
+	g_free(id->alsa_poll_fds);
+	id->alsa_poll_fds = NULL;
+
+	id->alsa_configured = 0;
+	id->alsa_rate = 0;
+}
+
+/* Close the device if it is open, alsa_begin will open it again.
+   Called with alsa_pipe_mutex held. */
+static void _alsa_release(spd_alsa_id_t * id)
+{
+	int err;
+
+	if (id->alsa_pcm == NULL)
+		return;
 
 	id->alsa_opened = 0;
+	_alsa_unconfigure(id);
 
-	if ((err = snd_pcm_close(id->alsa_pcm)) < 0) {
+	if ((err = snd_pcm_close(id->alsa_pcm)) < 0)
 		MSG(2, "Cannot close ALSA device (%s)", snd_strerror(err));
-		pthread_mutex_unlock(&id->alsa_pipe_mutex);
-		return -1;
-	}
+	id->alsa_pcm = NULL;
 
 	snd_pcm_sw_params_free(id->alsa_sw_params);
+}
 
-	g_free(id->alsa_poll_fds);
-	pthread_mutex_unlock(&id->alsa_pipe_mutex);
+/* Close the device once it has not been used for ALSA_IDLE_TIMEOUT */
+static void *_alsa_idle(void *data)
+{
+	spd_alsa_id_t *id = data;
+	struct timespec ts;
 
-	MSG(1, "Closing ALSA device ... success");
+	pthread_mutex_lock(&id->alsa_pipe_mutex);
+	while (!id->alsa_quit) {
+		if (id->alsa_opened || id->alsa_pcm == NULL) {
+			pthread_cond_wait(&id->alsa_idle_cond,
+					  &id->alsa_pipe_mutex);
+			continue;
+		}
 
-	return 0;
+		ts.tv_sec = id->alsa_idle_since + ALSA_IDLE_TIMEOUT;
+		ts.tv_nsec = 0;
+		pthread_cond_timedwait(&id->alsa_idle_cond,
+				       &id->alsa_pipe_mutex, &ts);
+
+		if (!id->alsa_quit && !id->alsa_opened && id->alsa_pcm != NULL
+		    && time(NULL) >= id->alsa_idle_since + ALSA_IDLE_TIMEOUT) {
+			MSG(2, "Closing ALSA device after %ds of inactivity",
+			    ALSA_IDLE_TIMEOUT);
+			_alsa_release(id);
+		}
+	}
+	pthread_mutex_unlock(&id->alsa_pipe_mutex);
+
+	return NULL;
 }
 
 /* Open ALSA for playback.
@@ -267,8 +350,16 @@ static AudioID *alsa_open(void **pars)
 
 	pthread_mutex_init(&alsa_id->alsa_pipe_mutex, NULL);
 	pthread_cond_init(&alsa_id->alsa_pipe_cond, NULL);
+	pthread_cond_init(&alsa_id->alsa_idle_cond, NULL);
 
+	alsa_id->alsa_pcm = NULL;
 	alsa_id->alsa_opened = 0;
+	alsa_id->alsa_configured = 0;
+	alsa_id->alsa_rate = 0;
+	alsa_id->alsa_quit = 0;
+	alsa_id->alsa_idle_since = time(NULL);
+	alsa_id->alsa_scratch = NULL;
+	alsa_id->alsa_scratch_size = 0;
 
 	MSG(1, "Opening ALSA sound output");
 
@@ -282,6 +373,15 @@ static AudioID *alsa_open(void **pars)
 		return NULL;
 	}
 
+	if (pthread_create(&alsa_id->alsa_idle_thread, NULL, _alsa_idle,
+			   alsa_id)) {
+		ERR("Cannot create the ALSA idle thread");
+		_alsa_close(alsa_id);
+		g_free(alsa_id->alsa_device_name);
+		g_free(alsa_id);
+		return NULL;
+	}
+
 	MSG(1, "Device '%s' initialized successfully.",
 	    alsa_id->alsa_device_name);
 
@@ -294,6 +394,12 @@ static int alsa_close(AudioID * id)
 	int err;
 	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
 
+	pthread_mutex_lock(&alsa_id->alsa_pipe_mutex);
+	alsa_id->alsa_quit = 1;
+	pthread_cond_signal(&alsa_id->alsa_idle_cond);
+	pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
+	pthread_join(alsa_id->alsa_idle_thread, NULL);
+
 	/* Close device */
 	if ((err = _alsa_close(alsa_id)) < 0) {
 		ERR("Cannot close audio device");
@@ -301,6 +407,7 @@ static int alsa_close(AudioID * id)
 	}
 	MSG(1, "ALSA closed.");
 
+	g_free(alsa_id->alsa_scratch);
 	g_free(alsa_id->alsa_device_name);
 	g_free(alsa_id);
 	id = NULL;
@@ -380,14 +487,26 @@ int wait_for_poll(spd_alsa_id_t * id, struct pollfd *alsa_poll_fds,
 }
 
 #define ERROR_EXIT() do {\
-	g_free(track_volume.samples); \
 	ERR("alsa_play() abnormal exit"); \
 	_alsa_close(alsa_id); \
 	return -1; \
 } while (0)
 
+/* Let alsa_idle_thread close the device after a failed alsa_begin */
+static int _alsa_begin_failed(spd_alsa_id_t * id)
+{
+	pthread_mutex_lock(&id->alsa_pipe_mutex);
+	id->alsa_opened = 0;
+	id->alsa_idle_since = time(NULL);
+	pthread_cond_signal(&id->alsa_idle_cond);
+	pthread_mutex_unlock(&id->alsa_pipe_mutex);
+
+	return -1;
+}
+
 /* Configure ALSA playback for the given configuration of track
-   But do not play anything yet */
+   But do not play anything yet.  The configuration is kept after alsa_end,
+   so that the next tracks of the same format start right away. */
 static int alsa_begin(AudioID * id, AudioTrack track)
 {
 	snd_pcm_format_t format;
@@ -397,6 +516,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 
 	snd_pcm_uframes_t period_size;
 	unsigned int sr;
+	char buf;
 
 	snd_pcm_state_t state;
 
@@ -407,16 +527,70 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 		return -1;
 	}
 
-	pthread_mutex_lock(&alsa_id->alsa_pipe_mutex);
-
 	MSG(2, "Start of playback on ALSA");
 
 	/* Is it not an empty track? */
 	/* Passing an empty track is not an error */
-	if (track.samples == NULL) {
-		pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
+	if (track.samples == NULL)
 		return 0;
+
+	/* Choose the correct format */
+	if (track.bits == 16) {
+		switch (alsa_id->id.format) {
+		case SPD_AUDIO_LE:
+			format = SND_PCM_FORMAT_S16_LE;
+			break;
+		case SPD_AUDIO_BE:
+			format = SND_PCM_FORMAT_S16_BE;
+			break;
+		default:
+			ERR("unknown audio format (%d)", alsa_id->id.format);
+			return -1;
+		}
+	} else if (track.bits == 8) {
+		format = SND_PCM_FORMAT_S8;
+	} else {
+		ERR("Unsupported sound data format, track.bits = %d",
+		    track.bits);
+		return -1;
+	}
+
+	pthread_mutex_lock(&alsa_id->alsa_pipe_mutex);
+
+	/* The device may have been closed while idle */
+	if (alsa_id->alsa_pcm == NULL && _alsa_open(alsa_id)) {
+		pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
+		return -1;
+	}
+
+	alsa_id->stop_requested = 0;
+
+	if (alsa_id->alsa_configured && alsa_id->alsa_format == format
+	    && alsa_id->alsa_rate == track.sample_rate
+	    && alsa_id->alsa_channels == track.num_channels) {
+		MSG(4, "Reusing the ALSA configuration");
+
+		/* Forget the stop requests of the previous playback */
+		while (read(alsa_id->alsa_stop_pipe[0], &buf, 1) > 0) ;
+
+		alsa_id->alsa_opened = 1;
+		pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
+
+		/* Draining the previous playback changed avail_min */
+		if ((err = snd_pcm_sw_params_set_avail_min(alsa_id->alsa_pcm,
+							   alsa_id->alsa_sw_params,
+							   alsa_id->alsa_avail_min)) < 0
+		    || (err = snd_pcm_sw_params(alsa_id->alsa_pcm,
+						alsa_id->alsa_sw_params)) < 0) {
+			ERR("Unable to set sw params for playback: %s\n",
+			    snd_strerror(err));
+			return _alsa_begin_failed(alsa_id);
+		}
+		goto prepare;
 	}
+
+	_alsa_unconfigure(alsa_id);
+
 	/* Allocate space for hw_params (description of the sound parameters) */
 	MSG(2, "Allocating new hw_params structure");
 	if ((err = snd_pcm_hw_params_malloc(&alsa_id->alsa_hw_params)) < 0) {
@@ -425,6 +599,9 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 		pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
 		return -1;
 	}
+	alsa_id->alsa_stop_pipe[0] = alsa_id->alsa_stop_pipe[1] = -1;
+	alsa_id->alsa_poll_fds = NULL;
+	alsa_id->alsa_configured = 1;
 
 	/* Initialize hw_params on our pcm */
 	if ((err =
@@ -436,13 +613,15 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 		return -1;
 	}
 
-	/* Create the pipe for communication about stop requests */
+	/* Create the pipe for communication about stop requests, its read
+	   end is emptied without blocking when the configuration is reused */
 	if (pipe(alsa_id->alsa_stop_pipe)) {
 		ERR("Stop pipe creation failed (%s)", strerror(errno));
+		alsa_id->alsa_stop_pipe[0] = alsa_id->alsa_stop_pipe[1] = -1;
 		pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
 		return -1;
 	}
-	alsa_id->stop_requested = 0;
+	fcntl(alsa_id->alsa_stop_pipe[0], F_SETFL, O_NONBLOCK);
 
 	/* Find how many descriptors we will get for poll() */
 	alsa_id->alsa_fd_count =
@@ -483,27 +662,6 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 	MSG(4, "PCM state before setting audio parameters: %s",
 	    snd_pcm_state_name(state));
 
-	/* Choose the correct format */
-	if (track.bits == 16) {
-		switch (alsa_id->id.format) {
-		case SPD_AUDIO_LE:
-			format = SND_PCM_FORMAT_S16_LE;
-			break;
-		case SPD_AUDIO_BE:
-			format = SND_PCM_FORMAT_S16_BE;
-			break;
-		default:
-			ERR("unknown audio format (%d)", alsa_id->id.format);
-			return -1;
-		}
-	} else if (track.bits == 8) {
-		format = SND_PCM_FORMAT_S8;
-	} else {
-		ERR("Unsupported sound data format, track.bits = %d",
-		    track.bits);
-		return -1;
-	}
-
 	/* Set access mode, bitrate, sample rate and channels */
 	MSG(4, "Setting access type to INTERLEAVED");
 	if ((err = snd_pcm_hw_params_set_access(alsa_id->alsa_pcm,
@@ -511,7 +669,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 						SND_PCM_ACCESS_RW_INTERLEAVED)
 	    ) < 0) {
 		ERR("Cannot set access type (%s)", snd_strerror(err));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	MSG(4, "Setting sample format to %s", snd_pcm_format_name(format));
@@ -520,7 +678,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 					  alsa_id->alsa_hw_params,
 					  format)) < 0) {
 		ERR("Cannot set sample format (%s)", snd_strerror(err));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	MSG(4, "Setting sample rate to %i", track.sample_rate);
@@ -531,7 +689,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 					     0)) < 0) {
 		ERR("Cannot set sample rate (%s)", snd_strerror(err));
 
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	MSG(4, "Setting channel count to %i", track.num_channels);
@@ -540,7 +698,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 					    alsa_id->alsa_hw_params,
 					    track.num_channels)) < 0) {
 		MSG(4, "cannot set channel count (%s)", snd_strerror(err));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	MSG(4, "Setting hardware parameters on the ALSA device");
@@ -549,7 +707,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 			       alsa_id->alsa_hw_params)) < 0) {
 		MSG(4, "cannot set parameters (%s) state=%s", snd_strerror(err),
 		    snd_pcm_state_name(snd_pcm_state(alsa_id->alsa_pcm)));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	/* Get the current swparams */
@@ -558,8 +716,10 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 				       alsa_id->alsa_sw_params)) < 0) {
 		ERR("Unable to determine current swparams for playback: %s\n",
 		    snd_strerror(err));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
+	snd_pcm_sw_params_get_avail_min(alsa_id->alsa_sw_params,
+					&alsa_id->alsa_avail_min);
 	//    MSG("Checking buffer size");
 	if ((err =
 	     snd_pcm_hw_params_get_buffer_size(alsa_id->alsa_hw_params,
@@ -567,7 +727,7 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 	    0) {
 		ERR("Unable to get buffer size for playback: %s\n",
 		    snd_strerror(err));
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 	MSG(4, "Buffer size on ALSA device is %d frames",
 	    (int)alsa_id->alsa_buffer_size);
@@ -585,12 +745,19 @@ static int alsa_begin(AudioID * id, AudioTrack track)
 	                                  0);
 	MSG(4, "Period size on ALSA device is %lu frames", (unsigned long) period_size);
 
+	/* Only now the configuration can be reused */
+	alsa_id->alsa_format = format;
+	alsa_id->alsa_rate = track.sample_rate;
+	alsa_id->alsa_hw_rate = sr;
+	alsa_id->alsa_channels = track.num_channels;
+
+prepare:
 	MSG(4, "Preparing device for playback");
 	if ((err = snd_pcm_prepare(alsa_id->alsa_pcm)) < 0) {
 		ERR("Cannot prepare audio interface for playback (%s)",
 		    snd_strerror(err));
 
-		return -1;
+		return _alsa_begin_failed(alsa_id);
 	}
 
 	return 0;
@@ -603,11 +770,7 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	int num_bytes;
 	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
 
-	AudioTrack track_volume;
-	float real_volume;
-	int i;
-
-	signed short *output_samples;
+	char *output_samples;
 
 	int err;
 	int ret;
@@ -623,16 +786,25 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	volume_size = bytes_per_sample * track.num_samples;
 	MSG(4, "volume size = %i", (int)volume_size);
 
-	/* Create a copy of track with adjusted volume. */
-	MSG(4, "Making copy of track and adjusting volume");
-	track_volume = track;
-	track_volume.samples = (short *)g_malloc(volume_size);
-	real_volume = ((float)alsa_id->id.volume + 100) / (float)200;
-	for (i = 0; i <= track.num_samples - 1; i++)
-		track_volume.samples[i] = track.samples[i] * real_volume;
+	/* Adjust the volume into a scratch buffer kept between tracks.  The
+	   track itself must stay untouched, modules may play it again. */
+	MSG(4, "Adjusting volume");
+	if (alsa_id->alsa_scratch_size < volume_size) {
+		alsa_id->alsa_scratch =
+		    g_realloc(alsa_id->alsa_scratch, volume_size);
+		alsa_id->alsa_scratch_size = volume_size;
+	}
+	if (track.bits == 16)
+		spd_dsp_gain_s16((int16_t *) track.samples,
+				 alsa_id->alsa_scratch, track.num_samples,
+				 alsa_id->id.volume);
+	else
+		spd_dsp_gain_s8((int8_t *) track.samples,
+				alsa_id->alsa_scratch, track.num_samples,
+				alsa_id->id.volume);
 
 	/* Loop until all samples are played on the device. */
-	output_samples = track_volume.samples;
+	output_samples = alsa_id->alsa_scratch;
 	num_bytes = volume_size;
 	MSG(4, "%d bytes to be played", num_bytes);
 	while (num_bytes > 0) {
@@ -680,7 +852,7 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 			num_bytes -=
 			    ret * bytes_per_sample * track.num_channels;
 			output_samples +=
-			    ret * bytes_per_sample * track.num_channels / 2;
+			    ret * bytes_per_sample * track.num_channels;
 		}
 
 		/* Report current state */
@@ -718,9 +890,6 @@ static int alsa_feed(AudioID * id, AudioTrack track)
 	}
 
 terminate:
-	if (track_volume.samples != NULL)
-		g_free(track_volume.samples);
-
 	return 0;
 }
 
@@ -893,34 +1062,52 @@ static int alsa_feed_sync_overlap(AudioID * id, AudioTrack track)
 	return alsa_drain_overlap(id, track);
 }
 
+static int alsa_get_delay(AudioID * id)
+{
+	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
+	snd_pcm_sframes_t delay;
+	int ret = -1;
+
+	pthread_mutex_lock(&alsa_id->alsa_pipe_mutex);
+	if (alsa_id->alsa_opened && alsa_id->alsa_pcm != NULL
+	    && alsa_id->alsa_rate != 0
+	    && snd_pcm_delay(alsa_id->alsa_pcm, &delay) == 0) {
+		if (delay < 0)
+			delay = 0;
+		ret = (gint64) delay * 1000000 / alsa_id->alsa_hw_rate;
+	}
+	pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
+
+	return ret;
+}
+
+/* Finish the playback, but keep the device configured for the next one,
+   alsa_idle_thread closes it if there is none for ALSA_IDLE_TIMEOUT */
 static int alsa_end(AudioID * id)
 {
 	spd_alsa_id_t *alsa_id = (spd_alsa_id_t *) id;
-	int err;
+	int err = 0;
+
+	/* The device was closed on a playback error */
+	if (alsa_id->alsa_pcm == NULL)
+		return -1;
 
 	if (!alsa_id->stop_requested)
 		alsa_drain(id);
 
 	err = snd_pcm_drop(alsa_id->alsa_pcm);
-	if (err < 0) {
+	if (err < 0)
 		ERR("snd_pcm_drop() failed: %s", snd_strerror(err));
-		return -1;
-	}
-
-	MSG(2, "Freeing HW parameters");
-	snd_pcm_hw_params_free(alsa_id->alsa_hw_params);
 
 	pthread_mutex_lock(&alsa_id->alsa_pipe_mutex);
 	alsa_id->alsa_opened = 0;
-	close(alsa_id->alsa_stop_pipe[0]);
-	close(alsa_id->alsa_stop_pipe[1]);
-
-	g_free(alsa_id->alsa_poll_fds);
+	alsa_id->alsa_idle_since = time(NULL);
+	pthread_cond_signal(&alsa_id->alsa_idle_cond);
 	pthread_mutex_unlock(&alsa_id->alsa_pipe_mutex);
 
 	MSG(1, "End of playback on ALSA");
 
-	return 0;
+	return err < 0 ? -1 : 0;
 }
 
 /* Play the track _track_ (see spd_audio.h) using the id->alsa_pcm device and
@@ -1022,6 +1209,7 @@ static spd_audio_plugin_t alsa_functions = {
 	alsa_feed_sync,
 	alsa_feed_sync_overlap,
 	alsa_end,
+	alsa_get_delay,
 };
 
 spd_audio_plugin_t *alsa_plugin_get(void)
@@ -1031,5 +1219,13 @@ spd_audio_plugin_t *alsa_plugin_get(void)
 
 spd_audio_plugin_t *SPD_AUDIO_PLUGIN_ENTRY(void)
     __attribute__ ((weak, alias("alsa_plugin_get")));
+
+int alsa_plugin_abi(void)
+{
+	return SPD_AUDIO_PLUGIN_ABI;
+}
+
+int SPD_AUDIO_PLUGIN_ABI_ENTRY(void)
+    __attribute__ ((weak, alias("alsa_plugin_abi")));
 #undef MSG
 #undef ERR
@@ -0,0 +1,575 @@
+/*
+ * null.c -- The null/file backend for the spd_audio library.
+ *
+ * Copyright (C) 2021 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* NOTE: This backend does not need any sound infrastructure. It either
+   discards the audio or writes it to a WAV or raw file, and simulates the
+   playback clock of a real device so that the callers block as long as they
+   would with real hardware (or a configurable factor less). This is meant for
+   headless benchmarks and for rendering speech to disk. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <glib.h>
+
+#define SPD_AUDIO_PLUGIN_ENTRY spd_null_LTX_spd_audio_plugin_get
+#include <spd_audio_plugin.h>
+#include <spd_probes.h>
+#include <spd_dsp.h>
+
+typedef struct {
+	AudioID id;
+	char *file_name;	/* file to write audio to, NULL to discard it */
+	FILE *file;
+	int wav;		/* whether to write a RIFF/WAVE container */
+	int file_bits;		/* format of the audio already in the file */
+	int file_channels;
+	int file_rate;
+	guint32 data_bytes;	/* bytes of audio data written to the file */
+	int skip;		/* current track can not be written to the file */
+	int speed;		/* playback speed factor, 0 to never wait */
+	int bits;		/* configuration given to null_begin() */
+	int num_channels;
+	int sample_rate;
+	struct timespec play_end;	/* when the fed audio will be played */
+	FILE *sound_log;	/* where to log when sound starts, or NULL */
+	int sound_found;	/* whether a non-silent sample was fed since begin */
+	int stop_requested;	/* whether we want to stop */
+	pthread_mutex_t null_mutex;	/* mutex to guard the playback clock */
+	pthread_cond_t null_cond;	/* to wake up waiters on stop */
+} spd_null_id_t;
+
+/* Overlap kept by null_feed_sync_overlap(), as the ALSA backend does */
+#define NULL_OVERLAP_MS 20
+
+/* Samples below this (in 16bit scale, about -40dBFS) are considered silent
+   when looking for the start of sound */
+#define NULL_SILENCE_THRESHOLD 328
+
+#define MSG(level, arg...) \
+	if(level <= null_log_level){ \
+		time_t t; \
+		struct timeval tv; \
+		char *tstr; \
+		t = time(NULL); \
+		tstr = g_strdup(ctime(&t)); \
+		tstr[strlen(tstr)-1] = 0; \
+		gettimeofday(&tv,NULL); \
+		fprintf(stderr," %s [%d]",tstr, (int) tv.tv_usec); \
+		fprintf(stderr," Null: "); \
+		fprintf(stderr,arg); \
+		fprintf(stderr,"\n"); \
+		fflush(stderr); \
+		g_free(tstr); \
+	}
+
+#define ERR(arg...) \
+	{ \
+		time_t t; \
+		struct timeval tv; \
+		char *tstr; \
+		t = time(NULL); \
+		tstr = g_strdup(ctime(&t)); \
+		tstr[strlen(tstr)-1] = 0; \
+		gettimeofday(&tv,NULL); \
+		fprintf(stderr," %s [%d]",tstr, (int) tv.tv_usec); \
+		fprintf(stderr," Null ERROR: "); \
+		fprintf(stderr,arg); \
+		fprintf(stderr,"\n"); \
+		fflush(stderr); \
+		g_free(tstr); \
+	}
+
+static int null_log_level;
+
+static void timespec_add_ns(struct timespec *ts, gint64 ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec -= 1;
+		ts->tv_nsec += 1000000000;
+	}
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec
+	    || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void put_le16(unsigned char *p, guint16 v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, guint32 v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+/* Write (or rewrite) the RIFF/WAVE header for the current file format and
+   amount of data */
+static int null_write_wav_header(spd_null_id_t * null_id)
+{
+	unsigned char header[44];
+	int block_align = null_id->file_channels * null_id->file_bits / 8;
+
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, 36 + null_id->data_bytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	put_le16(header + 20, 1);	/* PCM */
+	put_le16(header + 22, null_id->file_channels);
+	put_le32(header + 24, null_id->file_rate);
+	put_le32(header + 28, null_id->file_rate * block_align);
+	put_le16(header + 32, block_align);
+	put_le16(header + 34, null_id->file_bits);
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, null_id->data_bytes);
+
+	if (fseek(null_id->file, 0, SEEK_SET) < 0
+	    || fwrite(header, sizeof(header), 1, null_id->file) != 1) {
+		ERR("Can't write WAV header to %s", null_id->file_name);
+		return -1;
+	}
+	fseek(null_id->file, 0, SEEK_END);
+	return 0;
+}
+
+/* Write track samples to the file, converting to the WAV sample encoding
+   (little-endian signed 16bit or unsigned 8bit) if needed */
+static int null_write(spd_null_id_t * null_id, AudioTrack track)
+{
+	size_t num_bytes =
+	    (size_t) track.num_samples * track.num_channels * track.bits / 8;
+	unsigned char *buf = (unsigned char *)track.samples;
+	unsigned char *conv = NULL;
+	size_t i;
+	int ret = 0;
+
+	if (null_id->wav) {
+#if defined(BYTE_ORDER) && (BYTE_ORDER == BIG_ENDIAN)
+		int swap = track.bits == 16;
+#else
+		int swap = 0;
+#endif
+		if (swap) {
+			conv = g_malloc(num_bytes);
+			memcpy(conv, buf, num_bytes);
+			spd_dsp_swap_s16((int16_t *) conv, num_bytes / 2);
+			buf = conv;
+		} else if (track.bits == 8) {
+			conv = g_malloc(num_bytes);
+			for (i = 0; i < num_bytes; i++)
+				conv[i] = buf[i] ^ 0x80;
+			buf = conv;
+		}
+	}
+
+	if (fwrite(buf, 1, num_bytes, null_id->file) != num_bytes) {
+		ERR("Can't write audio to %s", null_id->file_name);
+		ret = -1;
+	} else {
+		null_id->data_bytes += num_bytes;
+	}
+
+	g_free(conv);
+	return ret;
+}
+
+/* Return the index of the first frame which is not silent, or -1 */
+static int null_find_sound(AudioTrack track)
+{
+	int n = track.num_samples * track.num_channels;
+	int i;
+
+	if (track.bits == 16) {
+		const gint16 *s = (const gint16 *)track.samples;
+		for (i = 0; i < n; i++)
+			if (s[i] > NULL_SILENCE_THRESHOLD
+			    || s[i] < -NULL_SILENCE_THRESHOLD)
+				return i / track.num_channels;
+	} else {
+		const gint8 *s = (const gint8 *)track.samples;
+		for (i = 0; i < n; i++)
+			if (s[i] > NULL_SILENCE_THRESHOLD / 256
+			    || s[i] < -NULL_SILENCE_THRESHOLD / 256)
+				return i / track.num_channels;
+	}
+	return -1;
+}
+
+/* Wait until the simulated device clock reaches `target', or a stop is
+   requested */
+static void null_wait_until(spd_null_id_t * null_id, struct timespec *target)
+{
+	struct timespec now;
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	while (!null_id->stop_requested) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!timespec_before(&now, target))
+			break;
+		pthread_cond_timedwait(&null_id->null_cond,
+				       &null_id->null_mutex, target);
+	}
+	pthread_mutex_unlock(&null_id->null_mutex);
+}
+
+/* Open the null device.
+
+  These parameters are passed in pars:
+  (char*) pars[6] ... name of the file to write audio to, ending with
+                      ".wav" to get a RIFF/WAVE file, and raw samples
+                      otherwise. NULL, "" or "none" to discard audio.
+  (char*) pars[7] ... speed factor of the simulated playback clock, 1 for
+                      real time, 0 to never wait
+  (void*) pars[8] ... =NULL
+
+  If the SPEECHD_NULL_SOUND_LOG environment variable is set, the CLOCK_MONOTONIC
+  time (in ns) at which the first non-silent sample of each track is played
+  is appended to that file, one line per track.  This is meant for
+  measuring latency up to the first audible sample.
+*/
+static AudioID *null_open(void **pars)
+{
+	spd_null_id_t *null_id;
+	pthread_condattr_t attr;
+	const char *file_name = pars[6];
+
+	null_id = (spd_null_id_t *) g_malloc0(sizeof(spd_null_id_t));
+
+	null_id->speed = 1;
+	if (pars[7] != NULL && atoi(pars[7]) >= 0)
+		null_id->speed = atoi(pars[7]);
+
+	if (file_name != NULL && file_name[0] && strcmp(file_name, "none")) {
+		null_id->file_name = g_strdup(file_name);
+		null_id->file = fopen(null_id->file_name, "wb");
+		if (null_id->file == NULL) {
+			ERR("Can't open %s for writing", null_id->file_name);
+			g_free(null_id->file_name);
+			g_free(null_id);
+			return NULL;
+		}
+		null_id->wav = g_str_has_suffix(null_id->file_name, ".wav");
+	}
+
+	if (g_getenv("SPEECHD_NULL_SOUND_LOG") != NULL) {
+		null_id->sound_log =
+		    fopen(g_getenv("SPEECHD_NULL_SOUND_LOG"), "a");
+		if (null_id->sound_log == NULL)
+			ERR("Can't open %s for writing",
+			    g_getenv("SPEECHD_NULL_SOUND_LOG"));
+	}
+
+	pthread_mutex_init(&null_id->null_mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&null_id->null_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	clock_gettime(CLOCK_MONOTONIC, &null_id->play_end);
+
+	MSG(1, "Null device opened, writing to %s at speed %d",
+	    null_id->file_name ? null_id->file_name : "nowhere",
+	    null_id->speed);
+
+	return (AudioID *) null_id;
+}
+
+static int null_begin(AudioID * id, AudioTrack track)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+
+	if (null_id == NULL)
+		return -1;
+
+	if (track.bits != 8 && track.bits != 16) {
+		ERR("Unsupported sound data format, track.bits = %d",
+		    track.bits);
+		return -1;
+	}
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	null_id->stop_requested = 0;
+	pthread_mutex_unlock(&null_id->null_mutex);
+
+	null_id->bits = track.bits;
+	null_id->num_channels = track.num_channels;
+	null_id->sample_rate = track.sample_rate;
+	null_id->skip = 0;
+	null_id->sound_found = 0;
+
+	if (null_id->file == NULL)
+		return 0;
+
+	if (null_id->file_rate == 0) {
+		null_id->file_bits = track.bits;
+		null_id->file_channels = track.num_channels;
+		null_id->file_rate = track.sample_rate;
+		if (null_id->wav)
+			return null_write_wav_header(null_id);
+	} else if (null_id->file_bits != track.bits
+		   || null_id->file_channels != track.num_channels
+		   || null_id->file_rate != track.sample_rate) {
+		MSG(2, "Track format %d bits %d channels %d Hz differs from file format, not writing it",
+		    track.bits, track.num_channels, track.sample_rate);
+		null_id->skip = 1;
+	}
+
+	return 0;
+}
+
+/* Write the track and advance the simulated device clock by its duration */
+static int null_feed(AudioID * id, AudioTrack track)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+	struct timespec now, sound;
+	gint64 duration;
+	int first = -1;
+
+	if (track.samples == NULL || track.num_samples <= 0)
+		return 0;
+
+	if (null_id->file != NULL && !null_id->skip)
+		if (null_write(null_id, track))
+			return -1;
+
+	if (null_id->sound_log != NULL && !null_id->sound_found) {
+		first = null_find_sound(track);
+		null_id->sound_found = first >= 0;
+	}
+
+	if (null_id->speed == 0 || track.sample_rate <= 0) {
+		if (first >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &sound);
+			goto log_sound;
+		}
+		return 0;
+	}
+
+	duration = (gint64) track.num_samples * 1000000000 /
+	    track.sample_rate / null_id->speed;
+
+	MSG(5, "Feeding %d samples, %" G_GINT64_FORMAT " ns",
+	    track.num_samples, duration);
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_before(&null_id->play_end, &now))
+		null_id->play_end = now;
+	sound = null_id->play_end;
+	timespec_add_ns(&null_id->play_end, duration);
+	pthread_mutex_unlock(&null_id->null_mutex);
+
+	if (first < 0)
+		return 0;
+
+	/* The first non-silent frame plays that long after the track starts */
+	timespec_add_ns(&sound, (gint64) first * 1000000000 /
+			track.sample_rate / null_id->speed);
+
+log_sound:
+	SPD_PROBE2(null_first_sound, sound.tv_sec, sound.tv_nsec);
+	fprintf(null_id->sound_log, "%" G_GINT64_FORMAT "\n",
+		(gint64) sound.tv_sec * 1000000000 + sound.tv_nsec);
+	fflush(null_id->sound_log);
+	return 0;
+}
+
+static int null_drain(AudioID * id)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+	struct timespec target;
+
+	if (null_id->speed == 0)
+		return 0;
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	target = null_id->play_end;
+	pthread_mutex_unlock(&null_id->null_mutex);
+
+	null_wait_until(null_id, &target);
+	return 0;
+}
+
+static int null_feed_sync(AudioID * id, AudioTrack track)
+{
+	int ret;
+
+	ret = null_feed(id, track);
+	if (ret)
+		return ret;
+
+	return null_drain(id);
+}
+
+/* Return when only NULL_OVERLAP_MS of (simulated) playback is left */
+static int null_feed_sync_overlap(AudioID * id, AudioTrack track)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+	struct timespec target;
+	int ret;
+
+	ret = null_feed(id, track);
+	if (ret)
+		return ret;
+
+	if (null_id->speed == 0)
+		return 0;
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	target = null_id->play_end;
+	pthread_mutex_unlock(&null_id->null_mutex);
+	timespec_add_ns(&target,
+			-(gint64) NULL_OVERLAP_MS * 1000000 / null_id->speed);
+
+	null_wait_until(null_id, &target);
+	return 0;
+}
+
+static int null_end(AudioID * id)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+
+	if (!null_id->stop_requested)
+		null_drain(id);
+
+	if (null_id->file != NULL) {
+		if (null_id->wav)
+			null_write_wav_header(null_id);
+		fflush(null_id->file);
+	}
+
+	MSG(2, "End of playback on null device");
+	return 0;
+}
+
+static int null_play(AudioID * id, AudioTrack track)
+{
+	int ret;
+
+	ret = null_begin(id, track);
+	if (ret)
+		return ret;
+
+	ret = null_feed_sync(id, track);
+	if (ret)
+		return ret;
+
+	return null_end(id);
+}
+
+/* Interrupt the simulated playback */
+static int null_stop(AudioID * id)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+
+	if (null_id == NULL)
+		return 0;
+
+	MSG(2, "STOP!");
+
+	pthread_mutex_lock(&null_id->null_mutex);
+	null_id->stop_requested = 1;
+	clock_gettime(CLOCK_MONOTONIC, &null_id->play_end);
+	pthread_cond_broadcast(&null_id->null_cond);
+	pthread_mutex_unlock(&null_id->null_mutex);
+
+	return 0;
+}
+
+static int null_close(AudioID * id)
+{
+	spd_null_id_t *null_id = (spd_null_id_t *) id;
+
+	if (null_id->file != NULL) {
+		if (null_id->wav && null_id->file_rate)
+			null_write_wav_header(null_id);
+		fclose(null_id->file);
+	}
+	if (null_id->sound_log != NULL)
+		fclose(null_id->sound_log);
+
+	pthread_cond_destroy(&null_id->null_cond);
+	pthread_mutex_destroy(&null_id->null_mutex);
+	g_free(null_id->file_name);
+	g_free(null_id);
+	id = NULL;
+
+	return 0;
+}
+
+static int null_set_volume(AudioID * id, int volume)
+{
+	return 0;
+}
+
+static void null_set_loglevel(int level)
+{
+	if (level) {
+		null_log_level = level;
+	}
+}
+
+static char const *null_get_playcmd(void)
+{
+	return "true";
+}
+
+/* Provide the null backend. */
+static spd_audio_plugin_t null_functions = {
+	"null",
+	null_open,
+	null_play,
+	null_stop,
+	null_close,
+	null_set_volume,
+	null_set_loglevel,
+	null_get_playcmd,
+	null_begin,
+	null_feed_sync,
+	null_feed_sync_overlap,
+	null_end,
+};
+
+spd_audio_plugin_t *null_plugin_get(void)
+{
+	return &null_functions;
+}
+
+spd_audio_plugin_t *SPD_AUDIO_PLUGIN_ENTRY(void)
+    __attribute__ ((weak, alias("null_plugin_get")));
+
+#undef MSG
+#undef ERR
@@ -41,6 +41,7 @@
 
 #define SPD_AUDIO_PLUGIN_ENTRY spd_oss_LTX_spd_audio_plugin_get
 #include <spd_audio_plugin.h>
+#include <spd_dsp.h>
 
 typedef struct {
 	AudioID id;
@@ -49,6 +50,8 @@ typedef struct {
 	pthread_mutex_t fd_mutex;
 	pthread_cond_t pt_cond;
 	pthread_mutex_t pt_mutex;
+	void *scratch;		/* samples with the volume applied */
+	size_t scratch_size;
 } spd_oss_id_t;
 
 static int _oss_open(spd_oss_id_t * id);
@@ -143,6 +146,8 @@ static AudioID *oss_open(void **pars)
 	oss_id = (spd_oss_id_t *) g_malloc(sizeof(spd_oss_id_t));
 
 	oss_id->device_name = g_strdup((char *)pars[0]);
+	oss_id->scratch = NULL;
+	oss_id->scratch_size = 0;
 
 	pthread_mutex_init(&oss_id->fd_mutex, NULL);
 
@@ -189,18 +194,14 @@ static int oss_play(AudioID * id, AudioTrack track)
 	int format, oformat, channels, speed;
 	int bytes_per_sample;
 	int num_bytes;
-	signed short *output_samples;
+	char *output_samples;
 	float delay = 0;
 	float DELAY = 0.1;	/* in seconds */
 	audio_buf_info info;
 	int bytes;
-	float real_volume;
-	int i;
 	int re;
 	spd_oss_id_t *oss_id = (spd_oss_id_t *) id;
 
-	AudioTrack track_volume;
-
 	if (oss_id == NULL)
 		return -1;
 
@@ -211,14 +212,6 @@ static int oss_play(AudioID * id, AudioTrack track)
 	if (ret)
 		return -2;
 
-	/* Create a copy of track with the adjusted volume */
-	track_volume = track;
-	track_volume.samples =
-	    (short *)g_malloc(sizeof(short) * track.num_samples);
-	real_volume = ((float)id->volume + 100) / (float)200;
-	for (i = 0; i <= track.num_samples - 1; i++)
-		track_volume.samples[i] = track.samples[i] * real_volume;
-
 	/* Choose the correct format */
 	if (track.bits == 16) {
 		format = AFMT_S16_NE;
@@ -279,12 +272,25 @@ static int oss_play(AudioID * id, AudioTrack track)
 		return 0;
 	}
 
+	/* Adjust the volume into a scratch buffer kept between tracks, the
+	   track itself must stay untouched */
+	num_bytes = track.num_samples * bytes_per_sample;
+	if (oss_id->scratch_size < num_bytes) {
+		oss_id->scratch = g_realloc(oss_id->scratch, num_bytes);
+		oss_id->scratch_size = num_bytes;
+	}
+	if (track.bits == 16)
+		spd_dsp_gain_s16((int16_t *) track.samples, oss_id->scratch,
+				 track.num_samples, id->volume);
+	else
+		spd_dsp_gain_s8((int8_t *) track.samples, oss_id->scratch,
+				track.num_samples, id->volume);
+
 	/* Loop until all samples are played on the device.
 	   In the meantime, wait in pthread_cond_timedwait for more data
 	   or for interruption. */
 	MSG(4, "Starting playback");
-	output_samples = track_volume.samples;
-	num_bytes = track.num_samples * bytes_per_sample;
+	output_samples = oss_id->scratch;
 	MSG(4, "bytes to play: %d, (%f secs)", num_bytes,
 	    (((float)(num_bytes) / 2) / (float)track.sample_rate));
 	while (num_bytes > 0) {
@@ -324,7 +330,7 @@ static int oss_play(AudioID * id, AudioTrack track)
 		}
 
 		num_bytes -= ret;
-		output_samples += ret / 2;
+		output_samples += ret;
 
 		MSG(4, "%d bytes written to OSS, %d remaining", ret, num_bytes);
 
@@ -417,9 +423,6 @@ static int oss_play(AudioID * id, AudioTrack track)
 	}
 	MSG(4, "End of wait");
 
-	if (track_volume.samples != NULL)
-		g_free(track_volume.samples);
-
 	/* Flush all the buffers */
 	_oss_sync(oss_id);
 
@@ -468,6 +471,7 @@ static int oss_close(AudioID * id)
 	/* Does nothing because the device is being automatically openned and
 	   closed in oss_play before and after playing each sample. */
 
+	g_free(oss_id->scratch);
 	g_free(oss_id->device_name);
 	g_free(oss_id);
 	id = NULL;
@@ -1,6 +1,6 @@
 
 /*
- * pulse.c -- The simple pulseaudio backend for the spd_audio library.
+ * pulse.c -- The pulseaudio backend for the spd_audio library.
  *
  * Copyright 2007-2009 Gilles Casse <gcasse@oralux.org>
  * Copyright 2008-2010 Brailcom, o.p.s
@@ -48,32 +48,54 @@
 #include <stdarg.h>
 #include <glib.h>
 
-#include <pulse/simple.h>
-#include <pulse/error.h>
+#include <pthread.h>
+#include <pulse/pulseaudio.h>
 
 #define SPD_AUDIO_PLUGIN_ENTRY spd_pulse_LTX_spd_audio_plugin_get
+#define SPD_AUDIO_PLUGIN_ABI_ENTRY spd_pulse_LTX_spd_audio_plugin_abi
 #include <spd_audio_plugin.h>
+#include <spd_dsp.h>
+
+/* NOTE: This backend plays through a pa_stream run by a threaded mainloop.
+   The stream is kept connected between playbacks: a change of sample rate
+   is applied to it with pa_stream_update_sample_rate(), and tracks of other
+   sample sizes or channel counts are converted to its format here.
+   Tracks given to pulse_submit() are copied and written from the write
+   callback, in the mainloop thread. */
 
 typedef struct {
 	AudioID id;
-	pa_simple *pa_simple;
+	pa_threaded_mainloop *pa_mainloop;
+	pa_context *pa_context;
+	pa_stream *pa_stream;
+	pa_sample_spec pa_spec;	/* format of pa_stream */
+	pthread_mutex_t pa_mutex;	/* guards opening and closing the above */
 	char *pa_server;
 	char *pa_device;
 	char *pa_name;
 	int pa_min_audio_length;	// in ms
-	volatile int pa_stop_playback;
-	int pa_current_rate;	// Sample rate for currently PA connection
-	int pa_current_bps;	// Bits per sample rate for currently PA connection
-	int pa_current_channels;	// Number of channels for currently PA connection
+	int pa_stop_playback;	/* guarded by the mainloop lock */
+	int pa_success;		/* result of the last operation waited for */
+	int16_t *pa_scratch;	/* converted samples */
+	size_t pa_scratch_size;
+	/* pulse_submitted_t not written yet, and their bytes left, guarded
+	   by the mainloop lock */
+	GQueue pa_submitted;
+	size_t pa_submitted_bytes;
 } spd_pulse_id_t;
 
-/* send a packet of XXX bytes to the sound device */
-#define PULSE_SEND_BYTES 256
+/* A track given to pulse_submit() */
+typedef struct {
+	char *data;
+	size_t bytes;
+	size_t written;
+	spd_audio_done_t done;
+	void *cookie;
+} pulse_submitted_t;
 
 /* Initial values, most often what synths will requests */
 #define DEF_RATE 44100
 #define DEF_CHANNELS 1
-#define DEF_BYTES_PER_SAMPLE 2
 
 /* This is the smallest audio sound we are expected to play immediately without buffering. */
 /* Changed to define on config file. Default is the same. */
@@ -117,34 +139,164 @@ static char const *pulse_play_cmd = "paplay -n speech-dispatcher-generic";
 		g_free(tstr); \
 	}
 
+/* Write as much of the submitted tracks as the stream has room for, with
+   the mainloop locked */
+static void pulse_write_submitted(spd_pulse_id_t * pulse_id)
+{
+	pulse_submitted_t *entry;
+	size_t writable;
+
+	while ((entry = g_queue_peek_head(&pulse_id->pa_submitted))
+	       && !pulse_id->pa_stop_playback) {
+		writable = pa_stream_writable_size(pulse_id->pa_stream);
+		if (writable == 0 || writable == (size_t) - 1)
+			break;
+		if (writable > entry->bytes - entry->written)
+			writable = entry->bytes - entry->written;
+
+		if (pa_stream_write(pulse_id->pa_stream,
+				    entry->data + entry->written, writable,
+				    NULL, 0, PA_SEEK_RELATIVE) < 0) {
+			MSG(4, "ERROR: Audio: pulse_write_submitted(): %s\n",
+			    pa_strerror(pa_context_errno(pulse_id->pa_context)));
+			break;
+		}
+		entry->written += writable;
+		pulse_id->pa_submitted_bytes -= writable;
+		if (entry->written < entry->bytes)
+			continue;
+
+		g_queue_pop_head(&pulse_id->pa_submitted);
+		entry->done(&pulse_id->id, entry->cookie);
+		g_free(entry->data);
+		g_free(entry);
+	}
+}
+
+/* Give back the submitted tracks not written yet, with the mainloop
+   locked */
+static void pulse_drop_submitted(spd_pulse_id_t * pulse_id)
+{
+	pulse_submitted_t *entry;
+
+	while ((entry = g_queue_pop_head(&pulse_id->pa_submitted))) {
+		entry->done(&pulse_id->id, entry->cookie);
+		g_free(entry->data);
+		g_free(entry);
+	}
+	pulse_id->pa_submitted_bytes = 0;
+}
+
+/* The callbacks just wake up whoever waits in the mainloop, the write
+   callback also writing the submitted tracks */
+static void pulse_context_state_cb(pa_context * c, void *data)
+{
+	spd_pulse_id_t *pulse_id = data;
+
+	pa_threaded_mainloop_signal(pulse_id->pa_mainloop, 0);
+}
+
+static void pulse_stream_state_cb(pa_stream * s, void *data)
+{
+	spd_pulse_id_t *pulse_id = data;
+
+	pa_threaded_mainloop_signal(pulse_id->pa_mainloop, 0);
+}
+
+static void pulse_stream_write_cb(pa_stream * s, size_t length, void *data)
+{
+	spd_pulse_id_t *pulse_id = data;
+
+	pulse_write_submitted(pulse_id);
+	pa_threaded_mainloop_signal(pulse_id->pa_mainloop, 0);
+}
+
+static void pulse_stream_success_cb(pa_stream * s, int success, void *data)
+{
+	spd_pulse_id_t *pulse_id = data;
+
+	pulse_id->pa_success = success;
+	pa_threaded_mainloop_signal(pulse_id->pa_mainloop, 0);
+}
+
+/* Wait for the operation _op_ to complete, with the mainloop locked.
+   Returns 0 on success, 1 if it was abandoned because of pulse_stop() and
+   -1 on failure. */
+static int pulse_wait_operation(spd_pulse_id_t * pulse_id, pa_operation * op)
+{
+	int ret;
+
+	if (op == NULL)
+		return -1;
+
+	pulse_id->pa_success = 0;
+	while (pa_operation_get_state(op) == PA_OPERATION_RUNNING
+	       && !pulse_id->pa_stop_playback)
+		pa_threaded_mainloop_wait(pulse_id->pa_mainloop);
+
+	if (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+		pa_operation_cancel(op);
+		ret = 1;
+	} else {
+		ret = pulse_id->pa_success ? 0 : -1;
+	}
+	pa_operation_unref(op);
+
+	return ret;
+}
+
+/* Close the connection to the server.  Does not free the AudioID struct. */
+/* Usable in pulse_begin, which reopens connections on failure. */
+static void pulse_connection_close(spd_pulse_id_t * pulse_id)
+{
+	if (pulse_id->pa_mainloop == NULL)
+		return;
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	pulse_drop_submitted(pulse_id);
+	if (pulse_id->pa_stream != NULL) {
+		pa_stream_disconnect(pulse_id->pa_stream);
+		pa_stream_unref(pulse_id->pa_stream);
+		pulse_id->pa_stream = NULL;
+	}
+	if (pulse_id->pa_context != NULL) {
+		pa_context_disconnect(pulse_id->pa_context);
+		pa_context_unref(pulse_id->pa_context);
+		pulse_id->pa_context = NULL;
+	}
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	pa_threaded_mainloop_stop(pulse_id->pa_mainloop);
+	pa_threaded_mainloop_free(pulse_id->pa_mainloop);
+	pulse_id->pa_mainloop = NULL;
+}
+
 static int _pulse_open(spd_pulse_id_t * id, int sample_rate,
-		       int num_channels, int bytes_per_sample)
+		       int num_channels)
 {
 	pa_buffer_attr buffAttr;
 	pa_sample_spec ss;
-	int error;
+	pa_context_state_t cstate;
+	pa_stream_state_t sstate;
 	char *client_name;
 
 	ss.rate = sample_rate;
 	ss.channels = num_channels;
-	if (bytes_per_sample == 2) {
-		switch (id->id.format) {
-		case SPD_AUDIO_LE:
-			ss.format = PA_SAMPLE_S16LE;
-			break;
-		case SPD_AUDIO_BE:
-			ss.format = PA_SAMPLE_S16BE;
-			break;
-		}
-	} else {
-		ss.format = PA_SAMPLE_U8;
+	switch (id->id.format) {
+	case SPD_AUDIO_LE:
+		ss.format = PA_SAMPLE_S16LE;
+		break;
+	case SPD_AUDIO_BE:
+		ss.format = PA_SAMPLE_S16BE;
+		break;
 	}
 
-	/* Set prebuf to one sample so that keys are spoken as soon as typed rather than delayed until the next key pressed */
+	/* Ask for the configured end-to-end latency, and set prebuf to one
+	   frame so that keys are spoken as soon as typed rather than delayed
+	   until the next key pressed */
 	buffAttr.maxlength = (uint32_t) - 1;
-	//buffAttr.tlength = (uint32_t)-1; - this is the default, which causes key echo to not work properly.
-	buffAttr.tlength = id->pa_min_audio_length * sample_rate * num_channels * bytes_per_sample / 1000;
-	buffAttr.prebuf = (uint32_t) - 1;
+	buffAttr.tlength = pa_usec_to_bytes(id->pa_min_audio_length * 1000, &ss);
+	buffAttr.prebuf = pa_frame_size(&ss);
 	buffAttr.minreq = (uint32_t) - 1;
 	buffAttr.fragsize = (uint32_t) - 1;
 
@@ -152,30 +304,87 @@ static int _pulse_open(spd_pulse_id_t * id, int sample_rate,
 	    asprintf(&client_name, "speech-dispatcher-%s", id->pa_name) < 0)
 		client_name = strdup("speech-dispatcher");
 
-	/* Open new connection */
-	if (!
-	    (id->pa_simple =
-	     pa_simple_new(id->pa_server, client_name,
-			   PA_STREAM_PLAYBACK, id->pa_device, "playback",
-			   &ss, NULL, &buffAttr, &error))) {
-		fprintf(stderr, __FILE__ ": pa_simple_new() failed: %s\n",
-			pa_strerror(error));
+	id->pa_mainloop = pa_threaded_mainloop_new();
+	if (id->pa_mainloop == NULL) {
+		ERR("pa_threaded_mainloop_new() failed");
 		free(client_name);
 		return 1;
 	}
+
+	/* Open new connection */
+	id->pa_context =
+	    pa_context_new(pa_threaded_mainloop_get_api(id->pa_mainloop),
+			   client_name);
 	free(client_name);
-	return 0;
-}
+	if (id->pa_context == NULL) {
+		ERR("pa_context_new() failed");
+		pulse_connection_close(id);
+		return 1;
+	}
+	pa_context_set_state_callback(id->pa_context, pulse_context_state_cb,
+				      id);
+	if (pa_context_connect(id->pa_context, id->pa_server,
+			       PA_CONTEXT_NOFLAGS, NULL) < 0) {
+		ERR("pa_context_connect() failed: %s",
+		    pa_strerror(pa_context_errno(id->pa_context)));
+		pulse_connection_close(id);
+		return 1;
+	}
 
-/* Close the connection to the server.  Does not free the AudioID struct. */
-/* Usable in pulse_play, which closes connections on failure or */
-/* changes in audio parameters. */
-static void pulse_connection_close(spd_pulse_id_t * pulse_id)
-{
-	if (pulse_id->pa_simple != NULL) {
-		pa_simple_free(pulse_id->pa_simple);
-		pulse_id->pa_simple = NULL;
+	pa_threaded_mainloop_lock(id->pa_mainloop);
+	if (pa_threaded_mainloop_start(id->pa_mainloop) < 0) {
+		ERR("pa_threaded_mainloop_start() failed");
+		goto fail;
+	}
+
+	while ((cstate = pa_context_get_state(id->pa_context))
+	       != PA_CONTEXT_READY) {
+		if (!PA_CONTEXT_IS_GOOD(cstate)) {
+			ERR("Cannot connect to the server: %s",
+			    pa_strerror(pa_context_errno(id->pa_context)));
+			goto fail;
+		}
+		pa_threaded_mainloop_wait(id->pa_mainloop);
+	}
+
+	id->pa_stream = pa_stream_new(id->pa_context, "playback", &ss, NULL);
+	if (id->pa_stream == NULL) {
+		ERR("pa_stream_new() failed: %s",
+		    pa_strerror(pa_context_errno(id->pa_context)));
+		goto fail;
+	}
+	pa_stream_set_state_callback(id->pa_stream, pulse_stream_state_cb, id);
+	pa_stream_set_write_callback(id->pa_stream, pulse_stream_write_cb, id);
+
+	if (pa_stream_connect_playback(id->pa_stream, id->pa_device, &buffAttr,
+				       PA_STREAM_ADJUST_LATENCY |
+				       PA_STREAM_VARIABLE_RATE |
+				       PA_STREAM_INTERPOLATE_TIMING |
+				       PA_STREAM_AUTO_TIMING_UPDATE, NULL,
+				       NULL) < 0) {
+		ERR("pa_stream_connect_playback() failed: %s",
+		    pa_strerror(pa_context_errno(id->pa_context)));
+		goto fail;
+	}
+
+	while ((sstate = pa_stream_get_state(id->pa_stream))
+	       != PA_STREAM_READY) {
+		if (!PA_STREAM_IS_GOOD(sstate)) {
+			ERR("Cannot connect the stream: %s",
+			    pa_strerror(pa_context_errno(id->pa_context)));
+			goto fail;
+		}
+		pa_threaded_mainloop_wait(id->pa_mainloop);
 	}
+
+	id->pa_spec = ss;
+	pa_threaded_mainloop_unlock(id->pa_mainloop);
+	return 0;
+
+fail:
+	pa_threaded_mainloop_unlock(id->pa_mainloop);
+	pulse_connection_close(id);
+	return 1;
 }
 
 static AudioID *pulse_open(void **pars)
@@ -196,16 +405,15 @@ static AudioID *pulse_open(void **pars)
 #else
 	pulse_id->id.format = SPD_AUDIO_LE;
 #endif
-	pulse_id->pa_simple = NULL;
+	pulse_id->pa_mainloop = NULL;
+	pulse_id->pa_context = NULL;
+	pulse_id->pa_stream = NULL;
+	pthread_mutex_init(&pulse_id->pa_mutex, NULL);
 	pulse_id->pa_server = NULL;
 	pulse_id->pa_device = (char *)pars[3];
 	pulse_id->pa_name = (char *)pars[5];
 	pulse_id->pa_min_audio_length = DEFAULT_PA_MIN_AUDIO_LENGTH;
 
-	pulse_id->pa_current_rate = -1;
-	pulse_id->pa_current_bps = -1;
-	pulse_id->pa_current_channels = -1;
-
 	if (!strcmp(pulse_id->pa_device, "default")) {
 		pulse_id->pa_device = NULL;
 	}
@@ -214,9 +422,14 @@ static AudioID *pulse_open(void **pars)
 		pulse_id->pa_min_audio_length = atoi(pars[4]);
 
 	pulse_id->pa_stop_playback = 0;
+	pulse_id->pa_scratch = NULL;
+	pulse_id->pa_scratch_size = 0;
+	g_queue_init(&pulse_id->pa_submitted);
+	pulse_id->pa_submitted_bytes = 0;
 
-	ret = _pulse_open(pulse_id, DEF_RATE, DEF_CHANNELS, DEF_BYTES_PER_SAMPLE);
+	ret = _pulse_open(pulse_id, DEF_RATE, DEF_CHANNELS);
 	if (ret) {
+		pthread_mutex_destroy(&pulse_id->pa_mutex);
 		g_free(pulse_id);
 		pulse_id = NULL;
 	}
@@ -224,89 +437,377 @@ static AudioID *pulse_open(void **pars)
 	return (AudioID *) pulse_id;
 }
 
-static int pulse_play(AudioID * id, AudioTrack track)
+/* Whether the stream can be played on, with the mainloop locked */
+static int pulse_connected(spd_pulse_id_t * pulse_id)
+{
+	return pulse_id->pa_stream != NULL
+	    && pa_context_get_state(pulse_id->pa_context) == PA_CONTEXT_READY
+	    && pa_stream_get_state(pulse_id->pa_stream) == PA_STREAM_READY;
+}
+
+/* Get the stream ready for playing tracks like _track_, reconnecting only
+   if the connection broke or the server can't change the rate */
+static int pulse_begin(AudioID * id, AudioTrack track)
 {
-	int bytes_per_sample;
-	int num_bytes;
-	int outcnt = 0;
-	signed short *output_samples;
-	int i;
-	int error;
 	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	int connected;
+	int ret;
 
 	if (id == NULL) {
 		return -1;
 	}
-	if (track.samples == NULL || track.num_samples <= 0) {
-		return 0;
-	}
-	MSG(4, "Starting playback\n");
-	/* Choose the correct format */
-	if (track.bits == 16) {
-		bytes_per_sample = 2;
-	} else if (track.bits == 8) {
-		bytes_per_sample = 1;
-	} else {
+	if (track.bits != 16 && track.bits != 8) {
 		ERR("ERROR: Unsupported sound data format, track.bits = %d\n",
 		    track.bits);
 		return -1;
 	}
-	output_samples = track.samples;
-	num_bytes = track.num_samples * bytes_per_sample;
+	MSG(4, "Starting playback\n");
+
+	pthread_mutex_lock(&pulse_id->pa_mutex);
 
-	/* Check if the current connection has suitable parameters for this track */
-	if (pulse_id->pa_current_rate != track.sample_rate
-	    || pulse_id->pa_current_bps != track.bits
-	    || pulse_id->pa_current_channels != track.num_channels) {
-		MSG(4, "Reopening connection due to change in track parameters sample_rate:%d bps:%d channels:%d\n", track.sample_rate, track.bits, track.num_channels);
-		/* Close old connection if any */
+	connected = 0;
+	if (pulse_id->pa_mainloop != NULL) {
+		pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+		connected = pulse_connected(pulse_id);
+		pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+	}
+	if (!connected) {
+		MSG(4, "Reopening connection, sample_rate:%d channels:%d\n",
+		    track.sample_rate, track.num_channels);
 		pulse_connection_close(pulse_id);
-		/* Open a new connection */
-		error = _pulse_open(pulse_id, track.sample_rate, track.num_channels,
-			    bytes_per_sample);
-		if (error) {
-			pulse_id->pa_current_rate = -1;
-			pulse_id->pa_current_bps = -1;
-			pulse_id->pa_current_channels = -1;
+		if (_pulse_open(pulse_id, track.sample_rate, track.num_channels)) {
+			pthread_mutex_unlock(&pulse_id->pa_mutex);
 			return -1;
 		}
-		/* Keep track of current connection parameters */
-		pulse_id->pa_current_rate = track.sample_rate;
-		pulse_id->pa_current_bps = track.bits;
-		pulse_id->pa_current_channels = track.num_channels;
 	}
-	MSG(4, "bytes to play: %d, (%f secs)\n", num_bytes,
-	    (((float)(num_bytes) / 2) / (float)track.sample_rate));
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
 	pulse_id->pa_stop_playback = 0;
-	outcnt = 0;
-	i = 0;
-	while ((outcnt < num_bytes) && !pulse_id->pa_stop_playback) {
-		if ((num_bytes - outcnt) > PULSE_SEND_BYTES) {
-			i = PULSE_SEND_BYTES;
-		} else {
-			i = (num_bytes - outcnt);
-		}
-		if (pa_simple_write
-		    (pulse_id->pa_simple, ((char *)output_samples) + outcnt, i,
-		     &error) < 0) {
-			pa_simple_drain(pulse_id->pa_simple, NULL);
+
+	if (pulse_id->pa_spec.rate != track.sample_rate) {
+		MSG(4, "Changing sample rate to %d\n", track.sample_rate);
+		ret = pulse_wait_operation(pulse_id,
+					   pa_stream_update_sample_rate
+					   (pulse_id->pa_stream,
+					    track.sample_rate,
+					    pulse_stream_success_cb, pulse_id));
+		if (ret < 0) {
+			MSG(4, "Cannot change the sample rate, reopening connection\n");
+			pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
 			pulse_connection_close(pulse_id);
-			MSG(4, "ERROR: Audio: pulse_play(): %s - closing device - re-open it in next run\n", pa_strerror(error));
-			break;
-		} else {
-			MSG(5, "Pulse: wrote %u bytes\n", i);
+			if (_pulse_open(pulse_id, track.sample_rate,
+					track.num_channels)) {
+				pthread_mutex_unlock(&pulse_id->pa_mutex);
+				return -1;
+			}
+			pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+		} else if (ret == 0) {
+			pulse_id->pa_spec.rate = track.sample_rate;
 		}
-		outcnt += i;
+		/* Otherwise pulse_stop cancelled it, the next one tries again */
 	}
+
+	/* pulse_end corked it */
+	if (pa_stream_is_corked(pulse_id->pa_stream) > 0)
+		pa_operation_unref(pa_stream_cork(pulse_id->pa_stream, 0,
+						  NULL, NULL));
+
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+	pthread_mutex_unlock(&pulse_id->pa_mutex);
+
 	return 0;
 }
 
-/* stop the pulse_play() loop */
+/* Return the samples of _track_ in the format of the stream, either
+   track.samples or the scratch buffer */
+static void *pulse_convert(spd_pulse_id_t * pulse_id, AudioTrack * track,
+			   size_t *bytes)
+{
+	int in_channels = track->num_channels;
+	int out_channels = pulse_id->pa_spec.channels;
+	size_t frames = track->num_samples / in_channels;
+	size_t needed;
+	int16_t *in, *out;
+	size_t f;
+	int c, sum;
+
+	if (track->bits == 16 && in_channels == out_channels) {
+		*bytes = track->num_samples * 2;
+		return track->samples;
+	}
+
+	/* Room for the 16bit samples followed by the converted channels */
+	needed = frames * (in_channels + out_channels) * sizeof(int16_t);
+	if (pulse_id->pa_scratch_size < needed) {
+		pulse_id->pa_scratch = g_realloc(pulse_id->pa_scratch, needed);
+		pulse_id->pa_scratch_size = needed;
+	}
+
+	in = (int16_t *) track->samples;
+	if (track->bits == 8) {
+		spd_dsp_s8_to_s16((int8_t *) track->samples,
+				  pulse_id->pa_scratch, frames * in_channels);
+		in = pulse_id->pa_scratch;
+	}
+
+	out = pulse_id->pa_scratch + frames * in_channels;
+	if (in_channels == out_channels) {
+		out = in;
+	} else if (in_channels == 1 && out_channels == 2) {
+		spd_dsp_mono_to_stereo_s16(in, out, frames);
+	} else if (in_channels == 2 && out_channels == 1) {
+		spd_dsp_stereo_to_mono_s16(in, out, frames);
+	} else {
+		for (f = 0; f < frames; f++) {
+			if (out_channels == 1) {
+				/* Downmix */
+				sum = 0;
+				for (c = 0; c < in_channels; c++)
+					sum += in[f * in_channels + c];
+				out[f] = sum / in_channels;
+				continue;
+			}
+			for (c = 0; c < out_channels; c++)
+				out[f * out_channels + c] =
+				    in[f * in_channels + c % in_channels];
+		}
+	}
+	*bytes = frames * out_channels * sizeof(*out);
+
+	return out;
+}
+
+/* Write _track_ to the stream as soon as there is room for it */
+static int pulse_feed(AudioID * id, AudioTrack track)
+{
+	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	const char *output_samples;
+	size_t num_bytes, writable;
+	int ret = 0;
+
+	if (id == NULL) {
+		return -1;
+	}
+	if (track.samples == NULL || track.num_samples <= 0) {
+		return 0;
+	}
+	/* pulse_begin failed to connect */
+	if (pulse_id->pa_mainloop == NULL) {
+		return -1;
+	}
+
+	output_samples = pulse_convert(pulse_id, &track, &num_bytes);
+	MSG(4, "bytes to play: %lu, (%f secs)\n", (unsigned long)num_bytes,
+	    (float)track.num_samples / track.num_channels / track.sample_rate);
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	while (num_bytes > 0 && !pulse_id->pa_stop_playback) {
+		if (!pulse_connected(pulse_id)) {
+			MSG(4, "ERROR: Audio: pulse_feed(): %s - reconnecting in next run\n",
+			    pa_strerror(pa_context_errno(pulse_id->pa_context)));
+			ret = -1;
+			break;
+		}
+
+		/* Keep the order with the submitted tracks */
+		writable = pa_stream_writable_size(pulse_id->pa_stream);
+		if (writable == 0
+		    || !g_queue_is_empty(&pulse_id->pa_submitted)) {
+			pa_threaded_mainloop_wait(pulse_id->pa_mainloop);
+			continue;
+		}
+		if (writable > num_bytes)
+			writable = num_bytes;
+
+		if (pa_stream_write(pulse_id->pa_stream, output_samples,
+				    writable, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+			MSG(4, "ERROR: Audio: pulse_feed(): %s - reconnecting in next run\n",
+			    pa_strerror(pa_context_errno(pulse_id->pa_context)));
+			ret = -1;
+			break;
+		}
+		MSG(5, "Pulse: wrote %lu bytes\n", (unsigned long)writable);
+		output_samples += writable;
+		num_bytes -= writable;
+	}
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	return ret;
+}
+
+/* Wait until everything written was played, or pulse_stop() */
+static int pulse_drain(spd_pulse_id_t * pulse_id)
+{
+	int ret = 0;
+
+	if (pulse_id->pa_mainloop == NULL)
+		return -1;
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	while (!g_queue_is_empty(&pulse_id->pa_submitted)
+	       && !pulse_id->pa_stop_playback && pulse_connected(pulse_id))
+		pa_threaded_mainloop_wait(pulse_id->pa_mainloop);
+	if (!g_queue_is_empty(&pulse_id->pa_submitted)
+	    && !pulse_id->pa_stop_playback) {
+		/* Disconnected */
+		pulse_drop_submitted(pulse_id);
+		ret = -1;
+	} else if (!pulse_id->pa_stop_playback && pulse_connected(pulse_id))
+		ret = pulse_wait_operation(pulse_id,
+					   pa_stream_drain(pulse_id->pa_stream,
+							   pulse_stream_success_cb,
+							   pulse_id));
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static int pulse_feed_sync(AudioID * id, AudioTrack track)
+{
+	int ret;
+
+	ret = pulse_feed(id, track);
+	if (ret)
+		return ret;
+
+	return pulse_drain((spd_pulse_id_t *) id);
+}
+
+/* The stream buffers only about pa_min_audio_length of audio, which is
+   the overlap the caller needs, so we just don't drain it */
+static int pulse_feed_sync_overlap(AudioID * id, AudioTrack track)
+{
+	return pulse_feed(id, track);
+}
+
+/* Queue a copy of _track_, written from the write callback as the stream
+   gets room for it */
+static int pulse_submit(AudioID * id, AudioTrack track,
+			spd_audio_done_t done, void *cookie)
+{
+	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	pulse_submitted_t *entry;
+	const char *output_samples;
+	size_t num_bytes;
+	int ret = 0;
+
+	if (id == NULL || pulse_id->pa_mainloop == NULL)
+		return -1;
+
+	entry = g_new0(pulse_submitted_t, 1);
+	entry->done = done;
+	entry->cookie = cookie;
+	if (track.samples != NULL && track.num_samples > 0) {
+		output_samples = pulse_convert(pulse_id, &track, &num_bytes);
+		entry->data = g_malloc(num_bytes);
+		memcpy(entry->data, output_samples, num_bytes);
+		entry->bytes = num_bytes;
+	}
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	if (!pulse_connected(pulse_id)) {
+		MSG(4, "ERROR: Audio: pulse_submit(): %s - reconnecting in next run\n",
+		    pa_strerror(pa_context_errno(pulse_id->pa_context)));
+		g_free(entry->data);
+		g_free(entry);
+		ret = -1;
+	} else {
+		g_queue_push_tail(&pulse_id->pa_submitted, entry);
+		pulse_id->pa_submitted_bytes += entry->bytes;
+		if (pulse_id->pa_stop_playback)
+			pulse_drop_submitted(pulse_id);
+		else
+			pulse_write_submitted(pulse_id);
+	}
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	return ret;
+}
+
+/* The stream interpolates its timing info, so this does not need a round
+   trip to the server */
+static int pulse_get_delay(AudioID * id)
+{
+	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	pa_usec_t latency;
+	int negative;
+	int ret = -1;
+
+	if (id == NULL || pulse_id->pa_mainloop == NULL)
+		return -1;
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	if (pulse_connected(pulse_id)
+	    && pa_stream_get_latency(pulse_id->pa_stream, &latency,
+				     &negative) == 0)
+		ret = MIN((negative ? 0 : latency)
+			  + pa_bytes_to_usec(pulse_id->pa_submitted_bytes,
+					     &pulse_id->pa_spec), G_MAXINT);
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	return ret;
+}
+
+/* Drain the stream and cork it until the next pulse_begin, but keep it
+   connected */
+static int pulse_end(AudioID * id)
+{
+	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
+	int ret;
+
+	if (id == NULL || pulse_id->pa_mainloop == NULL) {
+		return -1;
+	}
+
+	ret = pulse_drain(pulse_id);
+
+	pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+	if (pulse_connected(pulse_id))
+		pa_operation_unref(pa_stream_cork(pulse_id->pa_stream, 1,
+						  NULL, NULL));
+	pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+
+	return ret;
+}
+
+static int pulse_play(AudioID * id, AudioTrack track)
+{
+	int ret;
+
+	if (track.samples == NULL || track.num_samples <= 0) {
+		return 0;
+	}
+
+	ret = pulse_begin(id, track);
+	if (ret)
+		return ret;
+
+	ret = pulse_feed_sync(id, track);
+	if (ret)
+		return ret;
+
+	return pulse_end(id);
+}
+
+/* Stop the playback right away: drop what the server has buffered and
+   interrupt pulse_feed() or pulse_drain() */
 static int pulse_stop(AudioID * id)
 {
 	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
 
-	pulse_id->pa_stop_playback = 1;
+	pthread_mutex_lock(&pulse_id->pa_mutex);
+	if (pulse_id->pa_mainloop != NULL) {
+		pa_threaded_mainloop_lock(pulse_id->pa_mainloop);
+		pulse_id->pa_stop_playback = 1;
+		pulse_drop_submitted(pulse_id);
+		if (pulse_connected(pulse_id))
+			pa_operation_unref(pa_stream_flush
+					   (pulse_id->pa_stream, NULL, NULL));
+		pa_threaded_mainloop_signal(pulse_id->pa_mainloop, 0);
+		pa_threaded_mainloop_unlock(pulse_id->pa_mainloop);
+	}
+	pthread_mutex_unlock(&pulse_id->pa_mutex);
+
 	return 0;
 }
 
@@ -314,6 +815,8 @@ static int pulse_close(AudioID * id)
 {
 	spd_pulse_id_t *pulse_id = (spd_pulse_id_t *) id;
 	pulse_connection_close(pulse_id);
+	pthread_mutex_destroy(&pulse_id->pa_mutex);
+	g_free(pulse_id->pa_scratch);
 	g_free(pulse_id);
 	id = NULL;
 
@@ -346,7 +849,13 @@ static spd_audio_plugin_t pulse_functions = {
 	pulse_close,
 	pulse_set_volume,
 	pulse_set_loglevel,
-	pulse_get_playcmd
+	pulse_get_playcmd,
+	pulse_begin,
+	pulse_feed_sync,
+	pulse_feed_sync_overlap,
+	pulse_end,
+	pulse_get_delay,
+	pulse_submit,
 };
 
 spd_audio_plugin_t *pulse_plugin_get(void)
@@ -357,5 +866,13 @@ spd_audio_plugin_t *pulse_plugin_get(void)
 spd_audio_plugin_t *SPD_AUDIO_PLUGIN_ENTRY(void)
     __attribute__ ((weak, alias("pulse_plugin_get")));
 
+int pulse_plugin_abi(void)
+{
+	return SPD_AUDIO_PLUGIN_ABI;
+}
+
+int SPD_AUDIO_PLUGIN_ABI_ENTRY(void)
+    __attribute__ ((weak, alias("pulse_plugin_abi")));
+
 #undef MSG
 #undef ERR
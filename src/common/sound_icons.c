@@ -0,0 +1,328 @@
+/*
+ * sound_icons.c - Cache of decoded sound icons
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sndfile.h>
+
+#include "common.h"
+#include "spd_resample.h"
+#include "sound_icons.h"
+
+#define DBG_MODNAME "sound_icons"
+
+#define SOUND_ICONS_DEFAULT_SIZE (4 * 1024 * 1024)
+/* Frames of silence covering the delay of the resampler */
+#define SOUND_ICONS_PADDING 128
+
+typedef struct {
+	AudioTrack track;	/* First, see sound_icons_release() */
+	char *filename;		/* Real path of the file */
+	size_t bytes;
+	int refs;		/* One is held by the cache */
+	GList *link;		/* In sound_icons_lru, NULL if not cached */
+} SoundIcon;
+
+static pthread_mutex_t sound_icons_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable *sound_icons;	/* filename -> SoundIcon */
+static GQueue sound_icons_lru = G_QUEUE_INIT;	/* Most recently used first */
+static size_t sound_icons_bytes;
+static size_t sound_icons_max = SOUND_ICONS_DEFAULT_SIZE;
+
+/* Called with sound_icons_mutex held, or on an icon not shared yet */
+static void sound_icon_unref(SoundIcon * icon)
+{
+	if (--icon->refs > 0)
+		return;
+	g_free(icon->track.samples);
+	g_free(icon->filename);
+	g_free(icon);
+}
+
+/* Read the whole file as native-endian 16bit samples */
+static SoundIcon *sound_icon_decode(const char *filename)
+{
+	SoundIcon *icon;
+	SNDFILE *sf;
+	SF_INFO sfinfo;
+	sf_count_t items, readcount;
+	int subformat;
+
+	memset(&sfinfo, 0, sizeof(sfinfo));
+	sf = sf_open(filename, SFM_READ, &sfinfo);
+	if (NULL == sf) {
+		DBG(DBG_MODNAME " %s: %s", filename, sf_strerror(NULL));
+		return NULL;
+	}
+	if (sfinfo.channels < 1 || sfinfo.channels > 2) {
+		DBG(DBG_MODNAME " ERROR: channels = %d.", sfinfo.channels);
+		sf_close(sf);
+		return NULL;
+	}
+	if (sfinfo.frames > 0x7FFFFFFF / sfinfo.channels || sfinfo.frames == 0) {
+		DBG(DBG_MODNAME " ERROR: Unknown number of frames.");
+		sf_close(sf);
+		return NULL;
+	}
+
+	subformat = sfinfo.format & SF_FORMAT_SUBMASK;
+	if (subformat == SF_FORMAT_FLOAT || subformat == SF_FORMAT_DOUBLE) {
+		/* Set scaling for float to integer conversion. */
+		sf_command(sf, SFC_SET_SCALE_FLOAT_INT_READ, NULL, SF_TRUE);
+	}
+
+	items = sfinfo.channels * sfinfo.frames;
+	icon = g_new0(SoundIcon, 1);
+	icon->refs = 1;
+	icon->track.bits = 16;
+	icon->track.num_channels = sfinfo.channels;
+	icon->track.sample_rate = sfinfo.samplerate;
+	icon->track.samples = g_malloc(items * sizeof(short));
+	readcount = sf_read_short(sf, icon->track.samples, items);
+	sf_close(sf);
+	DBG(DBG_MODNAME " Read %lld items from %s.", (long long)readcount,
+	    filename);
+
+	if (readcount <= 0) {
+		sound_icon_unref(icon);
+		return NULL;
+	}
+	icon->track.num_samples = readcount - readcount % sfinfo.channels;
+	icon->bytes = icon->track.num_samples * sizeof(short);
+	return icon;
+}
+
+/* With sound_icons_mutex held */
+static void sound_icon_uncache(SoundIcon * icon)
+{
+	g_hash_table_remove(sound_icons, icon->filename);
+	g_queue_delete_link(&sound_icons_lru, icon->link);
+	icon->link = NULL;
+	sound_icons_bytes -= icon->bytes;
+	sound_icon_unref(icon);
+}
+
+/* With sound_icons_mutex held, replaces any icon of the same file */
+static void sound_icon_cache(SoundIcon * icon)
+{
+	SoundIcon *old;
+	GList *last;
+
+	if (icon->bytes > sound_icons_max)
+		return;
+
+	old = g_hash_table_lookup(sound_icons, icon->filename);
+	if (old)
+		sound_icon_uncache(old);
+	while (sound_icons_bytes + icon->bytes > sound_icons_max
+	       && (last = g_queue_peek_tail_link(&sound_icons_lru)))
+		sound_icon_uncache(last->data);
+
+	icon->refs++;
+	g_queue_push_head(&sound_icons_lru, icon);
+	icon->link = g_queue_peek_head_link(&sound_icons_lru);
+	g_hash_table_insert(sound_icons, icon->filename, icon);
+	sound_icons_bytes += icon->bytes;
+}
+
+/* Convert icon to the output format of id, or return it */
+static SoundIcon *sound_icon_convert(SoundIcon * icon, AudioID * id)
+{
+	AudioTrack format = spd_audio_output_format(id, icon->track);
+	SPDResampler *resampler;
+	SoundIcon *converted;
+	AudioTrack track;
+	short *padded;
+	int padding;
+
+	if (format.sample_rate == icon->track.sample_rate
+	    && format.num_channels == icon->track.num_channels
+	    && format.bits == icon->track.bits)
+		return icon;
+
+	/* Pad with silence so that the filter delay does not cut the end */
+	track = icon->track;
+	padding = SOUND_ICONS_PADDING * track.num_channels;
+	track.samples = g_malloc0((track.num_samples + padding) * sizeof(short));
+	memcpy(track.samples, icon->track.samples,
+	       track.num_samples * sizeof(short));
+	track.num_samples += padding;
+
+	resampler = spd_resampler_new(format.sample_rate, format.num_channels);
+	padded = track.samples;
+	track = spd_resampler_process(resampler, track);
+	converted = g_new0(SoundIcon, 1);
+	converted->refs = 1;
+	converted->filename = g_strdup(icon->filename);
+	converted->track = track;
+	converted->bytes = track.num_samples * sizeof(short);
+	converted->track.samples = g_malloc(converted->bytes);
+	memcpy(converted->track.samples, track.samples, converted->bytes);
+	spd_resampler_free(resampler);
+	g_free(padded);
+
+	DBG(DBG_MODNAME " Converted %s from %d Hz to %d Hz.", icon->filename,
+	    icon->track.sample_rate, converted->track.sample_rate);
+	return converted;
+}
+
+const AudioTrack *sound_icons_get(const char *filename, AudioID * id)
+{
+	SoundIcon *icon, *converted;
+	char *path;
+
+	path = realpath(filename, NULL);
+	if (path == NULL) {
+		DBG(DBG_MODNAME " Can't find %s.", filename);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&sound_icons_mutex);
+	if (sound_icons == NULL)
+		sound_icons = g_hash_table_new(g_str_hash, g_str_equal);
+	icon = g_hash_table_lookup(sound_icons, path);
+	if (icon) {
+		icon->refs++;
+		g_queue_unlink(&sound_icons_lru, icon->link);
+		g_queue_push_head_link(&sound_icons_lru, icon->link);
+	}
+	pthread_mutex_unlock(&sound_icons_mutex);
+
+	if (icon == NULL) {
+		icon = sound_icon_decode(path);
+		if (icon == NULL) {
+			free(path);
+			return NULL;
+		}
+		icon->filename = g_strdup(path);
+		pthread_mutex_lock(&sound_icons_mutex);
+		sound_icon_cache(icon);
+		pthread_mutex_unlock(&sound_icons_mutex);
+	}
+	free(path);
+
+	if (id == NULL)
+		return &icon->track;
+
+	/* Keep the converted samples instead if the icon is still cached,
+	   so that the conversion is done once */
+	converted = sound_icon_convert(icon, id);
+	if (converted != icon) {
+		pthread_mutex_lock(&sound_icons_mutex);
+		if (icon->link)
+			sound_icon_cache(converted);
+		sound_icon_unref(icon);
+		pthread_mutex_unlock(&sound_icons_mutex);
+	}
+	return &converted->track;
+}
+
+void sound_icons_release(const AudioTrack * track)
+{
+	pthread_mutex_lock(&sound_icons_mutex);
+	sound_icon_unref((SoundIcon *) track);
+	pthread_mutex_unlock(&sound_icons_mutex);
+}
+
+void sound_icons_set_cache_size(size_t bytes)
+{
+	GList *last;
+
+	pthread_mutex_lock(&sound_icons_mutex);
+	sound_icons_max = bytes;
+	while (sound_icons_bytes > sound_icons_max
+	       && (last = g_queue_peek_tail_link(&sound_icons_lru)))
+		sound_icon_uncache(last->data);
+	pthread_mutex_unlock(&sound_icons_mutex);
+}
+
+static void *sound_icons_preload_thread(void *data)
+{
+	char *dirname = data;
+	const char *name;
+	const AudioTrack *track;
+	char *filename;
+	GDir *dir;
+	gboolean full;
+
+	dir = g_dir_open(dirname, 0, NULL);
+	if (dir == NULL) {
+		DBG(DBG_MODNAME " Can't open %s.", dirname);
+		g_free(dirname);
+		return NULL;
+	}
+
+	while ((name = g_dir_read_name(dir))) {
+		if (name[0] == '.')
+			continue;
+		filename = g_build_filename(dirname, name, NULL);
+		if (g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
+			track = sound_icons_get(filename, NULL);
+			if (track)
+				sound_icons_release(track);
+		}
+		g_free(filename);
+
+		pthread_mutex_lock(&sound_icons_mutex);
+		full = sound_icons_bytes >= sound_icons_max;
+		pthread_mutex_unlock(&sound_icons_mutex);
+		if (full)
+			break;
+	}
+	DBG(DBG_MODNAME " Preloaded %lu bytes of sound icons from %s.",
+	    (unsigned long)sound_icons_bytes, dirname);
+
+	g_dir_close(dir);
+	g_free(dirname);
+	return NULL;
+}
+
+void sound_icons_preload(const char *dirname)
+{
+	pthread_t thread;
+	char *dir;
+
+	if (dirname == NULL || dirname[0] == '\0' || sound_icons_max == 0)
+		return;
+
+	dir = g_strdup(dirname);
+	if (spd_pthread_create(&thread, NULL, sound_icons_preload_thread, dir)) {
+		DBG(DBG_MODNAME " Can't create the preload thread.");
+		g_free(dir);
+		return;
+	}
+	pthread_detach(thread);
+}
+
+gboolean sound_icons_play(AudioID * id, const char *filename)
+{
+	const AudioTrack *track = sound_icons_get(filename, id);
+
+	if (track == NULL)
+		return FALSE;
+	if (spd_audio_play(id, *track, id->format))
+		DBG(DBG_MODNAME " Can't play %s.", filename);
+	sound_icons_release(track);
+	return TRUE;
+}
@@ -0,0 +1,54 @@
+/*
+ * sound_icons.h - Cache of decoded sound icons
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sound icons are short and played very often, e.g. on each focus change.
+ * They are decoded once and kept in memory, up to a given size, the least
+ * recently played ones being dropped first.  An icon is converted to the
+ * output format of the audio device the first time it is played on it, see
+ * spd_audio_set_output_format().
+ */
+
+#ifndef __SOUND_ICONS_H
+#define __SOUND_ICONS_H
+
+#include <stddef.h>
+#include <glib.h>
+
+#include "spd_audio.h"
+
+/* Set the memory the cache may use, in bytes, 0 disabling it.  The least
+   recently played icons beyond it are dropped. */
+void sound_icons_set_cache_size(size_t bytes);
+
+/* Decode the files of dirname into the cache, in a background thread,
+   until it is full */
+void sound_icons_preload(const char *dirname);
+
+/* Return the samples of filename, in the output format of id if not NULL.
+   The track has to be given back with sound_icons_release().  Returns NULL
+   if the file cannot be decoded. */
+const AudioTrack *sound_icons_get(const char *filename, AudioID * id);
+void sound_icons_release(const AudioTrack * track);
+
+/* Play filename on id, blocking until it is played or spd_audio_stop().
+   Returns FALSE if the file cannot be decoded. */
+gboolean sound_icons_play(AudioID * id, const char *filename);
+
+#endif /* __SOUND_ICONS_H */
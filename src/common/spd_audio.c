@@ -34,6 +34,9 @@
 #endif
 
 #include "spd_audio.h"
+#include "spd_probes.h"
+#include "spd_dsp.h"
+#include "spd_resample.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -52,6 +55,38 @@
 static int spd_audio_log_level;
 static lt_dlhandle lt_h;
 
+/* What id->private_data points to */
+typedef struct {
+	int abi;		/* SPD_AUDIO_PLUGIN_ABI of the plugin */
+	SPDResampler *resampler;	/* NULL if tracks are played as they are */
+
+	/* Cookies of the tracks given to submit() that the plugin is done
+	   with, with one byte in done_pipe for each */
+	pthread_mutex_t done_mutex;
+	GQueue done;
+	int done_pipe[2];
+} spd_audio_private_t;
+
+#define PRIVATE(id) ((spd_audio_private_t *) (id)->private_data)
+/* Whether the table of the plugin has the members of that version */
+#define HAS_ABI(id, version) (PRIVATE(id)->abi >= (version))
+
+/* Called by the plugin, from any thread */
+static void spd_audio_done(AudioID * id, void *cookie)
+{
+	spd_audio_private_t *priv = PRIVATE(id);
+	char c = 0;
+
+	/* Both under the lock, so that spd_audio_get_done() never finds the
+	   cookie without its byte */
+	pthread_mutex_lock(&priv->done_mutex);
+	g_queue_push_tail(&priv->done, cookie);
+	if (write(priv->done_pipe[1], &c, 1) != 1)
+		fprintf(stderr, "Can't notify audio completion: %s\n",
+			strerror(errno));
+	pthread_mutex_unlock(&priv->done_mutex);
+}
+
 /* Dynamically load a library with RTLD_GLOBAL set.
 
    This is needed when a dynamically-loaded library has its own plugins
@@ -94,6 +129,7 @@ AudioID *spd_audio_open(const char *name, void **pars, char **error)
 	AudioID *id;
 	spd_audio_plugin_t const *p;
 	spd_audio_plugin_t *(*fn) (void);
+	int (*abi) (void);
 	gchar *libname;
 	int ret;
 
@@ -141,6 +177,20 @@ AudioID *spd_audio_open(const char *name, void **pars, char **error)
 	}
 
 	id->function = p;
+	id->private_data = g_new0(spd_audio_private_t, 1);
+	abi = lt_dlsym(lt_h, SPD_AUDIO_PLUGIN_ABI_STR);
+	PRIVATE(id)->abi = abi != NULL ? abi() : 0;
+	pthread_mutex_init(&PRIVATE(id)->done_mutex, NULL);
+	g_queue_init(&PRIVATE(id)->done);
+	PRIVATE(id)->done_pipe[0] = PRIVATE(id)->done_pipe[1] = -1;
+	if (HAS_ABI(id, 2) && p->submit) {
+		if (pipe(PRIVATE(id)->done_pipe) == 0) {
+			fcntl(PRIVATE(id)->done_pipe[0], F_SETFL, O_NONBLOCK);
+		} else {
+			fprintf(stderr, "Can't create audio completion pipe: %s\n",
+				strerror(errno));
+		}
+	}
 #if defined(BYTE_ORDER) && (BYTE_ORDER == BIG_ENDIAN)
 	id->format = SPD_AUDIO_BE;
 #else
@@ -175,6 +225,11 @@ int spd_audio_begin(AudioID * id, AudioTrack track, AudioFormat format)
 		return 0;
 	}
 
+	if (PRIVATE(id)->resampler) {
+		spd_resampler_reset(PRIVATE(id)->resampler);
+		track = spd_resampler_format(PRIVATE(id)->resampler, track);
+	}
+
 	return id->function->begin(id, track);
 }
 
@@ -183,19 +238,9 @@ static void spd_audio_convert(AudioID * id, AudioTrack track, AudioFormat format
 {
 	/* Only perform byte swapping if the driver in use has given us audio in
 	   an endian format other than what the running CPU supports. */
-	if (format != id->format && track.bits == 16) {
-		unsigned char *out_ptr, *out_end, c;
-		out_ptr = (unsigned char *)track.samples;
-		out_end =
-		    out_ptr +
-		    track.num_samples * 2 * track.num_channels;
-		while (out_ptr < out_end) {
-			c = out_ptr[0];
-			out_ptr[0] = out_ptr[1];
-			out_ptr[1] = c;
-			out_ptr += 2;
-		}
-	}
+	if (format != id->format && track.bits == 16)
+		spd_dsp_swap_s16((int16_t *) track.samples,
+				 track.num_samples * track.num_channels);
 }
 
 /* Feed a track to the audio device (blocking).
@@ -228,6 +273,14 @@ int spd_audio_feed_sync(AudioID * id, AudioTrack track, AudioFormat format)
 	}
 
 	spd_audio_convert(id, track, format);
+	SPD_PROBE3(audio_fed, id->function->name, track.num_samples,
+		   track.sample_rate);
+
+	if (PRIVATE(id)->resampler) {
+		track = spd_resampler_process(PRIVATE(id)->resampler, track);
+		if (track.num_samples == 0)
+			return 0;
+	}
 
 	if (id->function->feed_sync) {
 		return id->function->feed_sync(id, track);
@@ -271,6 +324,14 @@ int spd_audio_feed_sync_overlap(AudioID * id, AudioTrack track, AudioFormat form
 	}
 
 	spd_audio_convert(id, track, format);
+	SPD_PROBE3(audio_fed, id->function->name, track.num_samples,
+		   track.sample_rate);
+
+	if (PRIVATE(id)->resampler) {
+		track = spd_resampler_process(PRIVATE(id)->resampler, track);
+		if (track.num_samples == 0)
+			return 0;
+	}
 
 	if (id->function->feed_sync_overlap) {
 		return id->function->feed_sync_overlap(id, track);
@@ -288,6 +349,96 @@ int spd_audio_feed_sync_overlap(AudioID * id, AudioTrack track, AudioFormat form
 	return -1;
 }
 
+/* Queue a track for playing on the audio device (non-blocking).
+
+   Arguments:
+   id -- the AudioID* of the device returned by spd_audio_open
+   track -- a track to play (see spd_audio.h), which can be reused as soon
+            as this returns
+   cookie -- what spd_audio_get_done() returns once the device does not
+            need the track any more
+
+   Return value:
+   0 if the track was queued, a non-zero value in case of failure, in
+   which case cookie will not be returned.
+
+   Comment:
+   This is an alternative to spd_audio_feed_sync_overlap(), between
+   spd_audio_begin() and spd_audio_end(), for the devices for which
+   spd_audio_can_submit() is true.  Tracks are played in the order they are
+   submitted.  The event fd of the device gets readable when
+   spd_audio_get_done() has a cookie to return, which happens once the
+   track was handed to the device, or dropped by spd_audio_stop(), so that
+   the caller can keep a few tracks in flight and wait for several devices
+   from one thread.  spd_audio_get_delay() tells when they will be heard,
+   and spd_audio_end() waits for them to be played.
+*/
+int spd_audio_submit(AudioID * id, AudioTrack track, AudioFormat format,
+		     void *cookie)
+{
+	if (!spd_audio_can_submit(id))
+		return -1;
+
+	spd_audio_convert(id, track, format);
+	SPD_PROBE3(audio_fed, id->function->name, track.num_samples,
+		   track.sample_rate);
+
+	if (PRIVATE(id)->resampler) {
+		track = spd_resampler_process(PRIVATE(id)->resampler, track);
+		if (track.num_samples == 0) {
+			/* Nothing to hand to the device */
+			spd_audio_done(id, cookie);
+			return 0;
+		}
+	}
+
+	return id->function->submit(id, track, spd_audio_done, cookie);
+}
+
+/* Whether spd_audio_submit() can be used on the device id */
+int spd_audio_can_submit(AudioID * id)
+{
+	return id && HAS_ABI(id, 2) && id->function->submit
+	    && PRIVATE(id)->done_pipe[0] >= 0;
+}
+
+/* Return the fd which is readable when spd_audio_get_done() has cookies
+   to return, or -1 if the device doesn't support spd_audio_submit() */
+int spd_audio_get_event_fd(AudioID * id)
+{
+	if (!spd_audio_can_submit(id))
+		return -1;
+	return PRIVATE(id)->done_pipe[0];
+}
+
+/* Get the cookie of a submitted track the device is done with.
+
+   Return value:
+   1 if *cookie was set, 0 if there is none for now.
+*/
+int spd_audio_get_done(AudioID * id, void **cookie)
+{
+	spd_audio_private_t *priv;
+	char c;
+	int ret = 0;
+
+	if (!spd_audio_can_submit(id))
+		return 0;
+
+	priv = PRIVATE(id);
+	pthread_mutex_lock(&priv->done_mutex);
+	if (!g_queue_is_empty(&priv->done)) {
+		*cookie = g_queue_pop_head(&priv->done);
+		/* Written by spd_audio_done() along with the cookie */
+		while (read(priv->done_pipe[0], &c, 1) < 0 && errno == EINTR)
+			;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&priv->done_mutex);
+
+	return ret;
+}
+
 /* Finish playing a track on the audio device.
 
    Arguments:
@@ -313,6 +464,27 @@ int spd_audio_end(AudioID * id)
 	return id->function->end(id);
 }
 
+/* Get how long the audio fed so far will take to be heard.
+
+   Arguments:
+   id -- the AudioID* of the device returned by spd_audio_open
+
+   Return value:
+   The delay in microseconds, or a negative value if the backend
+   can't tell it.
+
+   Comment:
+   It is meant to be called between spd_audio_begin() and
+   spd_audio_end(), from the thread feeding the audio.
+*/
+int spd_audio_get_delay(AudioID * id)
+{
+	if (!id || !HAS_ABI(id, 1) || !id->function->get_delay)
+		return -1;
+
+	return id->function->get_delay(id);
+}
+
 /* Play a track on the audio device (blocking).
 
    Arguments:
@@ -375,6 +547,7 @@ int spd_audio_stop(AudioID * id)
 {
 	int ret;
 	if (id && id->function->stop) {
+		SPD_PROBE1(audio_stop, id->function->name);
 		ret = id->function->stop(id);
 	} else {
 		fprintf(stderr, "Stop not supported on this device\n");
@@ -400,9 +573,21 @@ Comments:
 int spd_audio_close(AudioID * id)
 {
 	int ret = 0;
+	spd_audio_private_t *priv = id ? PRIVATE(id) : NULL;
+
 	if (id && id->function->close) {
 		ret = (id->function->close(id));
 	}
+	if (priv) {
+		spd_resampler_free(priv->resampler);
+		if (priv->done_pipe[0] >= 0) {
+			close(priv->done_pipe[0]);
+			close(priv->done_pipe[1]);
+		}
+		g_queue_clear(&priv->done);
+		pthread_mutex_destroy(&priv->done_mutex);
+		g_free(priv);
+	}
 
 	if (NULL != lt_h) {
 		lt_dlclose(lt_h);
@@ -413,6 +598,49 @@ int spd_audio_close(AudioID * id)
 	return ret;
 }
 
+/* Convert all tracks played on the device id to one format
+
+Arguments:
+   id -- the AudioID* of the device returned by spd_audio_open
+   sample_rate -- the rate tracks are resampled to, 0 to keep their rate
+   num_channels -- the number of channels tracks are converted to,
+             0 to keep their channels
+
+Return value:
+   0 if everything is ok, a non-zero value in case of failure.
+
+Comments:
+
+   Tracks are also converted to 16bit samples.  With a fixed format,
+   the backend can keep the device open while the voices and sound
+   icons played through it change.  Passing 0 for both disables the
+   conversion.
+*/
+int spd_audio_set_output_format(AudioID * id, int sample_rate,
+				int num_channels)
+{
+	if (!id || sample_rate < 0 || num_channels < 0)
+		return -1;
+
+	spd_resampler_free(PRIVATE(id)->resampler);
+	PRIVATE(id)->resampler = NULL;
+	if (sample_rate || num_channels)
+		PRIVATE(id)->resampler =
+		    spd_resampler_new(sample_rate, num_channels);
+	return 0;
+}
+
+/* Return the format track is played in on the device id, without samples */
+AudioTrack spd_audio_output_format(AudioID * id, AudioTrack track)
+{
+	if (id && PRIVATE(id)->resampler)
+		return spd_resampler_format(PRIVATE(id)->resampler, track);
+
+	track.num_samples = 0;
+	track.samples = NULL;
+	return track;
+}
+
 /* Set volume for playing tracks on the device id
 
 Arguments:
@@ -40,11 +40,22 @@ int spd_audio_begin(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_feed_sync(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_feed_sync_overlap(AudioID * id, AudioTrack track, AudioFormat format);
 int spd_audio_end(AudioID * id);
+int spd_audio_get_delay(AudioID * id);
+
+int spd_audio_can_submit(AudioID * id);
+int spd_audio_submit(AudioID * id, AudioTrack track, AudioFormat format,
+		     void *cookie);
+int spd_audio_get_event_fd(AudioID * id);
+int spd_audio_get_done(AudioID * id, void **cookie);
 
 int spd_audio_stop(AudioID * id);
 
 int spd_audio_close(AudioID * id);
 
+int spd_audio_set_output_format(AudioID * id, int sample_rate,
+				int num_channels);
+AudioTrack spd_audio_output_format(AudioID * id, AudioTrack track);
+
 int spd_audio_set_volume(AudioID * id, int volume);
 
 void spd_audio_set_loglevel(AudioID * id, int level);
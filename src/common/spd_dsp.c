@@ -0,0 +1,575 @@
+/*
+ * spd_dsp.c - Sample processing kernels shared by the audio backends
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each kernel has a plain C version, which the vector versions also use for
+ * the samples left over after their last full vector.  The gain is applied
+ * in Q15 fixed point with rounding, which all versions compute exactly the
+ * same way.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <pthread.h>
+
+#include "spd_dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPD_DSP_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SPD_DSP_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+	const char *name;
+	void (*gain_s16) (const int16_t * in, int16_t * out, size_t n, int g);
+	void (*swap_s16) (int16_t * buf, size_t n);
+	void (*s8_to_s16) (const int8_t * in, int16_t * out, size_t n);
+	void (*s16_to_s8) (const int16_t * in, int8_t * out, size_t n);
+	void (*mono_to_stereo) (const int16_t * in, int16_t * out, size_t n);
+	void (*stereo_to_mono) (const int16_t * in, int16_t * out, size_t n);
+	int32_t(*dot_s16) (const int16_t * a, const int16_t * b, size_t n);
+} SPDDSPKernels;
+
+/* Plain C */
+
+static void gain_s16_c(const int16_t * in, int16_t * out, size_t n, int g)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = (in[i] * g + (1 << 14)) >> 15;
+}
+
+static void swap_s16_c(int16_t * buf, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		buf[i] = (uint16_t) buf[i] >> 8 | (uint16_t) buf[i] << 8;
+}
+
+static void s8_to_s16_c(const int8_t * in, int16_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = in[i] * 256;
+}
+
+static void s16_to_s8_c(const int16_t * in, int8_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = in[i] >> 8;
+}
+
+static void mono_to_stereo_c(const int16_t * in, int16_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[2 * i] = out[2 * i + 1] = in[i];
+}
+
+static void stereo_to_mono_c(const int16_t * in, int16_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		out[i] = (in[2 * i] + in[2 * i + 1]) >> 1;
+}
+
+static int32_t dot_s16_c(const int16_t * a, const int16_t * b, size_t n)
+{
+	int32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+static const SPDDSPKernels kernels_c = {
+	"c", gain_s16_c, swap_s16_c, s8_to_s16_c, s16_to_s8_c,
+	mono_to_stereo_c, stereo_to_mono_c, dot_s16_c
+};
+
+#ifdef SPD_DSP_X86
+
+/* SSE2 */
+
+__attribute__ ((target("sse2")))
+static void gain_s16_sse2(const int16_t * in, int16_t * out, size_t n, int g)
+{
+	/* g in the low half of each 32bit lane, so that madd computes x * g */
+	const __m128i gv = _mm_set1_epi32(g);
+	const __m128i round = _mm_set1_epi32(1 << 14);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm_loadu_si128((const __m128i *)(in + i));
+		lo = _mm_madd_epi16(_mm_unpacklo_epi16(x, zero), gv);
+		hi = _mm_madd_epi16(_mm_unpackhi_epi16(x, zero), gv);
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(lo, hi));
+	}
+	gain_s16_c(in + i, out + i, n - i, g);
+}
+
+__attribute__ ((target("sse2")))
+static void swap_s16_sse2(int16_t * buf, size_t n)
+{
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm_loadu_si128((const __m128i *)(buf + i));
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		_mm_storeu_si128((__m128i *) (buf + i), x);
+	}
+	swap_s16_c(buf + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static void s8_to_s16_sse2(const int8_t * in, int16_t * out, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		x = _mm_loadu_si128((const __m128i *)(in + i));
+		/* Each byte becomes the high byte of a sample */
+		_mm_storeu_si128((__m128i *) (out + i),
+				 _mm_unpacklo_epi8(zero, x));
+		_mm_storeu_si128((__m128i *) (out + i + 8),
+				 _mm_unpackhi_epi8(zero, x));
+	}
+	s8_to_s16_c(in + i, out + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static void s16_to_s8_sse2(const int16_t * in, int8_t * out, size_t n)
+{
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(in + i)),
+				   8);
+		b = _mm_srai_epi16(_mm_loadu_si128
+				   ((const __m128i *)(in + i + 8)), 8);
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi16(a, b));
+	}
+	s16_to_s8_c(in + i, out + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static void mono_to_stereo_sse2(const int16_t * in, int16_t * out, size_t n)
+{
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *) (out + 2 * i),
+				 _mm_unpacklo_epi16(x, x));
+		_mm_storeu_si128((__m128i *) (out + 2 * i + 8),
+				 _mm_unpackhi_epi16(x, x));
+	}
+	mono_to_stereo_c(in + i, out + 2 * i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static void stereo_to_mono_sse2(const int16_t * in, int16_t * out, size_t n)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i a, b;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		/* madd with 1 adds the two channels of each frame */
+		a = _mm_madd_epi16(_mm_loadu_si128
+				   ((const __m128i *)(in + 2 * i)), one);
+		b = _mm_madd_epi16(_mm_loadu_si128
+				   ((const __m128i *)(in + 2 * i + 8)), one);
+		a = _mm_srai_epi32(a, 1);
+		b = _mm_srai_epi32(b, 1);
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(a, b));
+	}
+	stereo_to_mono_c(in + 2 * i, out + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+static int32_t dot_s16_sse2(const int16_t * a, const int16_t * b, size_t n)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16
+				    (_mm_loadu_si128((const __m128i *)(a + i)),
+				     _mm_loadu_si128((const __m128i *)(b + i))));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+	return _mm_cvtsi128_si32(acc) + dot_s16_c(a + i, b + i, n - i);
+}
+
+static const SPDDSPKernels kernels_sse2 = {
+	"sse2", gain_s16_sse2, swap_s16_sse2, s8_to_s16_sse2, s16_to_s8_sse2,
+	mono_to_stereo_sse2, stereo_to_mono_sse2, dot_s16_sse2
+};
+
+/* AVX2.  Unpacking and packing work within each 128bit half, the
+   permutations put the samples back in order. */
+
+__attribute__ ((target("avx2")))
+static void gain_s16_avx2(const int16_t * in, int16_t * out, size_t n, int g)
+{
+	const __m256i gv = _mm256_set1_epi32(g);
+	const __m256i round = _mm256_set1_epi32(1 << 14);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i x, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		x = _mm256_loadu_si256((const __m256i *)(in + i));
+		lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(x, zero), gv);
+		hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(x, zero), gv);
+		lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 15);
+		hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 15);
+		_mm256_storeu_si256((__m256i *) (out + i),
+				    _mm256_packs_epi32(lo, hi));
+	}
+	gain_s16_sse2(in + i, out + i, n - i, g);
+}
+
+__attribute__ ((target("avx2")))
+static void swap_s16_avx2(int16_t * buf, size_t n)
+{
+	__m256i x;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		x = _mm256_loadu_si256((const __m256i *)(buf + i));
+		x = _mm256_or_si256(_mm256_slli_epi16(x, 8),
+				    _mm256_srli_epi16(x, 8));
+		_mm256_storeu_si256((__m256i *) (buf + i), x);
+	}
+	swap_s16_sse2(buf + i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void s8_to_s16_avx2(const int8_t * in, int16_t * out, size_t n)
+{
+	__m256i x;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		x = _mm256_cvtepi8_epi16(_mm_loadu_si128
+					 ((const __m128i *)(in + i)));
+		_mm256_storeu_si256((__m256i *) (out + i),
+				    _mm256_slli_epi16(x, 8));
+	}
+	s8_to_s16_sse2(in + i, out + i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void s16_to_s8_avx2(const int16_t * in, int8_t * out, size_t n)
+{
+	__m256i a, b, x;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		a = _mm256_srai_epi16(_mm256_loadu_si256
+				      ((const __m256i *)(in + i)), 8);
+		b = _mm256_srai_epi16(_mm256_loadu_si256
+				      ((const __m256i *)(in + i + 16)), 8);
+		x = _mm256_packs_epi16(a, b);
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) (out + i), x);
+	}
+	s16_to_s8_sse2(in + i, out + i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void mono_to_stereo_avx2(const int16_t * in, int16_t * out, size_t n)
+{
+	__m256i x;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		x = _mm256_loadu_si256((const __m256i *)(in + i));
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) (out + 2 * i),
+				    _mm256_unpacklo_epi16(x, x));
+		_mm256_storeu_si256((__m256i *) (out + 2 * i + 16),
+				    _mm256_unpackhi_epi16(x, x));
+	}
+	mono_to_stereo_sse2(in + i, out + 2 * i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static void stereo_to_mono_avx2(const int16_t * in, int16_t * out, size_t n)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	__m256i a, b, x;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = _mm256_madd_epi16(_mm256_loadu_si256
+				      ((const __m256i *)(in + 2 * i)), one);
+		b = _mm256_madd_epi16(_mm256_loadu_si256
+				      ((const __m256i *)(in + 2 * i + 16)),
+				      one);
+		a = _mm256_srai_epi32(a, 1);
+		b = _mm256_srai_epi32(b, 1);
+		x = _mm256_packs_epi32(a, b);
+		x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) (out + i), x);
+	}
+	stereo_to_mono_sse2(in + 2 * i, out + i, n - i);
+}
+
+__attribute__ ((target("avx2")))
+static int32_t dot_s16_avx2(const int16_t * a, const int16_t * b, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i sum;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16
+				       (_mm256_loadu_si256
+					((const __m256i *)(a + i)),
+					_mm256_loadu_si256
+					((const __m256i *)(b + i))));
+	sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+			    _mm256_extracti128_si256(acc, 1));
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
+	return _mm_cvtsi128_si32(sum) + dot_s16_sse2(a + i, b + i, n - i);
+}
+
+static const SPDDSPKernels kernels_avx2 = {
+	"avx2", gain_s16_avx2, swap_s16_avx2, s8_to_s16_avx2, s16_to_s8_avx2,
+	mono_to_stereo_avx2, stereo_to_mono_avx2, dot_s16_avx2
+};
+
+#endif /* SPD_DSP_X86 */
+
+#ifdef SPD_DSP_NEON
+
+static void gain_s16_neon(const int16_t * in, int16_t * out, size_t n, int g)
+{
+	/* vqrdmulh computes (2 * x * g + (1 << 15)) >> 16, i.e. the same
+	   rounding as the C version */
+	const int16x8_t gv = vdupq_n_s16(g);
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		vst1q_s16(out + i, vqrdmulhq_s16(vld1q_s16(in + i), gv));
+	gain_s16_c(in + i, out + i, n - i, g);
+}
+
+static void swap_s16_neon(int16_t * buf, size_t n)
+{
+	uint8x16_t x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = vrev16q_u8(vreinterpretq_u8_s16(vld1q_s16(buf + i)));
+		vst1q_s16(buf + i, vreinterpretq_s16_u8(x));
+	}
+	swap_s16_c(buf + i, n - i);
+}
+
+static void s8_to_s16_neon(const int8_t * in, int16_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		vst1q_s16(out + i, vshll_n_s8(vld1_s8(in + i), 8));
+	s8_to_s16_c(in + i, out + i, n - i);
+}
+
+static void s16_to_s8_neon(const int16_t * in, int8_t * out, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		vst1_s8(out + i, vshrn_n_s16(vld1q_s16(in + i), 8));
+	s16_to_s8_c(in + i, out + i, n - i);
+}
+
+static void mono_to_stereo_neon(const int16_t * in, int16_t * out, size_t n)
+{
+	int16x8x2_t x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x.val[0] = x.val[1] = vld1q_s16(in + i);
+		vst2q_s16(out + 2 * i, x);
+	}
+	mono_to_stereo_c(in + i, out + 2 * i, n - i);
+}
+
+static void stereo_to_mono_neon(const int16_t * in, int16_t * out, size_t n)
+{
+	int16x8x2_t x;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = vld2q_s16(in + 2 * i);
+		vst1q_s16(out + i, vhaddq_s16(x.val[0], x.val[1]));
+	}
+	stereo_to_mono_c(in + 2 * i, out + i, n - i);
+}
+
+static int32_t dot_s16_neon(const int16_t * a, const int16_t * b, size_t n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int16x8_t x, y;
+	int32x2_t sum;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = vld1q_s16(a + i);
+		y = vld1q_s16(b + i);
+		acc = vmlal_s16(acc, vget_low_s16(x), vget_low_s16(y));
+		acc = vmlal_s16(acc, vget_high_s16(x), vget_high_s16(y));
+	}
+	sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	return vget_lane_s32(vpadd_s32(sum, sum), 0)
+	    + dot_s16_c(a + i, b + i, n - i);
+}
+
+static const SPDDSPKernels kernels_neon = {
+	"neon", gain_s16_neon, swap_s16_neon, s8_to_s16_neon, s16_to_s8_neon,
+	mono_to_stereo_neon, stereo_to_mono_neon, dot_s16_neon
+};
+
+#endif /* SPD_DSP_NEON */
+
+static const SPDDSPKernels *kernels = &kernels_c;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void)
+{
+#ifdef SPD_DSP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		kernels = &kernels_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		kernels = &kernels_sse2;
+#endif
+#ifdef SPD_DSP_NEON
+	kernels = &kernels_neon;
+#endif
+}
+
+static const SPDDSPKernels *get_kernels(void)
+{
+	pthread_once(&kernels_once, select_kernels);
+	return kernels;
+}
+
+/* Q15 factor of the volume, 1 << 15 meaning unchanged */
+static int gain_q15(int volume)
+{
+	if (volume > 100)
+		volume = 100;
+	if (volume < -100)
+		volume = -100;
+	return (volume + 100) * (1 << 15) / 200;
+}
+
+void spd_dsp_gain_s16(const int16_t * in, int16_t * out, size_t n, int volume)
+{
+	int g = gain_q15(volume);
+
+	if (g == 1 << 15) {
+		if (out != in)
+			memcpy(out, in, n * sizeof(*out));
+		return;
+	}
+	get_kernels()->gain_s16(in, out, n, g);
+}
+
+void spd_dsp_gain_s8(const int8_t * in, int8_t * out, size_t n, int volume)
+{
+	int g = gain_q15(volume);
+	size_t i;
+
+	if (g == 1 << 15) {
+		if (out != in)
+			memcpy(out, in, n * sizeof(*out));
+		return;
+	}
+	/* 8bit audio is rare enough to not deserve vector versions */
+	for (i = 0; i < n; i++)
+		out[i] = (in[i] * g + (1 << 14)) >> 15;
+}
+
+void spd_dsp_swap_s16(int16_t * buf, size_t n)
+{
+	get_kernels()->swap_s16(buf, n);
+}
+
+void spd_dsp_s8_to_s16(const int8_t * in, int16_t * out, size_t n)
+{
+	get_kernels()->s8_to_s16(in, out, n);
+}
+
+void spd_dsp_s16_to_s8(const int16_t * in, int8_t * out, size_t n)
+{
+	get_kernels()->s16_to_s8(in, out, n);
+}
+
+void spd_dsp_mono_to_stereo_s16(const int16_t * in, int16_t * out, size_t n)
+{
+	get_kernels()->mono_to_stereo(in, out, n);
+}
+
+void spd_dsp_stereo_to_mono_s16(const int16_t * in, int16_t * out, size_t n)
+{
+	get_kernels()->stereo_to_mono(in, out, n);
+}
+
+int32_t spd_dsp_dot_s16(const int16_t * a, const int16_t * b, size_t n)
+{
+	return get_kernels()->dot_s16(a, b, n);
+}
+
+const char *spd_dsp_implementation(void)
+{
+	return get_kernels()->name;
+}
@@ -0,0 +1,370 @@
+/*
+ * spd_resample.c - Conversion of audio tracks to a fixed device format
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The rate is converted by a polyphase filter: for a ratio up / down, each
+ * output sample is the dot product of taps input samples with one of up
+ * Kaiser-windowed sinc filters, the one for its position between two input
+ * samples.  The filters are stored in Q14 so that the dot products fit in
+ * 32 bits and can use the spd_dsp kernel.
+ *
+ * The input of each channel is kept in its own buffer, preceded by the last
+ * taps - 1 input frames of the previous track.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "spd_dsp.h"
+#include "spd_resample.h"
+
+/* Filter length for upsampling, downsampling makes it longer to keep the
+   same number of zero crossings */
+#define RESAMPLE_TAPS 32
+#define RESAMPLE_MAX_TAPS 256
+/* Odd ratios round the position to one of this many filters */
+#define RESAMPLE_MAX_PHASES 1024
+/* Fraction of the lowest of the two Nyquist frequencies that is kept */
+#define RESAMPLE_PASSBAND 0.9
+#define RESAMPLE_KAISER_BETA 8.0
+
+struct SPDResampler {
+	int out_rate;		/* 0 to keep the rate of the tracks */
+	int out_channels;	/* 0 to keep the channels of the tracks */
+
+	int in_rate;		/* Track format the filter is set up for */
+	int in_channels;
+	int up, down;		/* out rate / in rate */
+	int taps;		/* 0 if the rate is kept */
+	int phases;
+	int16_t *coefs;		/* phases filters of taps coefficients */
+
+	int16_t *input;		/* One buffer of input_frames per channel */
+	size_t input_frames;
+	size_t pos;		/* First input frame of the next output */
+	int phase;		/* and its offset, in 1/up frames */
+
+	int16_t *conv;		/* Track in 16bit and output channels */
+	size_t conv_size;
+	int16_t *out;
+	size_t out_size;
+};
+
+static void *grow(void *buf, size_t * size, size_t needed)
+{
+	if (*size < needed) {
+		buf = g_realloc(buf, needed);
+		*size = needed;
+	}
+	return buf;
+}
+
+static int gcd(int a, int b)
+{
+	int t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	int k;
+
+	for (k = 1; k < 64; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+/* Compute the filters for the current up / down ratio */
+static void make_filters(SPDResampler * r)
+{
+	double cutoff, t, x, w, h, sum;
+	double *tmp;
+	int p, k, q, rest, center = r->taps / 2 - 1;
+
+	/* In cycles per input sample */
+	cutoff = 0.5 * RESAMPLE_PASSBAND;
+	if (r->down > r->up)
+		cutoff = cutoff * r->up / r->down;
+
+	tmp = g_malloc(r->taps * sizeof(*tmp));
+	r->coefs = g_realloc(r->coefs, r->phases * r->taps * sizeof(*r->coefs));
+	for (p = 0; p < r->phases; p++) {
+		sum = 0;
+		for (k = 0; k < r->taps; k++) {
+			t = k - center - (double)p / r->phases;
+			x = t / (r->taps / 2);
+			w = bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1 - x * x))
+			    / bessel_i0(RESAMPLE_KAISER_BETA);
+			h = 2 * cutoff;
+			if (t != 0)
+				h = sin(2 * G_PI * cutoff * t) / (G_PI * t);
+			tmp[k] = h * w;
+			sum += tmp[k];
+		}
+		/* Unity gain at DC, rounding included */
+		rest = 1 << 14;
+		for (k = 0; k < r->taps; k++) {
+			q = lrint(tmp[k] / sum * (1 << 14));
+			r->coefs[p * r->taps + k] = q;
+			rest -= q;
+		}
+		r->coefs[p * r->taps + center] += rest;
+	}
+	g_free(tmp);
+}
+
+/* Set the resampler up for tracks of this rate and channels */
+static void setup(SPDResampler * r, int rate, int channels)
+{
+	int out_rate = r->out_rate ? r->out_rate : rate;
+	int d = gcd(out_rate, rate);
+
+	r->in_rate = rate;
+	r->in_channels = channels;
+	r->up = out_rate / d;
+	r->down = rate / d;
+
+	if (r->up == r->down) {
+		/* No history is kept, the input has to be set up again for
+		   the next ratio */
+		r->taps = 0;
+		g_free(r->input);
+		r->input = NULL;
+		r->input_frames = 0;
+		return;
+	}
+
+	r->taps = RESAMPLE_TAPS;
+	if (r->down > r->up)
+		r->taps = (RESAMPLE_TAPS * r->down / r->up + 15) & ~15;
+	if (r->taps > RESAMPLE_MAX_TAPS)
+		r->taps = RESAMPLE_MAX_TAPS;
+	r->phases = MIN(r->up, RESAMPLE_MAX_PHASES);
+	make_filters(r);
+
+	g_free(r->input);
+	r->input = NULL;
+	r->input_frames = 0;
+	spd_resampler_reset(r);
+}
+
+SPDResampler *spd_resampler_new(int sample_rate, int num_channels)
+{
+	SPDResampler *r = g_malloc0(sizeof(*r));
+
+	r->out_rate = sample_rate;
+	r->out_channels = num_channels;
+	return r;
+}
+
+void spd_resampler_free(SPDResampler * r)
+{
+	if (r == NULL)
+		return;
+	g_free(r->coefs);
+	g_free(r->input);
+	g_free(r->conv);
+	g_free(r->out);
+	g_free(r);
+}
+
+void spd_resampler_reset(SPDResampler * r)
+{
+	int channels = r->out_channels ? r->out_channels : r->in_channels;
+	int c;
+
+	/* The first output is on the first input frame, after silence */
+	r->pos = r->taps / 2;
+	r->phase = 0;
+	if (r->input && r->taps > 0)
+		for (c = 0; c < channels; c++)
+			memset(r->input + c * r->input_frames, 0,
+			       (r->taps - 1) * sizeof(*r->input));
+}
+
+AudioTrack spd_resampler_format(SPDResampler * r, AudioTrack track)
+{
+	if (r->out_rate)
+		track.sample_rate = r->out_rate;
+	if (r->out_channels)
+		track.num_channels = r->out_channels;
+	track.bits = 16;
+	track.num_samples = 0;
+	track.samples = NULL;
+	return track;
+}
+
+/* Make room for frames input frames after the history */
+static void grow_input(SPDResampler * r, int channels, size_t frames)
+{
+	size_t history = r->taps - 1;
+	size_t needed = history + frames;
+	int16_t *input;
+	int c;
+
+	if (r->input_frames >= needed)
+		return;
+
+	input = g_malloc(needed * channels * sizeof(*input));
+	for (c = 0; c < channels; c++) {
+		if (r->input)
+			memcpy(input + c * needed,
+			       r->input + c * r->input_frames,
+			       history * sizeof(*input));
+		else
+			memset(input + c * needed, 0,
+			       history * sizeof(*input));
+	}
+	g_free(r->input);
+	r->input = input;
+	r->input_frames = needed;
+}
+
+/* Convert frames frames of track to 16bit samples in the output channels */
+static int16_t *normalize(SPDResampler * r, AudioTrack * track, int channels,
+			  size_t frames)
+{
+	int in_channels = track->num_channels;
+	int16_t *in, *out;
+	size_t f;
+	int c, sum;
+
+	if (track->bits == 16 && in_channels == channels)
+		return (int16_t *) track->samples;
+
+	r->conv = grow(r->conv, &r->conv_size,
+		       frames * (in_channels + channels) * sizeof(*r->conv));
+
+	in = (int16_t *) track->samples;
+	if (track->bits == 8) {
+		spd_dsp_s8_to_s16((int8_t *) track->samples, r->conv,
+				  frames * in_channels);
+		in = r->conv;
+	}
+	if (in_channels == channels)
+		return in;
+
+	out = r->conv + frames * in_channels;
+	if (in_channels == 1 && channels == 2) {
+		spd_dsp_mono_to_stereo_s16(in, out, frames);
+	} else if (in_channels == 2 && channels == 1) {
+		spd_dsp_stereo_to_mono_s16(in, out, frames);
+	} else {
+		for (f = 0; f < frames; f++) {
+			if (channels == 1) {
+				sum = 0;
+				for (c = 0; c < in_channels; c++)
+					sum += in[f * in_channels + c];
+				out[f] = sum / in_channels;
+				continue;
+			}
+			for (c = 0; c < channels; c++)
+				out[f * channels + c] =
+				    in[f * in_channels + c % in_channels];
+		}
+	}
+	return out;
+}
+
+AudioTrack spd_resampler_process(SPDResampler * r, AudioTrack track)
+{
+	AudioTrack out = spd_resampler_format(r, track);
+	int channels = out.num_channels;
+	size_t frames, history, n, p, f;
+	const int16_t *coefs;
+	int16_t *in, *x;
+	int32_t acc;
+	int c, phase;
+
+	if (track.samples == NULL || track.num_samples <= 0
+	    || track.num_channels <= 0)
+		return out;
+
+	if (track.sample_rate != r->in_rate
+	    || track.num_channels != r->in_channels)
+		setup(r, track.sample_rate, track.num_channels);
+
+	frames = track.num_samples / track.num_channels;
+	in = normalize(r, &track, channels, frames);
+
+	if (r->taps == 0) {
+		out.num_samples = frames * channels;
+		out.samples = in;
+		return out;
+	}
+
+	history = r->taps - 1;
+	grow_input(r, channels, frames);
+	r->out = grow(r->out, &r->out_size,
+		      ((frames * r->up) / r->down + 2) * channels *
+		      sizeof(*r->out));
+
+	n = 0;
+	p = r->pos;
+	phase = r->phase;
+	for (c = 0; c < channels; c++) {
+		x = r->input + c * r->input_frames;
+		for (f = 0; f < frames; f++)
+			x[history + f] = in[f * channels + c];
+
+		p = r->pos;
+		phase = r->phase;
+		n = 0;
+		while (p + r->taps <= history + frames) {
+			if (r->phases == r->up)
+				coefs = r->coefs + phase * r->taps;
+			else
+				coefs = r->coefs + (gint64) phase * r->phases
+				    / r->up * r->taps;
+			acc = spd_dsp_dot_s16(x + p, coefs, r->taps);
+			acc = (acc + (1 << 13)) >> 14;
+			r->out[n * channels + c] = CLAMP(acc, -32768, 32767);
+			n++;
+
+			phase += r->down;
+			p += phase / r->up;
+			phase %= r->up;
+		}
+
+		/* Keep the end of the input for the next track */
+		memmove(x, x + frames, history * sizeof(*x));
+	}
+	r->pos = p - frames;
+	r->phase = phase;
+
+	out.num_samples = n * channels;
+	out.samples = r->out;
+	return out;
+}
@@ -0,0 +1,50 @@
+/*
+ * spd_resample.h - Conversion of audio tracks to a fixed device format
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1, or (at your option) any later
+ * version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A resampler converts the tracks of a playback to 16bit samples at one
+ * sample rate and channel count, whatever the format of the tracks is, so
+ * that the audio device does not have to be reconfigured when the voice or
+ * the sound icon changes.  It keeps the end of the previous track of the
+ * playback to filter across track boundaries.
+ */
+
+#ifndef __SPD_RESAMPLE_H
+#define __SPD_RESAMPLE_H
+
+#include <spd_audio_plugin.h>
+
+typedef struct SPDResampler SPDResampler;
+
+/* Create a resampler to sample_rate (0 to keep the rate of the tracks) and
+   num_channels (0 to keep the channels of the tracks) */
+SPDResampler *spd_resampler_new(int sample_rate, int num_channels);
+void spd_resampler_free(SPDResampler * resampler);
+
+/* Forget the previous tracks, for a new playback */
+void spd_resampler_reset(SPDResampler * resampler);
+
+/* Return the format track is converted to, without samples */
+AudioTrack spd_resampler_format(SPDResampler * resampler, AudioTrack track);
+
+/* Return track converted.  The samples are either those of track or in a
+   buffer of the resampler, valid until the next call. */
+AudioTrack spd_resampler_process(SPDResampler * resampler, AudioTrack track);
+
+#endif /* __SPD_RESAMPLE_H */
@@ -23,11 +23,16 @@
  * Based on ibmtts.c.
  */
 
-#include <sndfile.h>
+#include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
 
 #include "speak_queue.h"
 #include "common.h"
 #include "spd_audio.h"
+#include "sound_icons.h"
+#include "spd_probes.h"
 
 #define DBG_MODNAME "speak_queue"
 
@@ -41,7 +46,8 @@ typedef enum {
 typedef enum {
 	SPEAK_QUEUE_PAUSE_OFF,
 	SPEAK_QUEUE_PAUSE_REQUESTED,
-	SPEAK_QUEUE_PAUSE_MARK_REPORTED
+	SPEAK_QUEUE_PAUSE_MARK_REPORTED,
+	SPEAK_QUEUE_PAUSE_KEPT	/* The playback thread waits for a resume */
 } speak_queue_pause_state_t;
 
 /* Thread and process control. */
@@ -50,6 +56,8 @@ static pthread_mutex_t speak_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static speak_queue_state_t speak_queue_state = IDLE;
 static gboolean speak_queue_configured = FALSE; /* Whether we have configured audio */
+/* Chunks given to spd_audio_submit() the device is not done with yet */
+static int speak_queue_in_flight;
 
 static pthread_t speak_queue_play_thread;
 static pthread_t speak_queue_stop_or_pause_thread;
@@ -72,12 +80,50 @@ static gboolean speak_queue_flush_requested = FALSE;
 
 static void module_speak_queue_reset(void);
 
-/* The playback queue. */
+/* The playback queue.
+ *
+ * This is a ring of entries written by the synthesis side and read by the
+ * playback thread without taking speak_queue_mutex: each side only moves
+ * its own index, with atomic accesses.  The mutex and the conditions are
+ * only used to sleep when the ring is empty, or full (in entries or in
+ * audio samples), the other side then knowing from the *_waiting flags
+ * that it has to wake it.
+ *
+ * Each slot keeps the buffer it was given for the samples, mark name or
+ * file name of its entry, so that it can be reused for the next entry put
+ * in the slot.  The playback thread is the only reader, and also clears
+ * the queue while the playback thread sleeps; writers are serialized by
+ * speak_queue_push_mutex, in case e.g. the server pauses while a module
+ * is sending events.
+ */
 
-static int speak_queue_maxsize;
+#define SPEAK_QUEUE_RING_SIZE 128
+/* Slot buffers larger than this are not kept for the next entries */
+#define SPEAK_QUEUE_KEEP_BYTES (64 * 1024)
 
-static GSList *playback_queue = NULL;
-static int playback_queue_size = 0;	/* Number of audio frames currently in queue */
+typedef struct {
+	speak_queue_entry entry;
+	void *buf;
+	size_t buf_size;
+} speak_queue_slot;
+
+static int speak_queue_maxsize;
+/* Audio frames a pause may keep, 0 to drop them */
+static int speak_queue_keep_maxsize;
+
+static speak_queue_slot playback_queue[SPEAK_QUEUE_RING_SIZE];
+static gint playback_queue_head;	/* Next slot to read */
+static gint playback_queue_tail;	/* Next slot to write */
+static gint playback_queue_size;	/* Number of audio frames currently in queue */
+/* Frames above which writers wait, speak_queue_keep_maxsize while paused */
+static gint playback_queue_limit;
+/* Whether something could not be added to the queue while it was paused,
+   which then can't be resumed */
+static gint playback_queue_overflow;
+
+static pthread_mutex_t speak_queue_push_mutex = PTHREAD_MUTEX_INITIALIZER;
+static gint playback_queue_push_waiting;
+static gint playback_queue_pop_waiting;
 
 /* Use to wait for queue room availability. Theoretically several threads might
  * be wanting to push, so use broadcast. */
@@ -87,11 +133,34 @@ static pthread_cond_t playback_queue_data_condition = PTHREAD_COND_INITIALIZER;
 
 /* Internal function prototypes for playback thread. */
 static gboolean speak_queue_add_flag_to_playback_queue(speak_queue_entry_type type);
-static void speak_queue_delete_playback_queue_entry(speak_queue_entry *
-					       playback_queue_entry);
+static void speak_queue_release_playback_queue_entry(speak_queue_entry *
+						    playback_queue_entry);
 static gboolean speak_queue_send_to_audio(speak_queue_entry *
 				     playback_queue_entry);
 
+/* With devices which support spd_audio_submit(), so many chunks are kept
+ * queued in the device instead of waiting for each to be played. */
+#define SPEAK_QUEUE_IN_FLIGHT 3
+
+/* Index marks reached while the device still had audio to play before them
+ * wait here until it is heard, to be reported by the marks thread. */
+
+/* Marks due sooner than this (in microseconds) are reported right away */
+#define SPEAK_QUEUE_MARK_MIN_DELAY 2000
+
+typedef struct {
+	gint64 time;		/* g_get_monotonic_time() at which it is heard */
+	char *markId;
+} speak_queue_pending_mark;
+
+static pthread_t speak_queue_marks_thread;
+static pthread_mutex_t speak_queue_marks_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Wakes the marks thread, and those waiting for pending marks.  It uses the
+   monotonic clock, like the times of the marks. */
+static pthread_cond_t speak_queue_marks_cond;
+static GQueue speak_queue_pending_marks = G_QUEUE_INIT;
+static gboolean speak_queue_marks_quit = FALSE;
+
 /* Miscellaneous internal function prototypes. */
 static void speak_queue_clear_playback_queue();
 
@@ -99,12 +168,21 @@ static void speak_queue_clear_playback_queue();
 static void *speak_queue_play(void *);
 /* The stop_or_pause start routine. */
 static void *speak_queue_stop_or_pause(void *);
+/* The marks thread start routine. */
+static void *speak_queue_marks(void *);
 
 int module_speak_queue_init(int maxsize, char **status_info)
 {
+	pthread_condattr_t attr;
 	int ret;
 
 	speak_queue_maxsize = maxsize;
+	g_atomic_int_set(&playback_queue_limit, maxsize);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&speak_queue_marks_cond, &attr);
+	pthread_condattr_destroy(&attr);
 
 	/* Reset global state */
 	module_speak_queue_reset();
@@ -132,6 +210,15 @@ int module_speak_queue_init(int maxsize, char **status_info)
 		return -1;
 	}
 
+	DBG(DBG_MODNAME " Creating new thread for index marks.");
+	speak_queue_marks_quit = FALSE;
+	ret = spd_pthread_create(&speak_queue_marks_thread, NULL, speak_queue_marks, NULL);
+	if (ret != 0) {
+		DBG("Failed to create index marks thread.");
+		*status_info = g_strdup("Failed to create index marks thread.");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -141,6 +228,8 @@ void module_speak_queue_reset(void)
 	speak_queue_pause_state = SPEAK_QUEUE_PAUSE_OFF;
 	speak_queue_stop_requested = FALSE;
 	speak_queue_flush_requested = FALSE;
+	g_atomic_int_set(&playback_queue_limit, speak_queue_maxsize);
+	g_atomic_int_set(&playback_queue_overflow, 0);
 }
 
 int module_speak_queue_before_synth(void)
@@ -165,50 +254,126 @@ int module_speak_queue_before_play(void)
 	if (speak_queue_state == BEFORE_SYNTH) {
 		ret = 1;
 		speak_queue_state = BEFORE_PLAY;
+	}
+	pthread_mutex_unlock(&speak_queue_mutex);
+
+	if (ret) {
 		speak_queue_add_flag_to_playback_queue(SPEAK_QUEUE_QET_BEGIN);
 		/* Wake up playback thread */
+		pthread_mutex_lock(&speak_queue_mutex);
 		pthread_cond_signal(&speak_queue_play_cond);
+		pthread_mutex_unlock(&speak_queue_mutex);
 	}
-	pthread_mutex_unlock(&speak_queue_mutex);
 	return ret;
 }
 
 gboolean module_speak_queue_add_end(void)
 {
-	pthread_mutex_lock(&speak_queue_mutex);
-	gboolean ret = speak_queue_add_flag_to_playback_queue(SPEAK_QUEUE_QET_END);
-	pthread_mutex_unlock(&speak_queue_mutex);
-	return ret;
+	return speak_queue_add_flag_to_playback_queue(SPEAK_QUEUE_QET_END);
 }
 
+static gboolean playback_queue_empty(void)
+{
+	return g_atomic_int_get(&playback_queue_head)
+	    == g_atomic_int_get(&playback_queue_tail);
+}
+
+/* Returns the next entry, to be given back with
+   speak_queue_release_playback_queue_entry(), or NULL on stop. */
 static speak_queue_entry *playback_queue_pop()
 {
-	speak_queue_entry *result = NULL;
-	pthread_mutex_lock(&speak_queue_mutex);
-	while (!speak_queue_stop_requested && playback_queue == NULL) {
-		pthread_cond_wait(&playback_queue_data_condition,
-				  &speak_queue_mutex);
+	if (playback_queue_empty() && !speak_queue_stop_requested) {
+		pthread_mutex_lock(&speak_queue_mutex);
+		g_atomic_int_set(&playback_queue_pop_waiting, 1);
+		while (!speak_queue_stop_requested && playback_queue_empty()) {
+			pthread_cond_wait(&playback_queue_data_condition,
+					  &speak_queue_mutex);
+		}
+		g_atomic_int_set(&playback_queue_pop_waiting, 0);
+		pthread_mutex_unlock(&speak_queue_mutex);
 	}
-	if (!speak_queue_stop_requested) {
-		result = (speak_queue_entry *) playback_queue->data;
-		playback_queue =
-		    g_slist_remove(playback_queue, playback_queue->data);
-		if (result->type == SPEAK_QUEUE_QET_AUDIO) {
-			playback_queue_size -= result->data.audio.track.num_samples;
-			pthread_cond_broadcast(&playback_queue_room_condition);
+	if (speak_queue_stop_requested)
+		return NULL;
+
+	return &playback_queue[g_atomic_int_get(&playback_queue_head)].entry;
+}
+
+/* Whether the next slot can be written, with speak_queue_push_mutex held */
+static gboolean playback_queue_room(gint samples)
+{
+	gint next = (playback_queue_tail + 1) % SPEAK_QUEUE_RING_SIZE;
+
+	if (next == g_atomic_int_get(&playback_queue_head)
+	    || g_atomic_int_get(&playback_queue_overflow))
+		return FALSE;
+	return samples == 0
+	    || g_atomic_int_get(&playback_queue_size)
+	    <= g_atomic_int_get(&playback_queue_limit);
+}
+
+/* Gets a slot to put an entry of the given type in, with size bytes of
+   buffer, waiting for room if needed, unless speech is stopped (or flushed
+   or done, for audio) or kept paused.  speak_queue_push_mutex is then held
+   until playback_queue_push(), it is released if NULL is returned. */
+static speak_queue_slot *playback_queue_reserve(speak_queue_entry_type type,
+						size_t size, gint samples)
+{
+	speak_queue_slot *slot;
+
+	pthread_mutex_lock(&speak_queue_push_mutex);
+	if (!playback_queue_room(samples)) {
+		pthread_mutex_lock(&speak_queue_mutex);
+		g_atomic_int_set(&playback_queue_push_waiting, 1);
+		while (!playback_queue_room(samples)) {
+			if (speak_queue_pause_state == SPEAK_QUEUE_PAUSE_KEPT) {
+				/* Nobody makes room until the resume, and
+				   the queue would miss this entry anyway */
+				DBG(DBG_MODNAME " Paused audio too large to be kept.");
+				g_atomic_int_set(&playback_queue_overflow, 1);
+			}
+			if (g_atomic_int_get(&playback_queue_overflow)
+			    || speak_queue_close_requested
+			    || speak_queue_stop_requested
+			    || (type == SPEAK_QUEUE_QET_AUDIO
+				&& (speak_queue_state == IDLE
+				    || speak_queue_flush_requested))) {
+				g_atomic_int_set(&playback_queue_push_waiting, 0);
+				pthread_mutex_unlock(&speak_queue_mutex);
+				pthread_mutex_unlock(&speak_queue_push_mutex);
+				return NULL;
+			}
+			pthread_cond_wait(&playback_queue_room_condition,
+					  &speak_queue_mutex);
 		}
+		g_atomic_int_set(&playback_queue_push_waiting, 0);
+		pthread_mutex_unlock(&speak_queue_mutex);
 	}
-	pthread_mutex_unlock(&speak_queue_mutex);
-	return result;
+
+	slot = &playback_queue[playback_queue_tail];
+	if (slot->buf_size < size) {
+		g_free(slot->buf);
+		slot->buf = g_malloc(size);
+		slot->buf_size = size;
+	}
+	slot->entry.type = type;
+	return slot;
 }
 
-static gboolean playback_queue_push(speak_queue_entry * entry)
+/* Makes the reserved slot visible to the playback thread */
+static gboolean playback_queue_push(speak_queue_slot * slot)
 {
-	playback_queue = g_slist_append(playback_queue, entry);
-	if (entry->type == SPEAK_QUEUE_QET_AUDIO) {
-		playback_queue_size += entry->data.audio.track.num_samples;
+	if (slot->entry.type == SPEAK_QUEUE_QET_AUDIO)
+		g_atomic_int_add(&playback_queue_size,
+				 slot->entry.data.audio.track.num_samples);
+	g_atomic_int_set(&playback_queue_tail,
+			 (playback_queue_tail + 1) % SPEAK_QUEUE_RING_SIZE);
+	pthread_mutex_unlock(&speak_queue_push_mutex);
+
+	if (g_atomic_int_get(&playback_queue_pop_waiting)) {
+		pthread_mutex_lock(&speak_queue_mutex);
+		pthread_cond_signal(&playback_queue_data_condition);
+		pthread_mutex_unlock(&speak_queue_mutex);
 	}
-	pthread_cond_signal(&playback_queue_data_condition);
 	return TRUE;
 }
 
@@ -217,113 +382,178 @@ static gboolean playback_queue_push(speak_queue_entry * entry)
 gboolean
 module_speak_queue_add_audio(const AudioTrack *track, AudioFormat format)
 {
-	pthread_mutex_lock(&speak_queue_mutex);
-	while (playback_queue_size > speak_queue_maxsize) {
-		if (speak_queue_state == IDLE
-			|| speak_queue_stop_requested
-			|| speak_queue_flush_requested) {
-			pthread_mutex_unlock(&speak_queue_mutex);
-			return FALSE;
-		}
-		pthread_cond_wait(&playback_queue_room_condition,
-				  &speak_queue_mutex);
-	}
+	gint nbytes = track->bits / 8 * track->num_samples;
+	speak_queue_slot *slot;
+
+	if (speak_queue_state == IDLE || speak_queue_stop_requested || speak_queue_flush_requested)
+		return FALSE;
+
+	slot = playback_queue_reserve(SPEAK_QUEUE_QET_AUDIO, nbytes,
+				      track->num_samples);
+	if (slot == NULL)
+		return FALSE;
+
+	slot->entry.data.audio.track = *track;
+	slot->entry.data.audio.track.samples = slot->buf;
+	memcpy(slot->buf, track->samples, nbytes);
+	slot->entry.data.audio.format = format;
+
+	return playback_queue_push(slot);
+}
+
+/* Same as module_speak_queue_add_audio(), but the queue gets the samples
+   instead of a copy of them. */
+gboolean
+module_speak_queue_take_audio(AudioTrack *track, AudioFormat format)
+{
+	speak_queue_slot *slot;
+
 	if (speak_queue_state == IDLE || speak_queue_stop_requested || speak_queue_flush_requested) {
-		pthread_mutex_unlock(&speak_queue_mutex);
+		g_free(track->samples);
+		track->samples = NULL;
 		return FALSE;
 	}
 
-	speak_queue_entry *playback_queue_entry =
-	    g_new(speak_queue_entry, 1);
+	slot = playback_queue_reserve(SPEAK_QUEUE_QET_AUDIO, 0,
+				      track->num_samples);
+	if (slot == NULL) {
+		g_free(track->samples);
+		track->samples = NULL;
+		return FALSE;
+	}
 
-	playback_queue_entry->type = SPEAK_QUEUE_QET_AUDIO;
-	playback_queue_entry->data.audio.track = *track;
-	gint nbytes = track->bits / 8 * track->num_samples;
-	playback_queue_entry->data.audio.track.samples = g_memdup(track->samples, nbytes);
-	playback_queue_entry->data.audio.format = format;
+	/* The slot keeps the buffer for the next entries */
+	g_free(slot->buf);
+	slot->buf = track->samples;
+	slot->buf_size = track->bits / 8 * track->num_samples;
+	track->samples = NULL;
 
-	playback_queue_push(playback_queue_entry);
-	pthread_mutex_unlock(&speak_queue_mutex);
-	return TRUE;
+	slot->entry.data.audio.track = *track;
+	slot->entry.data.audio.track.samples = slot->buf;
+	slot->entry.data.audio.format = format;
+
+	return playback_queue_push(slot);
+}
+
+/* Adds an entry carrying a copy of str to the playback queue. */
+static gboolean speak_queue_add_string(speak_queue_entry_type type,
+				       const char *str)
+{
+	size_t size = strlen(str) + 1;
+	speak_queue_slot *slot;
+
+	slot = playback_queue_reserve(type, size, 0);
+	if (slot == NULL)
+		return FALSE;
+
+	memcpy(slot->buf, str, size);
+	if (type == SPEAK_QUEUE_QET_INDEX_MARK)
+		slot->entry.data.markId = slot->buf;
+	else
+		slot->entry.data.sound_icon_filename = slot->buf;
+	return playback_queue_push(slot);
 }
 
 /* Adds an Index Mark to the audio playback queue. */
 gboolean module_speak_queue_add_mark(const char *markId)
 {
-	speak_queue_entry *playback_queue_entry =
-	    (speak_queue_entry *) g_malloc(sizeof(speak_queue_entry));
-
-	playback_queue_entry->type = SPEAK_QUEUE_QET_INDEX_MARK;
-	playback_queue_entry->data.markId = g_strdup(markId);
-	pthread_mutex_lock(&speak_queue_mutex);
-	gboolean ret = playback_queue_push(playback_queue_entry);
-	pthread_mutex_unlock(&speak_queue_mutex);
-	return ret;
+	return speak_queue_add_string(SPEAK_QUEUE_QET_INDEX_MARK, markId);
 }
 
 /* Adds a begin or end flag to the playback queue. */
 static gboolean speak_queue_add_flag_to_playback_queue(speak_queue_entry_type type)
 {
-	speak_queue_entry *playback_queue_entry =
-	    (speak_queue_entry *) g_malloc(sizeof(speak_queue_entry));
+	speak_queue_slot *slot = playback_queue_reserve(type, 0, 0);
 
-	playback_queue_entry->type = type;
-	return playback_queue_push(playback_queue_entry);
+	if (slot == NULL)
+		return FALSE;
+	return playback_queue_push(slot);
 }
 
 /* Add a sound icon to the playback queue. */
 gboolean module_speak_queue_add_sound_icon(const char *filename)
 {
-	speak_queue_entry *playback_queue_entry =
-	    (speak_queue_entry *) g_malloc(sizeof(speak_queue_entry));
-
-	playback_queue_entry->type = SPEAK_QUEUE_QET_SOUND_ICON;
-	playback_queue_entry->data.sound_icon_filename = g_strdup(filename);
-	pthread_mutex_lock(&speak_queue_mutex);
-	gboolean ret = playback_queue_push(playback_queue_entry);
-	pthread_mutex_unlock(&speak_queue_mutex);
-	return ret;
+	return speak_queue_add_string(SPEAK_QUEUE_QET_SOUND_ICON, filename);
 }
 
-/* Deletes an entry from the playback audio queue, freeing memory. */
+/* Gives the entry returned by playback_queue_pop() back to the writers. */
 static void
-speak_queue_delete_playback_queue_entry(speak_queue_entry * playback_queue_entry)
+speak_queue_release_playback_queue_entry(speak_queue_entry * playback_queue_entry)
 {
-	switch (playback_queue_entry->type) {
-	case SPEAK_QUEUE_QET_AUDIO:
-		g_free(playback_queue_entry->data.audio.track.samples);
-		break;
-	case SPEAK_QUEUE_QET_INDEX_MARK:
-		g_free(playback_queue_entry->data.markId);
-		break;
-	case SPEAK_QUEUE_QET_SOUND_ICON:
-		g_free(playback_queue_entry->data.sound_icon_filename);
-		break;
-	default:
-		break;
+	speak_queue_slot *slot = (speak_queue_slot *) playback_queue_entry;
+	gint head = g_atomic_int_get(&playback_queue_head);
+
+	if (playback_queue_entry->type == SPEAK_QUEUE_QET_AUDIO)
+		g_atomic_int_add(&playback_queue_size,
+				 -playback_queue_entry->data.audio.track.num_samples);
+	if (slot->buf_size > SPEAK_QUEUE_KEEP_BYTES) {
+		g_free(slot->buf);
+		slot->buf = NULL;
+		slot->buf_size = 0;
+	}
+	g_atomic_int_set(&playback_queue_head,
+			 (head + 1) % SPEAK_QUEUE_RING_SIZE);
+
+	if (g_atomic_int_get(&playback_queue_push_waiting)) {
+		pthread_mutex_lock(&speak_queue_mutex);
+		pthread_cond_broadcast(&playback_queue_room_condition);
+		pthread_mutex_unlock(&speak_queue_mutex);
 	}
-	g_free(playback_queue_entry);
 }
 
-/* Erases the entire playback queue, freeing memory. */
+/* Erases the entire playback queue.  Only to be called while the playback
+   thread is not reading it. */
 static void speak_queue_clear_playback_queue()
 {
-	pthread_mutex_lock(&speak_queue_mutex);
+	while (!playback_queue_empty())
+		speak_queue_release_playback_queue_entry
+		    (&playback_queue[g_atomic_int_get(&playback_queue_head)].entry);
 
-	while (NULL != playback_queue) {
-		speak_queue_entry *playback_queue_entry =
-		    playback_queue->data;
-		speak_queue_delete_playback_queue_entry(playback_queue_entry);
-		playback_queue =
-		    g_slist_remove(playback_queue, playback_queue->data);
-	}
-	playback_queue = NULL;
-	playback_queue_size = 0;
+	pthread_mutex_lock(&speak_queue_mutex);
 	pthread_cond_broadcast(&playback_queue_room_condition);
 	pthread_mutex_unlock(&speak_queue_mutex);
 }
 
-/* Sends a chunk of audio to the audio player and waits for completion or error. */
+/* Collects the chunks the audio device is done with, waiting for one if
+   wait is TRUE. */
+static void speak_queue_collect_done(gboolean wait)
+{
+	struct pollfd pfd;
+	void *cookie;
+
+	pfd.fd = spd_audio_get_event_fd(module_audio_id);
+	pfd.events = POLLIN;
+	while (speak_queue_in_flight > 0) {
+		if (spd_audio_get_done(module_audio_id, &cookie)) {
+			speak_queue_in_flight--;
+			wait = FALSE;
+			continue;
+		}
+		if (!wait)
+			break;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			DBG(DBG_MODNAME " Can't wait for audio: %s",
+			    strerror(errno));
+			break;
+		}
+	}
+}
+
+/* Finishes the playback on the audio device, if it was configured. */
+static void speak_queue_end_audio(void)
+{
+	if (!speak_queue_configured)
+		return;
+	spd_audio_end(module_audio_id);
+	/* All submitted chunks were played or dropped by now */
+	speak_queue_collect_done(FALSE);
+	speak_queue_in_flight = 0;
+	speak_queue_configured = FALSE;
+}
+
+/* Sends a chunk of audio to the audio player and waits for completion or
+   error, or only for room among the chunks in flight if the device
+   supports it. */
 static gboolean speak_queue_send_track_to_audio(AudioTrack *track, AudioFormat format)
 {
 	int ret = 0;
@@ -334,7 +564,16 @@ static gboolean speak_queue_send_track_to_audio(AudioTrack *track, AudioFormat f
 		spd_audio_begin(module_audio_id, *track, format);
 		speak_queue_configured = TRUE;
 	}
-	ret = spd_audio_feed_sync_overlap(module_audio_id, *track, format);
+	if (spd_audio_can_submit(module_audio_id)) {
+		speak_queue_collect_done(speak_queue_in_flight
+					 >= SPEAK_QUEUE_IN_FLIGHT);
+		ret = spd_audio_submit(module_audio_id, *track, format, NULL);
+		if (ret == 0)
+			speak_queue_in_flight++;
+	} else {
+		ret = spd_audio_feed_sync_overlap(module_audio_id, *track,
+						  format);
+	}
 	if (ret < 0) {
 		DBG("ERROR: Can't play track for unknown reason.");
 		return FALSE;
@@ -343,72 +582,20 @@ static gboolean speak_queue_send_track_to_audio(AudioTrack *track, AudioFormat f
 	return TRUE;
 }
 
-/* Plays the specified audio file. */
+/* Plays the specified audio file, from the sound icons cache. */
 static gboolean speak_queue_send_file_to_audio(const char *filename)
 {
-	gboolean result = 0;
-	int subformat;
-	sf_count_t items;
-	sf_count_t readcount;
-	SNDFILE *sf;
-	SF_INFO sfinfo;
+	const AudioTrack *track;
+	gboolean result;
 
 	DBG("Playing |%s|", filename);
-	memset(&sfinfo, 0, sizeof(sfinfo));
-	sf = sf_open(filename, SFM_READ, &sfinfo);
-	if (NULL == sf) {
-		DBG("%s", sf_strerror(NULL));
-		return -1;
-	}
-	if (sfinfo.channels < 1 || sfinfo.channels > 2) {
-		DBG("ERROR: channels = %d.\n", sfinfo.channels);
-		result = FALSE;
-		goto cleanup1;
-	}
-	if (sfinfo.frames > 0x7FFFFFFF || sfinfo.frames == 0) {
-		DBG("ERROR: Unknown number of frames.");
-		result = FALSE;
-		goto cleanup1;
-	}
-
-	subformat = sfinfo.format & SF_FORMAT_SUBMASK;
-	items = sfinfo.channels * sfinfo.frames;
-	DBG("Frames = %jd, channels = %ld", sfinfo.frames,
-	    (long)sfinfo.channels);
-	DBG("Samplerate = %i, items = %lld", sfinfo.samplerate,
-	    (long long)items);
-	DBG("Major format = 0x%08X, subformat = 0x%08X, endian = 0x%08X",
-	    sfinfo.format & SF_FORMAT_TYPEMASK, subformat,
-	    sfinfo.format & SF_FORMAT_ENDMASK);
-
-	if (subformat == SF_FORMAT_FLOAT || subformat == SF_FORMAT_DOUBLE) {
-		/* Set scaling for float to integer conversion. */
-		sf_command(sf, SFC_SET_SCALE_FLOAT_INT_READ, NULL, SF_TRUE);
-	}
-	AudioTrack track;
-	track.num_samples = sfinfo.frames;
-	track.num_channels = sfinfo.channels;
-	track.sample_rate = sfinfo.samplerate;
-	track.bits = 16;
-	track.samples = g_malloc(items * sizeof(short));
-	readcount = sf_read_short(sf, (short *)track.samples, items);
-	DBG("Read %lld items from audio file.", (long long)readcount);
-
-	if (readcount > 0) {
-		track.num_samples = readcount / sfinfo.channels;
-		DBG("Sending %i samples to audio.", track.num_samples);
-		int ret = speak_queue_send_track_to_audio(&track, SPD_AUDIO_LE);
-		if (ret < 0) {
-			DBG("ERROR: Can't play track for unknown reason.");
-			result = -1;
-			goto cleanup2;
-		}
-		DBG("Sent to audio.");
-	}
-cleanup2:
-	g_free(track.samples);
-cleanup1:
-	sf_close(sf);
+	track = sound_icons_get(filename, module_audio_id);
+	if (track == NULL)
+		return FALSE;
+
+	result = speak_queue_send_track_to_audio((AudioTrack *) track,
+						 module_audio_id->format);
+	sound_icons_release(track);
 	return result;
 }
 
@@ -418,6 +605,191 @@ static gboolean speak_queue_send_to_audio(speak_queue_entry * playback_queue_ent
 					        playback_queue_entry->data.audio.format);
 }
 
+/* Reports an index mark, and returns TRUE if it is where a requested pause
+   stops the playback. */
+static gboolean speak_queue_report_mark(const char *markId)
+{
+	gboolean finished = FALSE;
+
+	DBG(DBG_MODNAME " reporting index mark |%s|.", markId);
+	SPD_PROBE1(speak_queue_mark, markId);
+	module_report_index_mark(markId);
+	DBG(DBG_MODNAME " index mark reported.");
+	pthread_mutex_lock(&speak_queue_mutex);
+	if (speak_queue_state == SPEAKING
+	    && speak_queue_pause_state == SPEAK_QUEUE_PAUSE_REQUESTED
+	    && speak_queue_keep_maxsize == 0
+	    && speak_queue_stop_or_pause_sleeping
+	    && g_str_has_prefix(markId, "__spd_")) {
+		DBG(DBG_MODNAME " Pause requested in playback thread.  Stopping.");
+		speak_queue_stop_requested = TRUE;
+		speak_queue_pause_state = SPEAK_QUEUE_PAUSE_MARK_REPORTED;
+		pthread_cond_signal(&speak_queue_stop_or_pause_cond);
+		finished = TRUE;
+	}
+	pthread_mutex_unlock(&speak_queue_mutex);
+	return finished;
+}
+
+/* Leaves markId to the marks thread if the audio fed before it is not
+   heard yet, returns FALSE if it is to be reported now. */
+static gboolean speak_queue_delay_mark(const char *markId)
+{
+	speak_queue_pending_mark *mark;
+	int delay = -1;
+
+	if (speak_queue_configured)
+		delay = spd_audio_get_delay(module_audio_id);
+
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	/* Keep them in order */
+	if (delay < SPEAK_QUEUE_MARK_MIN_DELAY
+	    && g_queue_is_empty(&speak_queue_pending_marks)) {
+		pthread_mutex_unlock(&speak_queue_marks_mutex);
+		return FALSE;
+	}
+
+	mark = g_new(speak_queue_pending_mark, 1);
+	mark->time = g_get_monotonic_time() + MAX(delay, 0);
+	mark->markId = g_strdup(markId);
+	g_queue_push_tail(&speak_queue_pending_marks, mark);
+	pthread_cond_broadcast(&speak_queue_marks_cond);
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+	return TRUE;
+}
+
+/* Waits for the marks thread to report all pending marks, or for a stop */
+static void speak_queue_wait_marks(void)
+{
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	while (!g_queue_is_empty(&speak_queue_pending_marks)
+	       && !speak_queue_stop_requested && !speak_queue_marks_quit)
+		pthread_cond_wait(&speak_queue_marks_cond,
+				  &speak_queue_marks_mutex);
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+}
+
+/* Drops the pending marks, on stop */
+static void speak_queue_clear_marks(void)
+{
+	speak_queue_pending_mark *mark;
+
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	while ((mark = g_queue_pop_head(&speak_queue_pending_marks))) {
+		g_free(mark->markId);
+		g_free(mark);
+	}
+	pthread_cond_broadcast(&speak_queue_marks_cond);
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+}
+
+/* Whether the playback is to be paused at markId, keeping what follows. */
+static gboolean speak_queue_keep_at_mark(const char *markId)
+{
+	gboolean keep;
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	keep = speak_queue_state == SPEAKING
+	    && speak_queue_pause_state == SPEAK_QUEUE_PAUSE_REQUESTED
+	    && speak_queue_keep_maxsize > 0
+	    && !speak_queue_stop_requested
+	    && g_str_has_prefix(markId, "__spd_");
+	pthread_mutex_unlock(&speak_queue_mutex);
+	return keep;
+}
+
+/* Pauses the playback at markId, once the audio before it was heard,
+   leaving the entries after it in the queue until
+   module_speak_queue_resume().  Returns TRUE if they were dropped or the
+   speech stopped meanwhile. */
+static gboolean speak_queue_keep_paused(const char *markId)
+{
+	gboolean stopped;
+
+	speak_queue_end_audio();
+	speak_queue_wait_marks();
+	speak_queue_report_mark(markId);
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	if (speak_queue_stop_requested) {
+		pthread_mutex_unlock(&speak_queue_mutex);
+		return TRUE;
+	}
+	speak_queue_pause_state = SPEAK_QUEUE_PAUSE_KEPT;
+	/* The synth may still add the rest of its text, but not wait for
+	   room */
+	g_atomic_int_set(&playback_queue_limit, speak_queue_keep_maxsize);
+	pthread_cond_broadcast(&playback_queue_room_condition);
+	pthread_mutex_unlock(&speak_queue_mutex);
+
+	DBG(DBG_MODNAME " Paused, keeping the rest of the audio.");
+	SPD_PROBE1(speak_queue_stopped, 1);
+	module_report_event_pause();
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	while (speak_queue_pause_state == SPEAK_QUEUE_PAUSE_KEPT
+	       && !speak_queue_stop_requested)
+		pthread_cond_wait(&speak_queue_play_cond, &speak_queue_mutex);
+	stopped = speak_queue_stop_requested || speak_queue_state == IDLE;
+	pthread_mutex_unlock(&speak_queue_mutex);
+
+	if (!stopped) {
+		DBG(DBG_MODNAME " Resuming the kept audio.");
+		module_report_event_begin();
+	}
+	return stopped;
+}
+
+/* Marks thread: reports the pending marks when they are heard. */
+static void *speak_queue_marks(void *nothing)
+{
+	speak_queue_pending_mark *mark;
+	struct timespec ts;
+	gint64 now, wait;
+
+	DBG(DBG_MODNAME " Index marks thread starting.......");
+
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	while (!speak_queue_marks_quit) {
+		mark = g_queue_peek_head(&speak_queue_pending_marks);
+		if (mark == NULL) {
+			pthread_cond_wait(&speak_queue_marks_cond,
+					  &speak_queue_marks_mutex);
+			continue;
+		}
+
+		now = g_get_monotonic_time();
+		if (mark->time > now) {
+			wait = mark->time - now;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += wait / G_USEC_PER_SEC;
+			ts.tv_nsec += (wait % G_USEC_PER_SEC) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&speak_queue_marks_cond,
+					       &speak_queue_marks_mutex, &ts);
+			continue;
+		}
+
+		g_queue_pop_head(&speak_queue_pending_marks);
+		pthread_mutex_unlock(&speak_queue_marks_mutex);
+
+		if (!speak_queue_stop_requested)
+			speak_queue_report_mark(mark->markId);
+		g_free(mark->markId);
+		g_free(mark);
+
+		pthread_mutex_lock(&speak_queue_marks_mutex);
+		pthread_cond_broadcast(&speak_queue_marks_cond);
+	}
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+
+	DBG(DBG_MODNAME " Index marks thread ended.......");
+	return NULL;
+}
+
 /* Playback thread. */
 static void *speak_queue_play(void *nothing)
 {
@@ -454,31 +826,17 @@ static void *speak_queue_play(void *nothing)
 				break;
 			case SPEAK_QUEUE_QET_INDEX_MARK:
 				markId = playback_queue_entry->data.markId;
-				DBG(DBG_MODNAME " reporting index mark |%s|.",
-				    markId);
-				module_report_index_mark(markId);
-				DBG(DBG_MODNAME " index mark reported.");
-				pthread_mutex_lock(&speak_queue_mutex);
-				if (speak_queue_state == SPEAKING
-				    && speak_queue_pause_state ==
-				    SPEAK_QUEUE_PAUSE_REQUESTED
-				    && speak_queue_stop_or_pause_sleeping
-				    && g_str_has_prefix(markId, "__spd_")) {
-					DBG(DBG_MODNAME " Pause requested in playback thread.  Stopping.");
-					speak_queue_stop_requested = TRUE;
-					speak_queue_pause_state =
-					    SPEAK_QUEUE_PAUSE_MARK_REPORTED;
-					pthread_cond_signal
-					    (&speak_queue_stop_or_pause_cond);
-					finished = TRUE;
+				if (speak_queue_keep_at_mark(markId)) {
+					finished = speak_queue_keep_paused(markId);
+					break;
 				}
-				pthread_mutex_unlock(&speak_queue_mutex);
+				/* Report it when the audio before it is
+				   heard rather than when it was fed */
+				if (!speak_queue_delay_mark(markId))
+					finished = speak_queue_report_mark(markId);
 				break;
 			case SPEAK_QUEUE_QET_SOUND_ICON:
-				if (speak_queue_configured) {
-					spd_audio_end(module_audio_id);
-					speak_queue_configured = FALSE;
-				}
+				speak_queue_end_audio();
 				speak_queue_send_file_to_audio(playback_queue_entry->
 						 data.sound_icon_filename);
 				break;
@@ -496,10 +854,9 @@ static void *speak_queue_play(void *nothing)
 					break;
 				}
 			case SPEAK_QUEUE_QET_END:
-				if (speak_queue_configured) {
-					spd_audio_end(module_audio_id);
-					speak_queue_configured = FALSE;
-				}
+				speak_queue_end_audio();
+				/* The audio is drained, so they are due */
+				speak_queue_wait_marks();
 				pthread_mutex_lock(&speak_queue_mutex);
 				DBG(DBG_MODNAME " playback thread got END from queue.");
 				if (speak_queue_state == SPEAKING) {
@@ -526,15 +883,12 @@ static void *speak_queue_play(void *nothing)
 				break;
 			}
 
-			speak_queue_delete_playback_queue_entry
+			speak_queue_release_playback_queue_entry
 			    (playback_queue_entry);
 			if (finished)
 				break;
 		}
-		if (speak_queue_configured) {
-			spd_audio_end(module_audio_id);
-			speak_queue_configured = FALSE;
-		}
+		speak_queue_end_audio();
 		pthread_mutex_lock(&speak_queue_mutex);
 	}
 	speak_queue_play_sleeping = 1;
@@ -559,6 +913,12 @@ void module_speak_queue_flush(void)
 void module_speak_queue_stop(void)
 {
 	pthread_mutex_lock(&speak_queue_mutex);
+	if (speak_queue_pause_state == SPEAK_QUEUE_PAUSE_KEPT) {
+		/* The pause was reported already */
+		pthread_mutex_unlock(&speak_queue_mutex);
+		module_speak_queue_drop_paused();
+		return;
+	}
 	if (speak_queue_state != IDLE &&
 	    !speak_queue_stop_requested &&
 	    speak_queue_stop_or_pause_sleeping) {
@@ -584,6 +944,60 @@ void module_speak_queue_pause(void)
 	pthread_mutex_unlock(&speak_queue_mutex);
 }
 
+void module_speak_queue_set_pause_keep(int maxsize)
+{
+	pthread_mutex_lock(&speak_queue_mutex);
+	speak_queue_keep_maxsize = maxsize;
+	pthread_mutex_unlock(&speak_queue_mutex);
+}
+
+gboolean module_speak_queue_resume(void)
+{
+	gboolean resumed;
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	resumed = speak_queue_pause_state == SPEAK_QUEUE_PAUSE_KEPT
+	    && !g_atomic_int_get(&playback_queue_overflow);
+	if (resumed) {
+		speak_queue_pause_state = SPEAK_QUEUE_PAUSE_OFF;
+		g_atomic_int_set(&playback_queue_limit, speak_queue_maxsize);
+		pthread_cond_signal(&speak_queue_play_cond);
+	}
+	pthread_mutex_unlock(&speak_queue_mutex);
+
+	/* Something is missing, the caller has to synthesize it again */
+	if (!resumed)
+		module_speak_queue_drop_paused();
+	return resumed;
+}
+
+gboolean module_speak_queue_drop_paused(void)
+{
+	pthread_mutex_lock(&speak_queue_mutex);
+	if (speak_queue_pause_state != SPEAK_QUEUE_PAUSE_KEPT) {
+		pthread_mutex_unlock(&speak_queue_mutex);
+		return FALSE;
+	}
+	DBG(DBG_MODNAME " Dropping the kept audio.");
+	/* Wake the playback thread, without reporting a stop */
+	speak_queue_state = IDLE;
+	speak_queue_pause_state = SPEAK_QUEUE_PAUSE_OFF;
+	pthread_cond_signal(&speak_queue_play_cond);
+	pthread_cond_broadcast(&playback_queue_room_condition);
+	while (!speak_queue_play_sleeping)
+		pthread_cond_wait(&speak_queue_play_sleeping_cond,
+				  &speak_queue_mutex);
+	pthread_mutex_unlock(&speak_queue_mutex);
+
+	speak_queue_clear_playback_queue();
+	speak_queue_clear_marks();
+
+	pthread_mutex_lock(&speak_queue_mutex);
+	module_speak_queue_reset();
+	pthread_mutex_unlock(&speak_queue_mutex);
+	return TRUE;
+}
+
 void module_speak_queue_terminate(void)
 {
 	pthread_mutex_lock(&speak_queue_mutex);
@@ -597,16 +1011,34 @@ void module_speak_queue_terminate(void)
 	pthread_cond_signal(&speak_queue_stop_or_pause_cond);
 	pthread_mutex_unlock(&speak_queue_mutex);
 
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	pthread_cond_broadcast(&speak_queue_marks_cond);
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+
 	DBG(DBG_MODNAME " Joining play thread.");
 	pthread_join(speak_queue_play_thread, NULL);
 	DBG(DBG_MODNAME " Joining stop thread.");
 	pthread_join(speak_queue_stop_or_pause_thread, NULL);
+
+	pthread_mutex_lock(&speak_queue_marks_mutex);
+	speak_queue_marks_quit = TRUE;
+	pthread_cond_broadcast(&speak_queue_marks_cond);
+	pthread_mutex_unlock(&speak_queue_marks_mutex);
+	DBG(DBG_MODNAME " Joining index marks thread.");
+	pthread_join(speak_queue_marks_thread, NULL);
 }
 
 void module_speak_queue_free(void)
 {
+	int i;
+
 	DBG(DBG_MODNAME " Freeing resources.");
 	speak_queue_clear_playback_queue();
+	for (i = 0; i < SPEAK_QUEUE_RING_SIZE; i++) {
+		g_free(playback_queue[i].buf);
+		playback_queue[i].buf = NULL;
+		playback_queue[i].buf_size = 0;
+	}
 }
 
 /* Stop or Pause thread. */
@@ -629,8 +1061,15 @@ static void *speak_queue_stop_or_pause(void *nothing)
 
 		pthread_cond_signal(&playback_queue_data_condition);
 		pthread_cond_broadcast(&playback_queue_room_condition);
+		/* In case the playback thread keeps a pause */
+		pthread_cond_signal(&speak_queue_play_cond);
 		pthread_mutex_unlock(&speak_queue_mutex);
 
+		/* In case the playback thread waits for pending marks */
+		pthread_mutex_lock(&speak_queue_marks_mutex);
+		pthread_cond_broadcast(&speak_queue_marks_cond);
+		pthread_mutex_unlock(&speak_queue_marks_mutex);
+
 		if (module_audio_id) {
 			pthread_mutex_lock(&speak_queue_mutex);
 			speak_queue_state = IDLE;
@@ -662,14 +1101,19 @@ static void *speak_queue_stop_or_pause(void *nothing)
 
 		DBG(DBG_MODNAME " Clearing playback queue.");
 		speak_queue_clear_playback_queue();
+		speak_queue_clear_marks();
 
 		int save_pause_state = speak_queue_pause_state;
 		pthread_mutex_lock(&speak_queue_mutex);
 		module_speak_queue_reset();
 		pthread_mutex_unlock(&speak_queue_mutex);
 
+		SPD_PROBE1(speak_queue_stopped,
+			   save_pause_state == SPEAK_QUEUE_PAUSE_MARK_REPORTED);
 		if (save_pause_state == SPEAK_QUEUE_PAUSE_MARK_REPORTED) {
 			module_report_event_pause();
+		} else if (save_pause_state == SPEAK_QUEUE_PAUSE_KEPT) {
+			/* The pause was reported when it was kept */
 		} else {
 			module_report_event_stop();
 		}
@@ -170,6 +170,10 @@ int module_speak_queue_before_play(void);
 
 /* To be called from the synth callback to push different types of events.  */
 gboolean module_speak_queue_add_audio(const AudioTrack *track, AudioFormat format);
+/* Same, but without copying track->samples, which must have been allocated
+ * with g_malloc.  They are freed by the queue, also on failure, and
+ * track->samples is set to NULL.  */
+gboolean module_speak_queue_take_audio(AudioTrack *track, AudioFormat format);
 gboolean module_speak_queue_add_mark(const char *markId);
 gboolean module_speak_queue_add_sound_icon(const char *filename);
 /* To be called on the last synth callback call.  */
@@ -185,6 +189,18 @@ void module_speak_queue_stop(void);
 /* To be called from module_pause.  */
 void module_speak_queue_pause(void);
 
+/* Make module_speak_queue_pause() keep up to maxsize audio frames after the
+ * index mark it stops at, 0 (the default) dropping them.  The playback
+ * waits there until module_speak_queue_resume(), and the synth may keep
+ * adding to the queue meanwhile, without waiting for room.  */
+void module_speak_queue_set_pause_keep(int maxsize);
+/* Continue the playback paused with the audio kept.  Returns FALSE if it
+ * was not kept, or not all of it, and it is dropped.  */
+gboolean module_speak_queue_resume(void);
+/* Drop the audio kept by a pause, without reporting an event.  Returns
+ * FALSE if there was none.  */
+gboolean module_speak_queue_drop_paused(void);
+
 /* To be called first from module_close to terminate audio early.  */
 void module_speak_queue_terminate(void);
 
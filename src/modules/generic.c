@@ -30,6 +30,7 @@
 #include <speechd_types.h>
 
 #include "module_utils.h"
+#include "sound_icons.h"
 
 #define MODULE_NAME     "generic"
 #define MODULE_VERSION  "0.2"
@@ -186,6 +187,8 @@ int module_init(char **status_info)
 		return -1;
 	}
 
+	sound_icons_preload(GenericSoundIconFolder);
+
 	*status_info = g_strdup("Everything ok so far.");
 	return 0;
 }
@@ -266,6 +269,8 @@ int module_stop(void)
 		DBG("generic: stopping process group pid %d\n", generic_pid);
 		kill(-generic_pid, SIGKILL);
 	}
+	if (generic_speaking && module_audio_id)
+		spd_audio_stop(module_audio_id);
 	return 0;
 }
 
@@ -377,12 +382,19 @@ void *_generic_speak(void *nothing)
 			    strchr(generic_message, '/')) {
 				DBG("Warning: bad icon name %s\n", generic_message);
 			}
-			char *cmd = g_strdup_printf("%s '%s/%s'", play_command, GenericSoundIconFolder, generic_message);
+			char *path = g_strdup_printf("%s/%s", GenericSoundIconFolder, generic_message);
 			module_report_event_begin();
-			DBG("icon command = |%s|\n", cmd);
-			system(cmd);
+			/* Play it from memory if we have the audio output,
+			   the play command otherwise */
+			if (module_audio_id == NULL
+			    || !sound_icons_play(module_audio_id, path)) {
+				char *cmd = g_strdup_printf("%s '%s'", play_command, path);
+				DBG("icon command = |%s|\n", cmd);
+				system(cmd);
+				free(cmd);
+			}
 			module_report_event_end();
-			free(cmd);
+			g_free(path);
 			generic_speaking = 0;
 			continue;
 		}
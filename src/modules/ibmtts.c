@@ -63,6 +63,7 @@
 #include "module_utils.h"
 
 #include "speak_queue.h"
+#include "sound_icons.h"
 
 typedef enum {
 	MODULE_FATAL_ERROR = -1,
@@ -453,6 +454,7 @@ int module_init(char **status_info)
 		DBG(DBG_MODNAME "queue initialization failed.");
 		return MODULE_FATAL_ERROR;
 	}
+	sound_icons_preload(IbmttsSoundIconFolder);
 
 	DBG(DBG_MODNAME "Creating new thread for TTS synthesis.");
 	sem_init(&synth_semaphore, 0, 0);
@@ -28,8 +28,13 @@
 #include <fdsetconv.h>
 #include "module_utils.h"
 #include "module_main.h"
+#include "sound_icons.h"
 
 static char *module_audio_pars[10];
+/* Not plugin parameters, applied by spd_audio itself */
+static int module_audio_output_rate;
+static int module_audio_output_channels;
+static int module_sound_icon_cache_size = -1;
 
 int log_level;
 
@@ -158,6 +163,14 @@ int module_set(const char *cur_item, const char *cur_value)
 	return 0;
 }
 
+#define SET_AUDIO_NUM(name,var) \
+	if(!strcmp(cur_item, #name)){ \
+		char *tptr; \
+		int number = strtol(cur_value, &tptr, 10); \
+		if (tptr == cur_value || number < 0) return -1; \
+		var = number; \
+	}
+
 #define SET_AUDIO_STR(name,idx) \
 	if(!strcmp(cur_item, #name)){ \
 		g_free(module_audio_pars[idx]); \
@@ -183,6 +196,16 @@ int module_audio_set(const char *cur_item, const char *cur_value) {
 	SET_AUDIO_STR(audio_pulse_min_length, 5)
 	    else
 	/* 6 reserved for speech-dispatcher module name */
+	SET_AUDIO_STR(audio_null_file, 7)
+	    else
+	SET_AUDIO_STR(audio_null_speed, 8)
+	    else
+	SET_AUDIO_NUM(audio_output_rate, module_audio_output_rate)
+	    else
+	SET_AUDIO_NUM(audio_output_channels, module_audio_output_channels)
+	    else
+	SET_AUDIO_NUM(sound_icon_cache_size, module_sound_icon_cache_size)
+	    else
 		return -1;	/* Unknown parameter */
 	return 0;
 }
@@ -676,6 +699,14 @@ int module_audio_init(char **status_info)
 			DBG("Using %s audio output method", outputs[i]);
 			g_strfreev(outputs);
 
+			spd_audio_set_output_format(module_audio_id,
+						    module_audio_output_rate,
+						    module_audio_output_channels);
+			if (module_sound_icon_cache_size >= 0)
+				sound_icons_set_cache_size((size_t)
+							   module_sound_icon_cache_size
+							   * 1024);
+
 			/* Volume is controlled by the synthesizer. Always play at normal on audio device. */
 			if (spd_audio_set_volume(module_audio_id, 85) < 0) {
 				DBG("Can't set volume. audio not initialized?");
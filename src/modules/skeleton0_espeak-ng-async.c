@@ -191,6 +191,21 @@ int module_audio_set(const char *var, const char *val)
 	} else if (!strcmp(var, "audio_pulse_min_length")) {
 		/* TODO */
 		return 0;
+	} else if (!strcmp(var, "audio_null_file")) {
+		/* TODO */
+		return 0;
+	} else if (!strcmp(var, "audio_null_speed")) {
+		/* TODO */
+		return 0;
+	} else if (!strcmp(var, "audio_output_rate")) {
+		/* TODO */
+		return 0;
+	} else if (!strcmp(var, "audio_output_channels")) {
+		/* TODO */
+		return 0;
+	} else if (!strcmp(var, "sound_icon_cache_size")) {
+		/* TODO */
+		return 0;
 	}
 	return -1;
 }
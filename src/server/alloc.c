@@ -22,6 +22,7 @@
 #endif
 
 #include "alloc.h"
+#include "server.h"
 
 TFDSetElement spd_fdset_copy(TFDSetElement *old)
 {
@@ -40,6 +41,7 @@ TFDSetElement spd_fdset_copy(TFDSetElement *old)
 	new.audio_nas_server = g_strdup(old->audio_nas_server);
 	new.audio_pulse_server = g_strdup(old->audio_pulse_server);
 	new.audio_pulse_device = g_strdup(old->audio_pulse_device);
+	new.audio_null_file = g_strdup(old->audio_null_file);
 
 	return new;
 
@@ -59,6 +61,8 @@ TSpeechDMessage *spd_message_copy(TSpeechDMessage * old)
 	memcpy(new->buf, old->buf, old->bytes);
 	new->buf[new->bytes] = 0;
 	new->settings = spd_fdset_copy(&old->settings);
+	if (new->stream != NULL)
+		stream_ref(new->stream);
 
 	return new;
 }
@@ -78,6 +82,7 @@ void mem_free_fdset(TFDSetElement * fdset)
 	g_free(fdset->audio_nas_server);
 	g_free(fdset->audio_pulse_server);
 	g_free(fdset->audio_pulse_device);
+	g_free(fdset->audio_null_file);
 }
 
 void mem_free_message(TSpeechDMessage * msg)
@@ -86,5 +91,7 @@ void mem_free_message(TSpeechDMessage * msg)
 		return;
 	g_free(msg->buf);
 	mem_free_fdset(&(msg->settings));
+	if (msg->stream != NULL)
+		stream_unref(msg->stream);
 	g_free(msg);
 }
@@ -187,6 +187,17 @@ GLOBAL_FDSET_OPTION_CB_STR(DefaultModule, output_module)
     GLOBAL_FDSET_OPTION_CB_STR(AudioPulseServer, audio_pulse_server)
     GLOBAL_FDSET_OPTION_CB_STR(AudioPulseDevice, audio_pulse_device)
     GLOBAL_FDSET_OPTION_CB_INT(AudioPulseMinLength, audio_pulse_min_length, 1, "")
+    GLOBAL_FDSET_OPTION_CB_STR(AudioNullFile, audio_null_file)
+    GLOBAL_FDSET_OPTION_CB_INT(AudioNullSpeed, audio_null_speed, val >= 0,
+			       "Null audio speed must be non-negative.")
+    GLOBAL_FDSET_OPTION_CB_INT(AudioOutputRate, audio_output_rate, val >= 0,
+			       "Audio output rate must be non-negative.")
+    GLOBAL_FDSET_OPTION_CB_INT(AudioOutputChannels, audio_output_channels,
+			       (val >= 0) && (val <= 2),
+			       "Audio output channels must be 0, 1 or 2.")
+    GLOBAL_FDSET_OPTION_CB_INT(SoundIconCacheSize, sound_icon_cache_size,
+			       val >= 0,
+			       "Sound icon cache size must be non-negative.")
 
     GLOBAL_FDSET_OPTION_CB_INT(DefaultRate, msg_settings.rate, (val >= -100)
 			       && (val <= +100), "Rate out of range.")
@@ -226,6 +237,18 @@ GLOBAL_FDSET_OPTION_CB_STR(DefaultModule, output_module)
     SPEECHD_OPTION_CB_INT(MaxQueueSize, max_queue_size, val >= 0,
 		      "Invalid parameter!")
     SPEECHD_OPTION_CB_INT_M(Timeout, server_timeout, val >= 0, "Invalid timeout value!")
+    SPEECHD_OPTION_CB_INT(FlightRecorderSize, flight_recorder_size, val >= 0,
+		      "Invalid parameter!")
+    SPEECHD_OPTION_CB_INT(FlightRecorderWatchdog, flight_recorder_watchdog,
+		      val >= 0, "Invalid parameter!")
+    SPEECHD_OPTION_CB_INT(SymbolsCacheSize, symbols_cache_size, val >= 0,
+		      "Invalid parameter!")
+    SPEECHD_OPTION_CB_INT(IndexMarksOnDemand, index_marks_on_demand,
+		      val == 0 || val == 1, "Invalid parameter!")
+    SPEECHD_OPTION_CB_INT(MessageSegmentLength, message_segment_length,
+		      val >= 0, "Invalid parameter!")
+    SPEECHD_OPTION_CB_INT(PausedAudioSize, paused_audio_size,
+		      val >= 0, "Invalid parameter!")
 
     DOTCONF_CB(cb_LanguageDefaultModule)
 {
@@ -432,6 +455,12 @@ configoption_t *load_config_options(int *num_options)
 	ADD_CONFIG_OPTION(LogFile, ARG_STR);
 	ADD_CONFIG_OPTION(LogDir, ARG_STR);
 	ADD_CONFIG_OPTION(CustomLogFile, ARG_LIST);
+	ADD_CONFIG_OPTION(FlightRecorderSize, ARG_INT);
+	ADD_CONFIG_OPTION(FlightRecorderWatchdog, ARG_INT);
+	ADD_CONFIG_OPTION(SymbolsCacheSize, ARG_INT);
+	ADD_CONFIG_OPTION(IndexMarksOnDemand, ARG_INT);
+	ADD_CONFIG_OPTION(MessageSegmentLength, ARG_INT);
+	ADD_CONFIG_OPTION(PausedAudioSize, ARG_INT);
 	ADD_CONFIG_OPTION(LogLevel, ARG_INT);
 	ADD_CONFIG_OPTION(DefaultModule, ARG_STR);
 	ADD_CONFIG_OPTION(LanguageDefaultModule, ARG_LIST);
@@ -461,6 +490,11 @@ configoption_t *load_config_options(int *num_options)
 	ADD_CONFIG_OPTION(AudioPulseServer, ARG_STR);
 	ADD_CONFIG_OPTION(AudioPulseDevice, ARG_STR);
 	ADD_CONFIG_OPTION(AudioPulseMinLength, ARG_INT);
+	ADD_CONFIG_OPTION(AudioNullFile, ARG_STR);
+	ADD_CONFIG_OPTION(AudioNullSpeed, ARG_INT);
+	ADD_CONFIG_OPTION(AudioOutputRate, ARG_INT);
+	ADD_CONFIG_OPTION(AudioOutputChannels, ARG_INT);
+	ADD_CONFIG_OPTION(SoundIconCacheSize, ARG_INT);
 
 	ADD_CONFIG_OPTION(BeginClient, ARG_STR);
 	ADD_CONFIG_OPTION(EndClient, ARG_NONE);
@@ -497,9 +531,20 @@ void load_default_global_set_options()
 	GlobalFDSet.audio_pulse_server = g_strdup("default");
 	GlobalFDSet.audio_pulse_device = g_strdup("default");
 	GlobalFDSet.audio_pulse_min_length = 10;
+	GlobalFDSet.audio_null_file = g_strdup("none");
+	GlobalFDSet.audio_null_speed = 1;
+	GlobalFDSet.audio_output_rate = 0;
+	GlobalFDSet.audio_output_channels = 0;
+	GlobalFDSet.sound_icon_cache_size = 4096;
 
 	SpeechdOptions.max_history_messages = 10000;
 	SpeechdOptions.max_queue_size = 10000;
+	SpeechdOptions.flight_recorder_size = 4096;
+	SpeechdOptions.flight_recorder_watchdog = 30;
+	SpeechdOptions.symbols_cache_size = 256;
+	SpeechdOptions.index_marks_on_demand = 0;
+	SpeechdOptions.message_segment_length = 0;
+	SpeechdOptions.paused_audio_size = 4096;
 
 	/* Options which are accessible from command line must be handled
 	   specially to make sure we don't overwrite them */
@@ -0,0 +1,123 @@
+/*
+ * escaping.c - SSIP dot escaping of message text
+ *
+ * Copyright (C) 2001, 2002, 2003, 2007 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "escaping.h"
+
+/*
+ * deescape_dot: Replace .. with . at the start of lines or at the
+ * start of the string.
+ * @orig_text: text to be unescaped.
+ * @orig_len: length of the text.
+ * Returns: a freshly allocated string, containing the unescaped data.
+ *
+ * In SSIP, the message terminator is \r\n.\r\n, just as it is in SMTP
+ * and similar protocols.  Thus, period needs to be escaped when it
+ * is the only character on a line.  deescape_dot reverts that
+ * transformation, after the message is received.
+ * This function deserves further examination.
+ */
+
+char *deescape_dot(const char *orig_text, size_t orig_len)
+{
+	/* Constants.  DOTLINE is CRLF followed by a period.
+	 * DOTLINELEN is the length of DOTLINE.
+	 * ESCAPED_DOTLINELEN is the length of the sequence \r\n..,
+	 * which is used in the original (unescaped) text.
+	 */
+	static const char *DOTLINE = "\r\n.";
+	static const size_t DOTLINELEN = 3;
+	static const size_t ESCAPED_DOTLINELEN = 4;	/* \r\n.. */
+
+	char *out_text = NULL;
+	char *out_ptr;
+	const char *orig_end = orig_text + orig_len;
+
+	if (orig_text == NULL)
+		return NULL;
+
+	out_text = g_malloc(orig_len + 1);
+	/* We may have allocated more than we need.  In any case, out_text
+	 * can be no longer than orig_text.
+	 * Note: g_malloc aborts the program on failure to allocate. */
+
+	out_ptr = out_text;
+	if (orig_len >= 2) {
+		/* De-escape .. at start of text. */
+		if ((orig_text[0] == '.') && (orig_text[1] == '.')) {
+			*(out_ptr++) = '.';
+			orig_text = orig_text + 2;
+		}
+	}
+
+	while (orig_text < orig_end) {
+		if ((orig_text[0] == '\r') && (orig_text[1] == '\n')
+		    && (orig_text[2] == '.') && (orig_text[3] == '.')) {
+			/* We just found \r\n.., the sequence we want to unescape. */
+			memcpy(out_ptr, DOTLINE, DOTLINELEN);
+			out_ptr += DOTLINELEN;
+			orig_text += ESCAPED_DOTLINELEN;
+		} else {
+			/* Just copy the character from source to destination... */
+			*(out_ptr++) = *(orig_text++);
+		}
+	}
+
+	*out_ptr = '\0';	/* NUL-terminate. */
+	return out_text;
+}
+
+char *escape_dot(char *otext)
+{
+	const char *seq, *run;
+	GString *ntext;
+
+	if (otext == NULL)
+		return NULL;
+
+	MSG2(5, "escaping", "Incoming text: |%s|", otext);
+
+	/* Most texts have nothing to escape, keep them as they are */
+	if (otext[0] != '.' && !strstr(otext, "\n."))
+		return otext;
+
+	ntext = g_string_sized_new(strlen(otext) + 16);
+	run = otext;
+
+	if (otext[0] == '.') {
+		g_string_append(ntext, "..");
+		run += 1;
+	}
+
+	while ((seq = strstr(run, "\n."))) {
+		g_string_append_len(ntext, run, seq - run);
+		g_string_append(ntext, "\n..");
+		run = seq + 2;
+	}
+	g_string_append(ntext, run);
+
+	g_free(otext);
+
+	MSG2(6, "escaping", "Altered text: |%s|", ntext->str);
+
+	return g_string_free(ntext, FALSE);
+}
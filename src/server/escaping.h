@@ -0,0 +1,32 @@
+/*
+ * escaping.h - SSIP dot escaping of message text (header)
+ *
+ * Copyright (C) 2001, 2002, 2003, 2007 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "speechd.h"
+
+#ifndef ESCAPING_H
+#define ESCAPING_H
+
+/* Replace .. with . at the start of lines of a received message */
+char *deescape_dot(const char *orig_text, size_t orig_len);
+
+/* Replace . with .. at the start of lines of a message sent to a module.
+   _otext_ is freed if a new string is returned. */
+char *escape_dot(char *otext);
+
+#endif /* ESCAPING_H */
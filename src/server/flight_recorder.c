@@ -0,0 +1,292 @@
+/*
+ * flight_recorder.c - In-memory ring of recent server events
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "speechd.h"
+#include "flight_recorder.h"
+
+#define FR_TEXT_LEN 40
+
+/* One record is 64 bytes, so that the default ring fits in 256KiB */
+typedef struct {
+	gint64 time;		/* g_get_monotonic_time() */
+	gint seq;		/* Record number + 1, 0 while being written */
+	guint16 event;
+	guint16 len;
+	gint32 a;
+	gint32 b;
+	gchar text[FR_TEXT_LEN];
+} FRRecord;
+
+typedef struct {
+	const char *kind;	/* The MSG2 kind the event belongs to */
+	const char *name;
+	gboolean progress;	/* Whether it shows that speech is progressing */
+} FREventInfo;
+
+static const FREventInfo fr_events[FR_EVENT_COUNT] = {
+	[FR_CLIENT_DATA] = {"protocol", "data", FALSE},
+	[FR_CLIENT_REPLY] = {"protocol", "reply", FALSE},
+	[FR_MSG_QUEUED] = {"queue", "queued", FALSE},
+	[FR_MSG_DEQUEUED] = {"queue", "dequeued", FALSE},
+	[FR_SYMBOLS] = {"symbols", "process", FALSE},
+	[FR_INDEX_MARKS] = {"index_marking", "insert", FALSE},
+	[FR_INDEX_MARK] = {"index_marking", "reported", TRUE},
+	[FR_MODULE_SPEAK] = {"output_module", "speak", TRUE},
+	[FR_MODULE_CMD] = {"output_module", "command", FALSE},
+	[FR_MODULE_REPLY] = {"output_module", "reply", TRUE},
+	[FR_MODULE_EVENT] = {"output_module", "event", TRUE},
+	[FR_MODULE_AUDIO] = {"output_module", "audio", TRUE},
+	[FR_MODULE_STOP] = {"output_module", "stop", FALSE},
+	[FR_MODULE_PAUSE] = {"output_module", "pause", FALSE},
+	[FR_MODULE_DONE] = {"output_module", "done", TRUE},
+	[FR_MODULE_RESTART] = {"output_module", "restart", FALSE},
+};
+
+static FRRecord *fr_ring;
+static guint fr_mask;
+static gint fr_next;
+
+/* Watchdog state, updated without locking: a late update only delays or
+   advances the watchdog by one period. */
+static gint fr_speaking;
+static gint64 fr_last_progress;
+static gint fr_stall_reported;
+static gint fr_watchdog_timeout;
+static gint fr_watchdog_armed;	/* The main loop checks every second */
+
+static void flight_recorder_arm_watchdog(void);
+
+void flight_recorder_init(int size)
+{
+	guint n = 1;
+
+	if (fr_ring != NULL || size <= 0)
+		return;
+
+	while (n < (guint) size)
+		n <<= 1;
+
+	fr_ring = g_new0(FRRecord, n);
+	fr_mask = n - 1;
+	MSG(4, "Flight recorder keeps the last %u events", n);
+}
+
+void flight_recorder_record(FREvent event, int a, int b,
+			    const char *text, int len)
+{
+	FRRecord *rec;
+	guint seq;
+	gint64 now;
+
+	if (fr_ring == NULL)
+		return;
+
+	now = g_get_monotonic_time();
+	seq = (guint) g_atomic_int_add(&fr_next, 1);
+	rec = &fr_ring[seq & fr_mask];
+
+	/* Invalidate the slot while we fill it, so that a concurrent dump
+	   skips it instead of printing a mix of two events */
+	g_atomic_int_set(&rec->seq, 0);
+	rec->time = now;
+	rec->event = event;
+	rec->a = a;
+	rec->b = b;
+	if (text == NULL)
+		len = 0;
+	else if (len < 0)
+		len = strnlen(text, FR_TEXT_LEN);
+	else if (len > FR_TEXT_LEN)
+		len = FR_TEXT_LEN;
+	if (len > 0)
+		memcpy(rec->text, text, len);
+	rec->len = len;
+	g_atomic_int_set(&rec->seq, (gint) (seq + 1));
+
+	if (event == FR_MODULE_SPEAK) {
+		fr_speaking = 1;
+		flight_recorder_arm_watchdog();
+	} else if (event == FR_MODULE_DONE)
+		fr_speaking = 0;
+	if (fr_events[event].progress) {
+		fr_last_progress = now;
+		fr_stall_reported = 0;
+	}
+}
+
+void flight_recorder_record_command(FREvent event, int a, const char *line,
+				    int len)
+{
+	int start = 0, end;
+
+	if (line == NULL) {
+		flight_recorder_record(event, a, MAX(len, 0), NULL, 0);
+		return;
+	}
+	if (len < 0)
+		len = strlen(line);
+	while (start < len && g_ascii_isspace(line[start]))
+		start++;
+	end = start;
+	while (end < len && !g_ascii_isspace(line[end]))
+		end++;
+	flight_recorder_record(event, a, len, line + start, end - start);
+}
+
+static void flight_recorder_print(FILE *f, const FRRecord *rec, gint64 now)
+{
+	const FREventInfo *info = &fr_events[rec->event];
+	gint64 age = now > rec->time ? now - rec->time : 0;
+	int i;
+
+	fprintf(f, "-%" G_GINT64_FORMAT ".%06d %s %s %d %d |",
+		age / G_USEC_PER_SEC, (int) (age % G_USEC_PER_SEC),
+		info->kind, info->name, rec->a, rec->b);
+	for (i = 0; i < rec->len; i++) {
+		unsigned char c = rec->text[i];
+		fputc(c < ' ' ? '.' : c, f);
+	}
+	fputs("|\n", f);
+}
+
+int flight_recorder_dump(const char *log_dir, const char *reason)
+{
+	FRRecord rec;
+	FILE *f;
+	char stamp[32];
+	char *path;
+	time_t t;
+	struct tm tm;
+	gint64 now;
+	guint next, first, i, size;
+
+	if (fr_ring == NULL)
+		return -1;
+
+	t = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&t, &tm));
+	if (log_dir == NULL || !strcmp(log_dir, "stdout")
+	    || !strcmp(log_dir, "stderr")) {
+		f = stderr;
+		path = NULL;
+	} else {
+		path = g_strdup_printf("%s/flight-recorder-%s.log", log_dir,
+				       stamp);
+		f = fopen(path, "w");
+		if (f == NULL) {
+			MSG(2, "Can't write flight recorder to %s: %s", path,
+			    strerror(errno));
+			g_free(path);
+			return -1;
+		}
+	}
+
+	now = g_get_monotonic_time();
+	size = fr_mask + 1;
+	next = (guint) g_atomic_int_get(&fr_next);
+	first = next > size ? next - size : 0;
+
+	fprintf(f, "Speech Dispatcher flight recorder, %s, dumped on %s\n",
+		stamp, reason);
+	fprintf(f, "%u events, ages in seconds: age kind event a b |text|\n",
+		next - first);
+
+	for (i = first; i != next; i++) {
+		const FRRecord *slot = &fr_ring[i & fr_mask];
+
+		if ((guint) g_atomic_int_get(&slot->seq) != i + 1)
+			continue;
+		rec = *slot;
+		/* Skip it if it got overwritten while we copied it */
+		if ((guint) g_atomic_int_get(&slot->seq) != i + 1)
+			continue;
+		if (rec.event >= FR_EVENT_COUNT || rec.len > FR_TEXT_LEN)
+			continue;
+		flight_recorder_print(f, &rec, now);
+	}
+
+	if (path != NULL) {
+		fclose(f);
+		MSG(2, "Flight recorder dumped to %s (%s)", path, reason);
+		g_free(path);
+	} else {
+		fflush(f);
+	}
+	return 0;
+}
+
+/* Return TRUE once when speech is in progress but no module progress was
+   recorded for timeout seconds */
+static gboolean flight_recorder_stalled(int timeout)
+{
+	if (fr_ring == NULL || timeout <= 0 || !fr_speaking
+	    || fr_stall_reported)
+		return FALSE;
+
+	if (g_get_monotonic_time() - fr_last_progress <
+	    (gint64) timeout * G_USEC_PER_SEC)
+		return FALSE;
+
+	fr_stall_reported = 1;
+	return TRUE;
+}
+
+static gboolean flight_recorder_watchdog(gpointer user_data)
+{
+	int timeout = g_atomic_int_get(&fr_watchdog_timeout);
+
+	if (flight_recorder_stalled(timeout)) {
+		MSG(2, "Output module made no progress for %d seconds",
+		    timeout);
+		flight_recorder_dump(SpeechdOptions.log_dir, "watchdog");
+	}
+	if (fr_speaking && timeout > 0)
+		return TRUE;
+
+	/* Speech may have started again meanwhile */
+	g_atomic_int_set(&fr_watchdog_armed, 0);
+	if (fr_speaking && timeout > 0
+	    && g_atomic_int_compare_and_exchange(&fr_watchdog_armed, 0, 1))
+		return TRUE;
+	return FALSE;
+}
+
+/* From any thread */
+static void flight_recorder_arm_watchdog(void)
+{
+	if (g_atomic_int_get(&fr_watchdog_timeout) > 0
+	    && g_atomic_int_compare_and_exchange(&fr_watchdog_armed, 0, 1))
+		g_timeout_add_seconds(1, flight_recorder_watchdog, NULL);
+}
+
+void flight_recorder_set_watchdog(int timeout)
+{
+	g_atomic_int_set(&fr_watchdog_timeout, timeout);
+	if (fr_ring != NULL && fr_speaking)
+		flight_recorder_arm_watchdog();
+}
@@ -0,0 +1,81 @@
+/*
+ * flight_recorder.h - In-memory ring of recent server events
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The flight recorder keeps the last events of the protocol, queue and module
+ * layers in a fixed-size binary ring, so that it can stay enabled while
+ * LogLevel is low.  Recording only stores two integers and a truncated copy
+ * of a string, all text formatting is done when the ring is dumped, on SIGUSR2
+ * or when the watchdog notices that the speaking module stopped progressing.
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <glib.h>
+
+typedef enum {
+	/* "protocol" */
+	FR_CLIENT_DATA,		/* a = fd, b = length, text = command verb */
+	FR_CLIENT_REPLY,	/* a = fd, text = reply */
+	/* "queue" */
+	FR_MSG_QUEUED,		/* a = message id, b = priority */
+	FR_MSG_DEQUEUED,	/* a = message id, b = priority */
+	/* "symbols" */
+	FR_SYMBOLS,		/* a = level, b = support level */
+	/* "index_marking" */
+	FR_INDEX_MARKS,		/* a = message id, b = resulting length */
+	FR_INDEX_MARK,		/* a = message id, text = mark reported to client */
+	/* "output_module" */
+	FR_MODULE_SPEAK,	/* a = message id, b = message type, text = module */
+	FR_MODULE_CMD,		/* a = wait for reply, b = length, text = verb */
+	FR_MODULE_REPLY,	/* a = result, text = reply */
+	FR_MODULE_EVENT,	/* text = event */
+	FR_MODULE_AUDIO,	/* a = samples, b = sample rate */
+	FR_MODULE_STOP,		/* text = module */
+	FR_MODULE_PAUSE,	/* text = module */
+	FR_MODULE_DONE,		/* text = final event (__spd_end, __spd_stopped...) */
+	FR_MODULE_RESTART,	/* text = module */
+	FR_EVENT_COUNT
+} FREvent;
+
+/* Allocate a ring of size records (rounded up to a power of two).
+   A size of 0 leaves the recorder disabled, recording is then a no-op.  */
+void flight_recorder_init(int size);
+
+/* Record an event.  text may be NULL, and len may be -1 if text is
+   NUL-terminated; only its first bytes are kept.  */
+void flight_recorder_record(FREvent event, int a, int b,
+			    const char *text, int len);
+
+/* Record a command line of len bytes, -1 if NUL-terminated.  Only its
+   first word is kept, never its arguments or the text spoken, and b is
+   set to its length.  line may be NULL for data that is only counted. */
+void flight_recorder_record_command(FREvent event, int a, const char *line,
+				    int len);
+
+/* Write the ring as text to a new file in log_dir.  */
+int flight_recorder_dump(const char *log_dir, const char *reason);
+
+/* Dump the ring when speech is in progress but no module progress was
+   recorded for timeout seconds, 0 disabling it.  The check only runs in
+   the main loop while speech is in progress.  */
+void flight_recorder_set_watchdog(int timeout);
+
+#endif /* FLIGHT_RECORDER_H */
@@ -26,19 +26,53 @@
 #endif
 
 #include "index_marking.h"
+#include "flight_recorder.h"
 
-void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
+/* Whether _c_ is one of the NFKC-stable ranges of
+   spd_utf8_is_normalized() */
+static int spd_unichar_is_normalized(gunichar c)
+{
+	if (c >= 0xc0 && c <= 0x17f)
+		/* Latin-1 letters and Latin Extended-A, but ligatures and
+		   middle dots which have compatibility decompositions */
+		return c != 0x132 && c != 0x133 && c != 0x13f && c != 0x140
+		    && c != 0x149 && c != 0x17f;
+	return (c >= 0x391 && c <= 0x3c9 && c != 0x3a2)	/* Greek letters */
+	    || (c >= 0x400 && c <= 0x45f);	/* Cyrillic */
+}
+
+int spd_utf8_is_normalized(const char *text)
+{
+	const unsigned char *p = (const unsigned char *)text;
+	gunichar c;
+
+	while (*p) {
+		if (*p < 0x80) {
+			p++;
+			continue;
+		}
+		c = g_utf8_get_char_validated((const char *)p, -1);
+		if (c == (gunichar) - 1 || c == (gunichar) - 2
+		    || !spd_unichar_is_normalized(c))
+			return 0;
+		p = (const unsigned char *)g_utf8_next_char(p);
+	}
+
+	return 1;
+}
+
+void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode,
+			int marks)
 {
 	GString *marked_text;
-	char *pos;
-	char character[6];
-	char character2[6];
+	const char *pos, *run;
+	const char *entity;
+	char mark[64];
+	int mark_len;
 	gunichar u_char;
 	int n = 0;
-	int ret;
 	int inside_tag = 0;
-
-	marked_text = g_string_new("");
+	size_t len;
 
 	assert(msg != NULL);
 	assert(msg->buf != NULL);
@@ -46,83 +80,86 @@ void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode)
 	MSG2(5, "index_marking", "MSG before index marking: |%s|, ssml_mode=%d",
 	     msg->buf, ssml_mode);
 
-	if (ssml_mode == SPD_DATA_TEXT)
-		g_string_printf(marked_text, "<speak>");
+	/* Already SSML, and nobody needs the marks */
+	if (!marks && ssml_mode == SPD_DATA_SSML)
+		return;
 
-	pos = msg->buf;
-	while (pos) {
-		ret = spd_utf8_read_char(pos, character);
-		if (ret == 0 || (strlen(character) == 0))
+	/* Leave room for some entities and marks, so that we usually
+	   don't need to reallocate */
+	len = strlen(msg->buf);
+	marked_text = g_string_sized_new(len + len / 8 + 32);
+
+	if (ssml_mode == SPD_DATA_TEXT)
+		g_string_append(marked_text, "<speak>");
+
+	/* Only these ASCII characters need care, everything else is copied
+	   in runs as it is.  strcspn() is vectorized by the C library, so
+	   plain text is skipped several bytes at a time. */
+	run = pos = msg->buf;
+	for (;;) {
+		pos += strcspn(pos, marks ? "<>&.?!" : "<>&");
+		if (*pos == '\0')
 			break;
-		u_char = g_utf8_get_char(character);
+		entity = NULL;
 
-		if (u_char == '<') {
-			if (ssml_mode == SPD_DATA_SSML) {
+		switch (*pos) {
+		case '<':
+			if (ssml_mode == SPD_DATA_SSML)
 				inside_tag = 1;
-				g_string_append_printf(marked_text, "%s",
-						       character);
-			} else
-				g_string_append_printf(marked_text, "&lt;");
-		} else if (u_char == '>') {
-			if (ssml_mode == SPD_DATA_SSML) {
+			else
+				entity = "&lt;";
+			break;
+		case '>':
+			if (ssml_mode == SPD_DATA_SSML)
 				inside_tag = 0;
-				g_string_append_printf(marked_text, "%s",
-						       character);
-			} else
-				g_string_append_printf(marked_text, "&gt;");
-		} else if (u_char == '&') {
-			if (ssml_mode == SPD_DATA_SSML) {
-				g_string_append_printf(marked_text, "%s",
-						       character);
-			} else {
-				if (!inside_tag)
-					g_string_append_printf(marked_text,
-							       "&amp;");
-			}
-		} else
-		    if (((u_char == '.') || (u_char == '?') || (u_char == '!'))
-			&& !inside_tag) {
-			pos = g_utf8_find_next_char(pos, NULL);
-			ret = spd_utf8_read_char(pos, character2);
-			if ((ret == 0) || (strlen(character2) == 0)) {
-				g_string_append_printf(marked_text, "%s",
-						       character);
-				MSG2(6, "index_marking", "MSG altering 1: |%s|",
-				     marked_text->str);
+			else
+				entity = "&gt;";
+			break;
+		case '&':
+			if (ssml_mode != SPD_DATA_SSML)
+				entity = "&amp;";
+			break;
+		case '.':
+		case '?':
+		case '!':
+			if (!marks || inside_tag)
 				break;
-			}
-			u_char = g_utf8_get_char(character2);
-			if ((g_unichar_isspace(u_char)) || (u_char == '<')
-			    || (u_char == '&')) {
-				g_string_append_printf(marked_text,
-						       "%s" SD_MARK_HEAD "%d"
-						       SD_MARK_TAIL,
-						       character, n);
+			/* Mark the end of sentences */
+			u_char = g_utf8_get_char(pos + 1);
+			if (u_char != 0 && (g_unichar_isspace(u_char)
+					    || u_char == '<' || u_char == '&')) {
+				g_string_append_len(marked_text, run,
+						    pos + 1 - run);
+				mark_len = g_snprintf(mark, sizeof(mark),
+						      SD_MARK_HEAD "%d"
+						      SD_MARK_TAIL, n);
+				g_string_append_len(marked_text, mark,
+						    mark_len);
 				n++;
-				MSG2(6, "index_marking", "MSG altering 2: |%s|",
-				     marked_text->str);
-				continue;
-			} else {
-				g_string_append_printf(marked_text, "%s",
-						       character);
-				MSG2(6, "index_marking", "MSG altering 3: |%s|",
+				run = pos + 1;
+				MSG2(6, "index_marking", "MSG altering: |%s|",
 				     marked_text->str);
-				continue;
 			}
-		} else {
-			g_string_append_printf(marked_text, "%s", character);
+			break;
 		}
 
-		pos = g_utf8_find_next_char(pos, NULL);
+		if (entity) {
+			g_string_append_len(marked_text, run, pos - run);
+			g_string_append(marked_text, entity);
+			run = pos + 1;
+		}
+		pos++;
 	}
+	g_string_append_len(marked_text, run, pos - run);
 
 	if (ssml_mode == SPD_DATA_TEXT)
-		g_string_append_printf(marked_text, "</speak>");
+		g_string_append(marked_text, "</speak>");
 
-	g_free(msg->buf);
-	msg->buf = marked_text->str;
+	flight_recorder_record(FR_INDEX_MARKS, msg->id, marked_text->len,
+			       NULL, 0);
 
-	g_string_free(marked_text, 0);
+	g_free(msg->buf);
+	msg->buf = g_string_free(marked_text, FALSE);
 
 	MSG2(5, "index_marking", "MSG after index marking: |%s|", msg->buf);
 }
@@ -204,3 +241,113 @@ char *strip_index_marks(const char *buf, SPDDataMode ssml_mode)
 
 	return strret;
 }
+
+/* Append the segment _start_.._end_ of the body of a message to
+   _segments_, in a speak element of its own */
+static void add_segment(GPtrArray * segments, const char *open_tag,
+			int open_len, const char *start, const char *end)
+{
+	g_ptr_array_add(segments,
+			g_strdup_printf("%.*s%.*s</speak>", open_len, open_tag,
+					(int)(end - start), start));
+}
+
+char **split_index_marked_text(const char *buf, int length)
+{
+	GPtrArray *segments;
+	const char *open_tag, *body, *end;
+	const char *p, *q, *r;
+	const char *start, *prev_start, *cut;
+	int open_len;
+	int depth = 0;
+
+	assert(buf != NULL);
+
+	if (length <= 0 || strlen(buf) <= length)
+		return NULL;
+
+	/* Only cut messages which are a single speak element, so that each
+	   segment can get the same root element */
+	open_tag = buf + strspn(buf, " \t\r\n");
+	if (strncmp(open_tag, "<speak", 6)
+	    || (open_tag[6] != '>' && !g_ascii_isspace(open_tag[6])))
+		return NULL;
+	body = strchr(open_tag, '>');
+	if (body == NULL || body[-1] == '/')
+		return NULL;
+	body++;
+	open_len = body - open_tag;
+	end = g_strrstr(body, "</speak>");
+	if (end == NULL || end[8 + strspn(end + 8, " \t\r\n")] != '\0')
+		return NULL;
+
+	segments = g_ptr_array_new_with_free_func(g_free);
+	start = prev_start = body;
+	cut = NULL;
+	p = body;
+	while ((q = strchr(p, '<')) != NULL && q < end) {
+		if (!strncmp(q, SD_MARK_HEAD, strlen(SD_MARK_HEAD))) {
+			r = strstr(q, SD_MARK_TAIL);
+			if (r == NULL)
+				break;
+			p = r = r + strlen(SD_MARK_TAIL);
+			/* Only cut at sentence ends which are outside of
+			   any other element */
+			if (depth != 0)
+				continue;
+			if (r - start > length) {
+				/* Cut at the previous sentence end, or here
+				   if this sentence alone is too long */
+				if (cut == NULL)
+					cut = r;
+				add_segment(segments, open_tag, open_len,
+					    start, cut);
+				prev_start = start;
+				start = cut;
+				cut = NULL;
+			}
+			if (r > start)
+				cut = r;
+			continue;
+		}
+
+		if (!strncmp(q, "<!--", 4)) {
+			r = strstr(q, "-->");
+			if (r == NULL)
+				break;
+			p = r + 3;
+			continue;
+		}
+		r = strchr(q, '>');
+		if (r == NULL)
+			break;
+		if (q[1] == '/')
+			depth--;
+		else if (q[1] != '?' && q[1] != '!' && r[-1] != '/')
+			depth++;
+		p = r + 1;
+	}
+
+	if (end - start > length && cut != NULL) {
+		add_segment(segments, open_tag, open_len, start, cut);
+		prev_start = start;
+		start = cut;
+	}
+	if (segments->len > 0 && start + strspn(start, " \t\r\n") == end) {
+		/* Nothing left to say, extend the last segment instead */
+		g_ptr_array_remove_index(segments, segments->len - 1);
+		start = prev_start;
+	}
+	add_segment(segments, open_tag, open_len, start, end);
+
+	if (segments->len < 2) {
+		g_ptr_array_free(segments, TRUE);
+		return NULL;
+	}
+
+	MSG2(5, "index_marking", "Message split into %u segments",
+	     segments->len);
+
+	g_ptr_array_add(segments, NULL);
+	return (char **)g_ptr_array_free(segments, FALSE);
+}
@@ -30,8 +30,15 @@
 #define SD_MARK_HEAD "<mark name=\""SD_MARK_BODY
 #define SD_MARK_TAIL "\"/>"
 
-/* Insert index marks into a message. */
-void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode);
+/* Return 1 if _text_ is valid UTF-8 that g_utf8_normalize() would leave
+   unchanged with G_NORMALIZE_ALL_COMPOSE.  This only knows about the most
+   common scripts, so 0 means it has to be normalized to find out. */
+int spd_utf8_is_normalized(const char *text);
+
+/* Insert index marks into a message, and convert it to SSML if it
+   is plain text.  If _marks_ is 0, only the conversion is done. */
+void insert_index_marks(TSpeechDMessage * msg, SPDDataMode ssml_mode,
+			int marks);
 
 /* Find the index mark specified as _mark_ and return the
 rest of the text after that index mark. */
@@ -41,4 +48,11 @@ char *find_index_mark(TSpeechDMessage * msg, int mark);
    allocated string. */
 char *strip_index_marks(const char *buf, SPDDataMode ssml_mode);
 
+/* Split the SSML message _buf_ after the index marks ending its
+   sentences, into segments of about _length_ bytes which are each a
+   complete speak element.  Return a NULL-terminated array to be freed
+   with g_strfreev(), or NULL if _buf_ is not longer than _length_ or
+   can't be split. */
+char **split_index_marked_text(const char *buf, int length);
+
 #endif /* INDEX_MARKING_H */
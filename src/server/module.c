@@ -33,10 +33,12 @@
 #include <dirent.h>
 #include <glib.h>
 #include <dotconf.h>
+#include <spd_probes.h>
 
 #include "speechd.h"
 #include "output.h"
 #include "module.h"
+#include "flight_recorder.h"
 
 static char *spd_get_path(const char *filename, const char *startdir)
 {
@@ -570,6 +572,8 @@ int reload_output_module(OutputModule * old_module)
 		return 0;
 
 	MSG(3, "Reloading output module %s", old_module->name);
+	SPD_PROBE1(module_restart, old_module->name);
+	flight_recorder_record(FR_MODULE_RESTART, 0, 0, old_module->name, -1);
 
 	output_close(old_module);
 	close(old_module->pipe_in[1]);
@@ -82,6 +82,10 @@
 #define OK_INSIDE_BLOCK					"260 OK INSIDE BLOCK" NEWLINE
 #define OK_OUTSIDE_BLOCK				"261 OK OUTSIDE BLOCK" NEWLINE
 
+#define OK_INSIDE_STREAM				"264 OK INSIDE STREAM" NEWLINE
+#define C_OK_INSIDE_STREAM				"264"
+#define OK_OUTSIDE_STREAM				"265 OK OUTSIDE STREAM" NEWLINE
+
 #define OK_DEBUGGING					"262 OK DEBUGGING SET" NEWLINE
 
 #define OK_PITCH_RANGE_SET				"263 OK PITCH RANGE SET" NEWLINE
@@ -131,6 +135,7 @@
 #define ERR_ALREADY_INSIDE_BLOCK		"330 ERR ALREADY INSIDE BLOCK" NEWLINE
 #define ERR_ALREADY_OUTSIDE_BLOCK		"331 ERR ALREADY OUTSIDE BLOCK" NEWLINE
 #define ERR_NOT_ALLOWED_INSIDE_BLOCK	"332 ERR NOT ALLOWED INSIDE BLOCK" NEWLINE
+#define ERR_ALREADY_OUTSIDE_STREAM		"334 ERR ALREADY OUTSIDE STREAM" NEWLINE
 
 #define ERR_COULDNT_SET_PITCH_RANGE		"340 ERR COULDNT SET PITCH RANGE" NEWLINE
 
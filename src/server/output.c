@@ -25,10 +25,13 @@
 
 #include <fdsetconv.h>
 #include <safe_io.h>
+#include <spd_probes.h>
 #include "output.h"
 #include "parse.h"
 #include "speak_queue.h"
 #include "index_marking.h"
+#include "escaping.h"
+#include "flight_recorder.h"
 
 #ifndef HAVE_STRNDUP
 /*
@@ -56,15 +59,37 @@ char *strndup(const char *s, size_t n)
 #endif /* HAVE_STRNDUP */
 
 static pthread_t output_thread;
+static int output_thread_joinable;
 static void *output_thread_func(void *data);
 static int output_end_queued;
 static int output_stop_requested;
 static int output_pause_requested;
 
+/* Long messages are sent in segments, see split_index_marked_text().  The
+   output thread takes the end of each segment but the last one for a
+   SD_MARK_BODY "segment" event, and the speak thread then sends the next
+   one with output_speak_segment().  Meanwhile, the module is idle but the
+   message is still being spoken, so a stop or a pause has to be handled
+   without it. */
+static pthread_mutex_t output_segments_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char **output_segments;	/* NULL if the message is sent in one piece */
+static int output_segment;	/* Index of the next segment to send */
+static int output_segment_pending;	/* Between two segments */
+static int output_segments_id;	/* Id of the message being sent */
+
+/* With server audio, a pause keeps the audio after the index mark it stops
+   at, see module_speak_queue_set_pause_keep(), and the module goes on with
+   its segment meanwhile, so that output_resume() can continue without
+   synthesizing again.  Also protected by output_segments_mutex. */
+static OutputModule *output_kept;	/* NULL if nothing is kept */
+static int output_kept_paused;	/* The pause was reported */
+static int output_drop_kept(void);
+
 static void output_open_audio(OutputModule *output)
 {
 	void *pars[9] = { NULL };
 	char min_length[11];
+	char null_speed[11];
 	char *error;
 	gchar **outputs;
 	int i;
@@ -76,6 +101,9 @@ static void output_open_audio(OutputModule *output)
 	snprintf(min_length, sizeof(min_length), "%u", GlobalFDSet.audio_pulse_min_length);
 	pars[4] = min_length;
 	pars[5] = output->name;
+	pars[6] = GlobalFDSet.audio_null_file;
+	snprintf(null_speed, sizeof(null_speed), "%u", GlobalFDSet.audio_null_speed);
+	pars[7] = null_speed;
 
 	outputs = g_strsplit(GlobalFDSet.audio_output_method, ",", 0);
 	for (i = 0; NULL != outputs[i]; i++) {
@@ -85,6 +113,10 @@ static void output_open_audio(OutputModule *output)
 			DBG("Using %s audio output method", outputs[i]);
 			g_strfreev(outputs);
 
+			spd_audio_set_output_format(output->audio,
+						    GlobalFDSet.audio_output_rate,
+						    GlobalFDSet.audio_output_channels);
+
 			/* Volume is controlled by the synthesizer. Always play at normal on audio device. */
 			if (spd_audio_set_volume(output->audio, 85) < 0) {
 				DBG("Can't set volume. audio not initialized?");
@@ -112,6 +144,23 @@ void output_set_speaking_monitor(TSpeechDMessage * msg, OutputModule * output)
 	speaking_gid = msg->settings.reparted;
 }
 
+static void output_start_thread(OutputModule * output)
+{
+	if (spd_pthread_create(&output_thread, NULL, output_thread_func, output))
+		MSG(1, "Can't create the output thread");
+	else
+		output_thread_joinable = 1;
+}
+
+/* Wait for the output thread to be done with the module, if not yet */
+static void output_join_thread(void)
+{
+	if (!output_thread_joinable)
+		return;
+	pthread_join(output_thread, NULL);
+	output_thread_joinable = 0;
+}
+
 OutputModule *get_output_module_by_name(const char *name)
 {
 	OutputModule *output;
@@ -374,6 +423,10 @@ int output_send_data(const char *cmd, OutputModule * output, int wfr)
 	}
 	MSG2(5, "output_module", "Command sent to output module: |%s| (%d)",
 	     cmd, wfr);
+	SPD_PROBE3(module_cmd_sent, output->name, cmd, wfr);
+	/* What is not waiting for a reply is the text, or its settings */
+	flight_recorder_record_command(FR_MODULE_CMD, wfr, wfr ? cmd : NULL,
+				       strlen(cmd));
 
 	if (wfr) {		/* wait for reply? */
 		int ret = 0;
@@ -383,6 +436,7 @@ int output_send_data(const char *cmd, OutputModule * output, int wfr)
 
 		MSG2(5, "output_module", "Reply from output module: |%s|",
 		     response->str);
+		SPD_PROBE2(module_cmd_replied, output->name, response->str);
 
 		switch (response->str[0]) {
 		case '3':
@@ -407,6 +461,8 @@ int output_send_data(const char *cmd, OutputModule * output, int wfr)
 			ret = -3;
 			break;
 		}
+		flight_recorder_record(FR_MODULE_REPLY, ret, 0, response->str,
+				       response->len);
 		g_string_free(response, TRUE);
 		return ret;
 	}
@@ -667,6 +723,11 @@ int output_send_audio_settings(OutputModule * output)
 	//ADD_SET_STR(audio_pulse_server);
 	ADD_SET_STR(audio_pulse_device);
 	ADD_SET_INT(audio_pulse_min_length);
+	ADD_SET_STR(audio_null_file);
+	ADD_SET_INT(audio_null_speed);
+	ADD_SET_INT(audio_output_rate);
+	ADD_SET_INT(audio_output_channels);
+	ADD_SET_INT(sound_icon_cache_size);
 
 	SEND_CMD_N("AUDIO");
 	SEND_DATA_N(set_str->str);
@@ -732,22 +793,38 @@ int output_send_debug(OutputModule * output, int flag, const char *log_path)
 
 int output_speak(TSpeechDMessage * msg, OutputModule *output)
 {
+	char **segments = NULL;
+	const char *text;
 	int err;
 	int ret;
-	char *newbuf;
 
 	if (msg == NULL)
 		return -1;
 
 	output_lock();
 
-	newbuf = escape_dot(msg->buf);
-	if (newbuf != msg->buf) {
-		g_free(msg->buf);
-		msg->buf = newbuf;
-	}
+	/* The paused message is not to be resumed any more */
+	if (output_drop_kept() < 0)
+		OL_RET(-1)
+
+	/* This frees the previous buffer if it needs escaping */
+	msg->buf = escape_dot(msg->buf);
 	msg->bytes = -1;
 
+	if (msg->settings.type == SPD_MSGTYPE_TEXT)
+		segments =
+		    split_index_marked_text(msg->buf,
+					    SpeechdOptions.message_segment_length);
+
+	pthread_mutex_lock(&output_segments_mutex);
+	g_strfreev(output_segments);
+	output_segments = segments;
+	output_segment = 0;
+	output_segment_pending = 0;
+	output_segments_id = msg->id;
+	text = segments != NULL ? segments[output_segment++] : msg->buf;
+	pthread_mutex_unlock(&output_segments_mutex);
+
 	output_set_speaking_monitor(msg, output);
 
 	if (module_audio_id) {
@@ -778,20 +855,114 @@ int output_speak(TSpeechDMessage * msg, OutputModule *output)
 		MSG(2, "Invalid message type in output_speak()!");
 	}
 
-	SEND_DATA(msg->buf)
+	SEND_DATA(text)
 	    SEND_CMD("\n.")
 
+	flight_recorder_record(FR_MODULE_SPEAK, msg->id, msg->settings.type,
+			       output->name, -1);
+
 	/* Start a thread that will process the module events */
 	output_end_queued = 0;
 	output_stop_requested = 0;
 	output_pause_requested = 0;
-	spd_pthread_create(&output_thread, NULL, output_thread_func, output);
+	output_start_thread(output);
 
 	output_unlock();
 
 	return 0;
 }
 
+int output_speak_segment(void)
+{
+	const char *text = NULL;
+	OutputModule *output;
+	int err;
+
+	output_lock();
+
+	pthread_mutex_lock(&output_segments_mutex);
+	if (output_segment_pending) {
+		output_segment_pending = 0;
+		text = output_segments[output_segment++];
+	}
+	pthread_mutex_unlock(&output_segments_mutex);
+
+	/* Stopped or paused meanwhile */
+	if (text == NULL)
+		OL_RET(0)
+
+	if (speaking_module == NULL)
+		OL_RET(-1)
+		    else
+		output = speaking_module;
+
+	/* The output thread exited after the end of the previous segment */
+	output_join_thread();
+
+	MSG(4, "Module speak, segment %d!", output_segment);
+
+	SEND_CMD("SPEAK");
+	SEND_DATA(text)
+	    SEND_CMD("\n.")
+
+	flight_recorder_record(FR_MODULE_SPEAK, output_segments_id,
+			       SPD_MSGTYPE_TEXT, output->name, -1);
+
+	output_start_thread(output);
+
+	OL_RET(0)
+}
+
+/* Called by the output thread when the module is done with a message.
+   Return 1 if it was one segment of it and the next one is to be sent. */
+static int output_segment_done(void)
+{
+	int more;
+
+	pthread_mutex_lock(&output_segments_mutex);
+	more = output_segments != NULL && output_segments[output_segment] != NULL;
+	if (more) {
+		output_segment_pending = 1;
+		/* Otherwise output_resume() reports it */
+		if (!output_kept_paused)
+			module_report_index_mark(SD_MARK_BODY "segment");
+	}
+	pthread_mutex_unlock(&output_segments_mutex);
+
+	return more;
+}
+
+/* Drop the segments not sent yet, since the message is being stopped or
+   paused.  Return 1 if the module is already done with the previous
+   segment.  In that case, if _mark_ is not NULL, it is set to the last
+   index mark of that segment. */
+static int output_segments_interrupt(char **mark)
+{
+	int between;
+	const char *p, *q;
+
+	pthread_mutex_lock(&output_segments_mutex);
+	between = output_segment_pending;
+	output_segment_pending = 0;
+	if (between && mark != NULL) {
+		*mark = NULL;
+		p = g_strrstr(output_segments[output_segment - 1],
+			      SD_MARK_HEAD);
+		if (p != NULL) {
+			p += strlen(SD_MARK_HEAD) - SD_MARK_BODY_LEN;
+			q = strstr(p, SD_MARK_TAIL);
+			if (q != NULL)
+				*mark = g_strndup(p, q - p);
+		}
+	}
+	g_strfreev(output_segments);
+	output_segments = NULL;
+	output_segment = 0;
+	pthread_mutex_unlock(&output_segments_mutex);
+
+	return between;
+}
+
 int output_stop()
 {
 	int err;
@@ -804,6 +975,18 @@ int output_stop()
 		    else
 		output = speaking_module;
 
+	SPD_PROBE1(stop_requested, output->name);
+	flight_recorder_record(FR_MODULE_STOP, 0, 0, output->name, -1);
+
+	if (output_segments_interrupt(NULL)) {
+		MSG(4, "module is between two segments, stop directly");
+		if (output->audio)
+			module_speak_queue_stop();
+		else
+			module_report_event_stop();
+		OL_RET(0)
+	}
+
 	if (output->audio)
 	{
 		if (output_end_queued) {
@@ -826,6 +1009,7 @@ size_t output_pause()
 {
 	static int err;
 	static OutputModule *output;
+	char *mark;
 
 	output_lock();
 
@@ -834,6 +1018,34 @@ size_t output_pause()
 		    else
 		output = speaking_module;
 
+	SPD_PROBE1(pause_requested, output->name);
+	flight_recorder_record(FR_MODULE_PAUSE, 0, 0, output->name, -1);
+
+	if (output->audio && SpeechdOptions.paused_audio_size > 0) {
+		MSG(4, "pausing speak_queue, keeping the audio");
+		pthread_mutex_lock(&output_segments_mutex);
+		output_kept = output;
+		output_kept_paused = 0;
+		pthread_mutex_unlock(&output_segments_mutex);
+		module_speak_queue_pause();
+		OL_RET(0)
+	}
+
+	if (output_segments_interrupt(&mark)) {
+		MSG(4, "module is between two segments, pause directly");
+		if (!output->audio) {
+			module_report_event_pause();
+		} else {
+			/* Let the speak queue pause at the end of what it
+			   still has to play */
+			module_speak_queue_pause();
+			if (mark == NULL || !module_speak_queue_add_mark(mark))
+				module_speak_queue_stop();
+		}
+		g_free(mark);
+		OL_RET(0)
+	}
+
 	if (output->audio)
 	{
 		if (output_end_queued) {
@@ -852,6 +1064,78 @@ size_t output_pause()
 	OL_RET(0)
 }
 
+/* Drop the audio kept by output_pause() and stop the module if it is still
+   working on the paused message.  Called with the output lock held. */
+static int output_drop_kept(void)
+{
+	OutputModule *output;
+	int running;
+
+	pthread_mutex_lock(&output_segments_mutex);
+	output = output_kept;
+	output_kept = NULL;
+	output_kept_paused = 0;
+	running = !output_segment_pending && !output_end_queued;
+	pthread_mutex_unlock(&output_segments_mutex);
+
+	if (output == NULL)
+		return 0;
+
+	MSG(4, "Dropping the audio kept by the pause");
+	output_segments_interrupt(NULL);
+	if (running) {
+		/* Its audio is discarded meanwhile */
+		output_stop_requested = 1;
+		if (output_send_data("STOP\n", output, 0) < 0)
+			return -1;
+	}
+	output_join_thread();
+	module_speak_queue_drop_paused();
+
+	return 0;
+}
+
+int output_resume(TSpeechDMessage * msg)
+{
+	OutputModule *output;
+	int segment;
+
+	output_lock();
+
+	pthread_mutex_lock(&output_segments_mutex);
+	output = output_kept_paused ? output_kept : NULL;
+	pthread_mutex_unlock(&output_segments_mutex);
+
+	if (output == NULL)
+		OL_RET(-1)
+
+	if (msg->id != output_segments_id) {
+		output_drop_kept();
+		OL_RET(-1)
+	}
+
+	/* The speak queue reports the begin right away */
+	output_set_speaking_monitor(msg, output);
+	if (!module_speak_queue_resume()) {
+		MSG(4, "Not all the audio was kept, synthesizing again");
+		speaking_module = NULL;
+		output_drop_kept();
+		OL_RET(-1)
+	}
+
+	MSG(4, "Resuming with the kept audio");
+	/* From now on, the end of the segment is reported as usual */
+	pthread_mutex_lock(&output_segments_mutex);
+	segment = output_segment_pending;
+	output_kept = NULL;
+	output_kept_paused = 0;
+	pthread_mutex_unlock(&output_segments_mutex);
+	if (segment)
+		module_report_index_mark(SD_MARK_BODY "segment");
+
+	OL_RET(0)
+}
+
 static GSList *playback_events = NULL;
 static pthread_mutex_t playback_events_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -864,11 +1148,22 @@ static speak_queue_entry *output_new_event(speak_queue_entry_type type)
 
 static void output_queue_event(speak_queue_entry *entry)
 {
+	OutputModule *output = speaking_module;
 	char c = 0;
+
+	if (output == NULL) {
+		/* From a module still working on a paused message, see
+		   output_pause() */
+		MSG(4, "Dropping event %d, the message is paused", entry->type);
+		if (entry->type == SPEAK_QUEUE_QET_INDEX_MARK)
+			g_free(entry->data.markId);
+		g_free(entry);
+		return;
+	}
 	pthread_mutex_lock(&playback_events_mutex);
 	playback_events = g_slist_append(playback_events, entry);
 	pthread_mutex_unlock(&playback_events_mutex);
-	write(speaking_module->pipe_speak[1], &c, 1);
+	write(output->pipe_speak[1], &c, 1);
 }
 
 static void output_queue_new_event(speak_queue_entry_type type)
@@ -940,10 +1235,15 @@ static int output_module_is_speaking(OutputModule * output)
 
 	retcode = 1;
 	MSG2(5, "output_module", "Received event:\n %s", response->str);
+	if (strncmp(response->str, "705", 3))
+		flight_recorder_record(FR_MODULE_EVENT, 0, 0, response->str,
+				       response->len);
 	if (!strncmp(response->str, "701", 3))
 	{
 		MSG2(5, "output_module", "got begin");
-		if (output->audio) {
+		if (output_segment > 1) {
+			/* A later segment of a message which has already begun */
+		} else if (output->audio) {
 			if (!module_speak_queue_before_play())
 				MSG(3, "Warning: couldn't add begin to speak queue");
 		} else {
@@ -953,7 +1253,10 @@ static int output_module_is_speaking(OutputModule * output)
 	else if (!strncmp(response->str, "702", 3))
 	{
 		MSG2(5, "output_module", "got end");
-		if (output->audio) {
+		if (output_segment_done()) {
+			MSG2(5, "output_module", "end of segment %d",
+			     output_segment);
+		} else if (output->audio) {
 			if (output_stop_requested) {
 				MSG(4, "we sent STOP early, now tell the speak queue");
 				module_speak_queue_stop();
@@ -1096,13 +1399,14 @@ static int output_module_is_speaking(OutputModule * output)
 			goto out;
 
 		size = track.num_channels * track.num_samples * track.bits / 8;
-		track.samples = malloc(size);
+		track.samples = g_malloc(size);
 		filled = 0;
 
 		end = memchr(p, '\n', end - p);
 		if (!end) {
 			MSG2(2, "output_module",
 				"ERROR: bogus audio end of line %s", p);
+			g_free(track.samples);
 			retcode = -5;
 			goto out;
 		}
@@ -1161,16 +1465,19 @@ static int output_module_is_speaking(OutputModule * output)
 		}
 
 		if (retcode < 0) {
-			free(track.samples);
+			g_free(track.samples);
 			goto out;
 		}
 
 		MSG2(5, "output_module",
 			"Got audio: eventually %zd bytes", size);
+		SPD_PROBE4(audio_received, track.num_samples, track.num_channels,
+			   track.sample_rate, track.bits);
+		flight_recorder_record(FR_MODULE_AUDIO, track.num_samples,
+				       track.sample_rate, NULL, 0);
 
-		gboolean ret = module_speak_queue_add_audio(&track, format);
-
-		free(track.samples);
+		/* The speak queue keeps our buffer */
+		gboolean ret = module_speak_queue_take_audio(&track, format);
 
 		if (!ret)
 			MSG2(2, "output_module", "Audio interrupted");
@@ -1213,7 +1520,7 @@ int output_is_speaking(char **index_mark)
 
 	speak_queue_entry *entry;
 	char c;
-	int end = 0;
+	int end = 0, paused = 0;
 
 	/* Wait for next event */
 	read(output->pipe_speak[0], &c, 1);
@@ -1246,10 +1553,12 @@ int output_is_speaking(char **index_mark)
 			end = 1;
 			break;
 		case SPEAK_QUEUE_QET_PAUSE:
+			SPD_PROBE1(pause_completed, output->name);
 			*index_mark = (char *)g_strdup("__spd_paused");
-			end = 1;
+			end = paused = 1;
 			break;
 		case SPEAK_QUEUE_QET_STOP:
+			SPD_PROBE1(stop_completed, output->name);
 			*index_mark = (char *)g_strdup("__spd_stopped");
 			end = 1;
 			break;
@@ -1261,9 +1570,20 @@ int output_is_speaking(char **index_mark)
 	g_free(entry);
 
 	if (end) {
+		flight_recorder_record(FR_MODULE_DONE, 0, 0, *index_mark, -1);
+		pthread_mutex_lock(&output_segments_mutex);
+		if (paused && output_kept != NULL) {
+			/* The module may still be working on the message */
+			output_kept_paused = 1;
+			end = 0;
+		} else {
+			output_kept = NULL;
+		}
+		pthread_mutex_unlock(&output_segments_mutex);
 		/* Wait for all audio processing to terminate before cleaning
 		 * everything */
-		pthread_join(output_thread, NULL);
+		if (end)
+			output_join_thread();
 	}
 
 	return 0;
@@ -1385,50 +1705,3 @@ int output_check_module(OutputModule * output)
 	}
 	return 0;
 }
-
-char *escape_dot(char *otext)
-{
-	char *seq;
-	GString *ntext;
-	char *ootext;
-	char *ret = NULL;
-
-	if (otext == NULL)
-		return NULL;
-
-	MSG2(5, "escaping", "Incoming text: |%s|", otext);
-
-	ootext = otext;
-
-	ntext = g_string_new("");
-
-	if (otext[0] == '.') {
-		g_string_append(ntext, "..");
-		otext += 1;
-	}
-
-	MSG2(6, "escaping", "Altering text (I): |%s|", ntext->str);
-
-	while ((seq = strstr(otext, "\n."))) {
-		*seq = 0;
-		g_string_append(ntext, otext);
-		g_string_append(ntext, "\n..");
-		otext = seq + 2;
-	}
-
-	MSG2(6, "escaping", "Altering text (II): |%s|", ntext->str);
-
-	if (otext == ootext) {
-		g_string_free(ntext, 1);
-		ret = otext;
-	} else {
-		g_string_append(ntext, otext);
-		g_free(ootext);
-		ret = ntext->str;
-		g_string_free(ntext, 0);
-	}
-
-	MSG2(6, "escaping", "Altered text: |%s|", ret);
-
-	return ret;
-}
@@ -25,15 +25,15 @@
 OutputModule *get_output_module(const TSpeechDMessage * message);
 
 int output_speak(TSpeechDMessage * msg, OutputModule *output);
+int output_speak_segment(void);
 int output_stop(void);
 size_t output_pause(void);
+int output_resume(TSpeechDMessage * msg);
 int output_is_speaking(char **index_mark);
 int output_send_debug(OutputModule * output, int flag, const char *logfile_path);
 
 int output_check_module(OutputModule * output);
 
-char *escape_dot(char *otext);
-
 void output_set_speaking_monitor(TSpeechDMessage * msg, OutputModule * output);
 GString *output_read_reply(OutputModule * output);
 int output_send_data(const char *cmd, OutputModule * output, int wfr);
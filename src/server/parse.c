@@ -33,6 +33,7 @@
 #include "server.h"
 #include "sem_functions.h"
 #include "output.h"
+#include "escaping.h"
 #include "fdsetconv.h"
 
 /*
@@ -110,6 +111,7 @@ char *parse(const char *buf, const int bytes, const int fd)
 		CHECK_SSIP_COMMAND("get", parse_get, BLOCK_NO);
 		CHECK_SSIP_COMMAND("help", parse_help, BLOCK_NO);
 		CHECK_SSIP_COMMAND("block", parse_block, BLOCK_OK);
+		CHECK_SSIP_COMMAND("stream", parse_stream, BLOCK_OK);
 
 		if (!strcmp(command, "bye") || !strcmp(command, "quit")) {
 			MSG(4, "Bye received.");
@@ -175,6 +177,26 @@ enddata:
 				return g_strdup(ERR_INVALID_ENCODING);
 			}
 
+			/* Inside a stream, the text is appended to the open
+			   message and queued sentence by sentence */
+			if (speechd_socket->stream != NULL) {
+				char *text;
+
+				text = deescape_dot(speechd_socket->o_buf->str,
+						    speechd_socket->o_bytes);
+				server_data_off(fd);
+				msg_uid = stream_append(fd, speechd_socket,
+							text, 0);
+				g_free(text);
+				if (msg_uid < 0)
+					return g_strdup(ERR_INTERNAL);
+				if (msg_uid == 0)
+					return g_strdup(OK_MSG_CANCELED);
+				return g_strdup_printf(C_OK_MESSAGE_QUEUED "-%d"
+						       NEWLINE OK_MESSAGE_QUEUED,
+						       msg_uid);
+			}
+
 			new =
 			    (TSpeechDMessage *)
 			    g_malloc(sizeof(TSpeechDMessage));
@@ -183,6 +205,7 @@ enddata:
 			new->buf =
 			    deescape_dot(speechd_socket->o_buf->str,
 					 new->bytes);
+			new->stream = NULL;
 			reparted = speechd_socket->inside_block;
 			MSG(5, "New buf is now: |%s|", new->buf);
 			if ((msg_uid =
@@ -871,6 +894,7 @@ char *parse_general_event(const char *buf, const int bytes, const int fd,
 	msg = (TSpeechDMessage *) g_malloc(sizeof(TSpeechDMessage));
 	msg->bytes = strlen(param);
 	msg->buf = g_strdup(param);
+	msg->stream = NULL;
 
 	msg_uid = queue_message(msg, fd, 1, type, speechd_socket->inside_block);
 	if (msg_uid == 0) {
@@ -1108,6 +1132,10 @@ char *parse_block(const char *buf, const int bytes, const int fd,
 		}
 	} else if (TEST_CMD(cmd_main, "end")) {
 		assert(speechd_socket->inside_block >= 0);
+		if (speechd_socket->stream != NULL) {
+			g_free(cmd_main);
+			return g_strdup(ERR_NOT_ALLOWED_INSIDE_BLOCK);
+		}
 		if (speechd_socket->inside_block > 0) {
 			speechd_socket->inside_block = 0;
 			return g_strdup(OK_OUTSIDE_BLOCK);
@@ -1120,67 +1148,34 @@ char *parse_block(const char *buf, const int bytes, const int fd,
 	}
 }
 
-/*
- * deescape_dot: Replace .. with . at the start of lines or at the
- * start of the string.
- * @orig_text: text to be unescaped.
- * @orig_len: length of the text.
- * Returns: a freshly allocated string, containing the unescaped data.
- *
- * In SSIP, the message terminator is \r\n.\r\n, just as it is in SMTP
- * and similar protocols.  Thus, period needs to be escaped when it
- * is the only character on a line.  deescape_dot reverts that
- * transformation, after the message is received.
- * This function deserves further examination.
- */
-
-char *deescape_dot(const char *orig_text, size_t orig_len)
+char *parse_stream(const char *buf, const int bytes, const int fd,
+		   TSpeechDSock * speechd_socket)
 {
-	/* Constants.  DOTLINE is CRLF followed by a period.
-	 * DOTLINELEN is the length of DOTLINE.
-	 * ESCAPED_DOTLINELEN is the length of the sequence \r\n..,
-	 * which is used in the original (unescaped) text.
-	 */
-	static const char *DOTLINE = "\r\n.";
-	static const size_t DOTLINELEN = 3;
-	static const size_t ESCAPED_DOTLINELEN = 4;	/* \r\n.. */
-
-	char *out_text = NULL;
-	char *out_ptr;
-	const char *orig_end = orig_text + orig_len;
-
-	if (orig_text == NULL)
-		return NULL;
+	char *cmd_main;
+	TSpeechDStream *stream;
 
-	out_text = g_malloc(orig_len + 1);
-	/* We may have allocated more than we need.  In any case, out_text
-	 * can be no longer than orig_text.
-	 * Note: g_malloc aborts the program on failure to allocate. */
-
-	out_ptr = out_text;
-	if (orig_len >= 2) {
-		/* De-escape .. at start of text. */
-		if ((orig_text[0] == '.') && (orig_text[1] == '.')) {
-			*(out_ptr++) = '.';
-			orig_text = orig_text + 2;
-		}
-	}
+	GET_PARAM_STR(cmd_main, 1, CONV_DOWN);
 
-	while (orig_text < orig_end) {
-		if ((orig_text[0] == '\r') && (orig_text[1] == '\n')
-		    && (orig_text[2] == '.') && (orig_text[3] == '.')) {
-			/* We just found \r\n.., the sequence we want to unescape. */
-			memcpy(out_ptr, DOTLINE, DOTLINELEN);
-			out_ptr += DOTLINELEN;
-			orig_text += ESCAPED_DOTLINELEN;
-		} else {
-			/* Just copy the character from source to destination... */
-			*(out_ptr++) = *(orig_text++);
-		}
+	if (TEST_CMD(cmd_main, "begin")) {
+		g_free(cmd_main);
+		if (speechd_socket->inside_block > 0)
+			return g_strdup(ERR_ALREADY_INSIDE_BLOCK);
+		stream = stream_new(fd);
+		speechd_socket->stream = stream;
+		speechd_socket->stream_buf = g_string_new("");
+		speechd_socket->inside_block = ++SpeechdStatus.max_gid;
+		return g_strdup_printf(C_OK_INSIDE_STREAM "-%u" NEWLINE
+				       OK_INSIDE_STREAM, stream->id);
+	} else if (TEST_CMD(cmd_main, "end")) {
+		g_free(cmd_main);
+		if (speechd_socket->stream == NULL)
+			return g_strdup(ERR_ALREADY_OUTSIDE_STREAM);
+		stream_close(fd, speechd_socket);
+		return g_strdup(OK_OUTSIDE_STREAM);
+	} else {
+		g_free(cmd_main);
+		return g_strdup(ERR_PARAMETER_INVALID);
 	}
-
-	*out_ptr = '\0';	/* NUL-terminate. */
-	return out_text;
 }
 
 /* isanum() tests if the given string is a number,
@@ -1249,20 +1244,3 @@ char *get_param(const char *buf, const int n, const int bytes,
 
 	return par;
 }
-
-/* Read one char  (which _pointer_ is pointing to) from an UTF-8 string
- * and store it into _character_. _character_ must have space for
- * at least  7 bytes (6 bytes character + 1 byte trailing 0). This
- * function doesn't validate if the string is valid UTF-8.
- */
-int spd_utf8_read_char(const char *pointer, char *character)
-{
-	int bytes;
-	gunichar u_char;
-
-	u_char = g_utf8_get_char(pointer);
-	bytes = g_unichar_to_utf8(u_char, character);
-	character[bytes] = 0;
-
-	return bytes;
-}
@@ -46,11 +46,11 @@ char *parse_get(const char *buf, const int bytes, const int fd,
 		const TSpeechDSock * speechd_socket);
 char *parse_help(const char *buf, const int bytes, const int fd,
 		 const TSpeechDSock * speechd_socket);
+char *parse_stream(const char *buf, const int bytes, const int fd,
+		   TSpeechDSock * speechd_socket);
 char *parse_block(const char *buf, const int bytes, const int fd,
 		  TSpeechDSock * speechd_socket);
 
-char *deescape_dot(const char *orig_text, size_t orig_len);
-
 /* Function for parsing the input from clients */
 char *get_param(const char *buf, const int n, const int bytes,
 		const int lower_case);
@@ -59,6 +59,5 @@ char *get_param(const char *buf, const int n, const int bytes,
 char *parse_general_event(const char *buf, const int bytes, const int fd,
 			  const TSpeechDSock * speechd_socket,
 			  SPDMessageType type);
-int spd_utf8_read_char(const char *pointer, char *character);
 
 #endif
@@ -0,0 +1,555 @@
+/*
+ * preprocessing_bench.c - Microbenchmark of the text preprocessing pipeline
+ *
+ * Copyright (C) 2021 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This drives the stages a text message goes through in the server
+ * (deescape_dot(), normalization, insert_symbols(),
+ * insert_index_marks() and escape_dot()) over a corpus of realistic inputs,
+ * and insert_char_description() over each of their characters,
+ * for every symbol level and several locales, and reports the time spent per
+ * input byte and the number of allocations per message.
+ *
+ * It is built on demand with "make preprocessing_bench" and run with
+ * "make bench" from src/server.
+ *
+ * With -c, it instead checks that the symbol engines give the same result for
+ * the whole corpus, which "make bench-check" runs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdarg.h>
+#include <time.h>
+
+#include "speechd.h"
+#include "symbols.h"
+#include "index_marking.h"
+#include "escaping.h"
+
+/* The server logging is not linked in, and we don't want any output */
+void MSG(int level, const char *format, ...)
+{
+}
+
+void MSG2(int level, const char *kind, const char *format, ...)
+{
+}
+
+#ifdef __GLIBC__
+/* Count allocations by interposing the allocator used by GLib */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOCATION_COUNT 1
+#else
+static unsigned long allocations;
+#endif
+
+typedef struct {
+	const char *name;
+	const char *text;
+	SPDDataMode ssml_mode;
+} BenchInput;
+
+static const BenchInput corpus[] = {
+	{ "code",
+	  "for (i = 0; i < n; i++) {\n"
+	  "\tif (a[i] != b[i] && *p->q >= 0x7f)\n"
+	  "\t\treturn -1;\t/* ~x | y ^ z */\n"
+	  "}\n"
+	  "#include <stdio.h>\n"
+	  "x = (y << 2) % 3 + z[\"key\"]; // $HOME @user `cmd`\n"
+	  ".\n",
+	  SPD_DATA_TEXT },
+	{ "prose",
+	  "Well... I said -- no, I *shouted* -- \"Stop!\" (Really?) "
+	  "It's 5:30; we're late, aren't we? Yes: 100% late & $20 poorer... "
+	  "[sic] {ok} ~fin~ Dr. Smith's e-mail is j.smith@example.org!!!! "
+	  "See http://example.org/a?b=c&d=e#f.\r\n.\r\nNext line.   ",
+	  SPD_DATA_TEXT },
+	{ "cjk",
+	  "你好，世界！这是一个测试。「日本語」の文章です、句読点もあります。"
+	  "中文標點符號：冒號；分號？問號……省略號——破折號。"
+	  "한국어 문장도 있습니다. 그렇죠?",
+	  SPD_DATA_TEXT },
+	{ "emoji",
+	  "Great job 👍🎉! See you 🙂 at 🕒 with ☕ and 🍰... ❤️🔥 "
+	  "👩‍👩‍👧‍👦 family, 🇫🇷 flag, 👍🏽 thumbs, ✈️ → 🏝️.",
+	  SPD_DATA_TEXT },
+	{ "ssml",
+	  "<speak><p><s>Hello <mark name=\"a\"/>world.</s>"
+	  "<s><emphasis level=\"strong\">Don&apos;t</emphasis> stop &amp; go!</s></p>"
+	  "<break time=\"200ms\"/><prosody rate=\"fast\">Quick &lt;brown&gt; fox...</prosody>"
+	  "<!-- comment --><say-as interpret-as=\"characters\">a.b.c</say-as>"
+	  "<s>It costs $5 (or 4&#8364;)?</s><mark name=\"b\"/><audio src=\"x.wav\"/>"
+	  "<voice name=\"x\">Bye!</voice></speak>",
+	  SPD_DATA_SSML },
+};
+
+static const struct {
+	const char *name;
+	SymLvl level;
+	SPDPunctuation punct;
+} levels[] = {
+	{ "none", SYMLVL_NONE, SPD_PUNCT_NONE },
+	{ "some", SYMLVL_SOME, SPD_PUNCT_SOME },
+	{ "most", SYMLVL_MOST, SPD_PUNCT_MOST },
+	{ "all", SYMLVL_ALL, SPD_PUNCT_ALL },
+	{ "char", SYMLVL_CHAR, SPD_PUNCT_NONE },
+};
+
+/* Same as the default configuration */
+static const char *symbols_files[] = {
+	"gender-neutral.dic",
+	"font-variants.dic",
+	"symbols.dic",
+	"emojis.dic",
+	"orca.dic",
+	"orca-chars.dic",
+};
+
+static int iterations = 1000;
+static int repeat = 1;
+static int threads = 1;
+
+static gint64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *stage, const char *locale, const char *level,
+		   const char *input, size_t bytes, gint64 ns,
+		   unsigned long allocs)
+{
+	printf("%-18s %-6s %-5s %-6s %7lu %10.2f", stage, locale, level,
+	       input, (unsigned long)bytes,
+	       (double)ns / iterations / (bytes ? bytes : 1));
+#ifdef HAVE_ALLOCATION_COUNT
+	printf(" %10.2f\n", (double)allocs / iterations);
+#else
+	printf(" %10s\n", "n/a");
+#endif
+}
+
+static void init_message(TSpeechDMessage * msg, const char *text,
+			 const char *locale, SPDDataMode ssml_mode)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->buf = g_strdup(text);
+	msg->bytes = text ? strlen(text) : 0;
+	msg->settings.type = SPD_MSGTYPE_TEXT;
+	msg->settings.ssml_mode = ssml_mode;
+	msg->settings.symbols_preprocessing = SYMLVL_CHAR;
+	msg->settings.msg_settings.voice.language = (char *)locale;
+}
+
+static void bench_symbols(const BenchInput * input, const char *text,
+			  const char *locale, int l)
+{
+	TSpeechDMessage *msgs = g_new(TSpeechDMessage, iterations);
+	TSpeechDMessage **ptrs = g_new(TSpeechDMessage *, iterations);
+	unsigned long allocs;
+	gint64 start, ns;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		ptrs[i] = &msgs[i];
+		init_message(&msgs[i], text, locale, input->ssml_mode);
+		msgs[i].settings.msg_settings.punctuation_mode =
+		    levels[l].punct;
+		if (levels[l].level == SYMLVL_CHAR)
+			msgs[i].settings.type = SPD_MSGTYPE_CHAR;
+	}
+
+	allocs = allocations;
+	start = now_ns();
+	if (threads > 1) {
+		insert_symbols_parallel(ptrs, iterations, 0);
+	} else {
+		for (i = 0; i < iterations; i++)
+			insert_symbols(&msgs[i], 0);
+	}
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+
+	report("insert_symbols", locale, levels[l].name, input->name,
+	       strlen(text), ns, allocs);
+
+	for (i = 0; i < iterations; i++)
+		g_free(msgs[i].buf);
+	g_free(ptrs);
+	g_free(msgs);
+}
+
+/* Echo each character of the text as SPD_MSGTYPE_CHAR messages, as key echo
+   and spelling do */
+static void bench_chars(const BenchInput * input, const char *text,
+			const char *locale)
+{
+	int nchars = g_utf8_strlen(text, -1);
+	TSpeechDMessage *msgs = g_new(TSpeechDMessage, nchars);
+	unsigned long allocs = 0;
+	gint64 ns = 0, start;
+	const char *p;
+	int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		for (p = text, j = 0; *p; p = g_utf8_next_char(p), j++) {
+			init_message(&msgs[j], NULL, locale, SPD_DATA_TEXT);
+			msgs[j].buf = g_strndup(p, g_utf8_next_char(p) - p);
+			msgs[j].settings.type = SPD_MSGTYPE_CHAR;
+		}
+
+		allocs -= allocations;
+		start = now_ns();
+		for (j = 0; j < nchars; j++)
+			insert_char_description(&msgs[j], 0);
+		ns += now_ns() - start;
+		allocs += allocations;
+
+		for (j = 0; j < nchars; j++)
+			g_free(msgs[j].buf);
+	}
+
+	report("char_description", locale, "char", input->name, strlen(text),
+	       ns, allocs);
+
+	g_free(msgs);
+}
+
+static void bench_index_marks(const BenchInput * input, const char *text)
+{
+	TSpeechDMessage *msgs = g_new(TSpeechDMessage, iterations);
+	unsigned long allocs;
+	gint64 start, ns;
+	int i;
+
+	for (i = 0; i < iterations; i++)
+		init_message(&msgs[i], text, "en", input->ssml_mode);
+
+	allocs = allocations;
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		insert_index_marks(&msgs[i], input->ssml_mode, 1);
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+
+	report("insert_index_marks", "-", "-", input->name, strlen(text), ns,
+	       allocs);
+
+	for (i = 0; i < iterations; i++)
+		g_free(msgs[i].buf);
+	g_free(msgs);
+}
+
+static void bench_escaping(const BenchInput * input, const char *text)
+{
+	char **bufs = g_new(char *, iterations);
+	char *escaped;
+	size_t escaped_len;
+	unsigned long allocs;
+	gint64 start, ns;
+	int i;
+
+	/* What the client sends on the socket */
+	escaped = escape_dot(g_strdup(text));
+	escaped_len = strlen(escaped);
+
+	allocs = allocations;
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		bufs[i] = deescape_dot(escaped, escaped_len);
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+	report("deescape_dot", "-", "-", input->name, escaped_len, ns, allocs);
+
+	for (i = 0; i < iterations; i++) {
+		g_free(bufs[i]);
+		bufs[i] = g_strdup(text);
+	}
+
+	allocs = allocations;
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		bufs[i] = escape_dot(bufs[i]);
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+	report("escape_dot", "-", "-", input->name, strlen(text), ns, allocs);
+
+	for (i = 0; i < iterations; i++)
+		g_free(bufs[i]);
+	g_free(bufs);
+	g_free(escaped);
+}
+
+static void bench_normalize(const BenchInput * input, const char *text)
+{
+	char **bufs = g_new(char *, iterations);
+	unsigned long allocs;
+	gint64 start, ns;
+	int i;
+
+	allocs = allocations;
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		bufs[i] = g_utf8_normalize(text, -1, G_NORMALIZE_ALL_COMPOSE);
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+	report("g_utf8_normalize", "-", "-", input->name, strlen(text), ns,
+	       allocs);
+
+	for (i = 0; i < iterations; i++)
+		g_free(bufs[i]);
+
+	/* What speak() does */
+	allocs = allocations;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (spd_utf8_is_normalized(text))
+			bufs[i] = NULL;
+		else
+			bufs[i] = g_utf8_normalize(text, -1,
+						   G_NORMALIZE_ALL_COMPOSE);
+	}
+	ns = now_ns() - start;
+	allocs = allocations - allocs;
+	report("normalize", "-", "-", input->name, strlen(text), ns, allocs);
+
+	for (i = 0; i < iterations; i++)
+		g_free(bufs[i]);
+	g_free(bufs);
+}
+
+/* Compare the output of the symbol engines for all inputs, locales and
+   levels, returns the number of differences */
+static int check_engines(gchar ** locales)
+{
+	TSpeechDMessage trie, regex;
+	int i, j, l, differences = 0, checked = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+		const BenchInput *input = &corpus[i];
+		GString *text = g_string_new(NULL);
+
+		for (j = 0; j < repeat; j++)
+			g_string_append(text, input->text);
+
+		for (j = 0; locales[j]; j++) {
+			for (l = 0; l < G_N_ELEMENTS(levels); l++) {
+				init_message(&trie, text->str, locales[j],
+					     input->ssml_mode);
+				trie.settings.msg_settings.punctuation_mode =
+				    levels[l].punct;
+				if (levels[l].level == SYMLVL_CHAR)
+					trie.settings.type = SPD_MSGTYPE_CHAR;
+				regex = trie;
+				regex.buf = g_strdup(trie.buf);
+
+				symbols_set_engine(SYMENGINE_TRIE);
+				insert_symbols(&trie, 0);
+				symbols_set_engine(SYMENGINE_REGEX);
+				insert_symbols(&regex, 0);
+
+				checked++;
+				if (strcmp(trie.buf, regex.buf)
+				    || trie.settings.type != regex.settings.type
+				    || trie.settings.msg_settings.punctuation_mode
+				    != regex.settings.msg_settings.punctuation_mode) {
+					differences++;
+					printf("%s %s %s differs:\n"
+					       "  trie:  |%s|\n"
+					       "  regex: |%s|\n",
+					       locales[j], levels[l].name,
+					       input->name, trie.buf, regex.buf);
+				}
+
+				g_free(trie.buf);
+				g_free(regex.buf);
+			}
+		}
+
+		g_string_free(text, TRUE);
+	}
+
+	printf("%d cases checked, %d differences\n", checked, differences);
+	return differences;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-n iterations] [-r repeat] [-l locale,locale...]\n"
+		"          [-e trie|regex] [-C cache_dir] [-M cache_kib] [-j threads] [-c]\n"
+		"  -n  number of messages processed per measurement (default 1000)\n"
+		"  -r  number of times each corpus input is repeated in a message (default 1)\n"
+		"  -l  locales to benchmark insert_symbols() for (default en,fr,de,zh,ja)\n"
+		"  -e  symbol engine to benchmark (default trie)\n"
+		"  -C  directory to cache compiled symbols in (default none)\n"
+		"  -M  KiB of processed texts to cache (default 0)\n"
+		"  -j  threads processing the messages with insert_symbols_parallel()\n"
+		"      (default 1, allocation counts are then approximate)\n"
+		"  -c  only check that both symbol engines give the same result\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	gchar **locales;
+	const char *locale_list = "en,fr,de,zh,ja";
+	SymEngine engine = SYMENGINE_TRIE;
+	int check = 0;
+	int c, i, j, l;
+
+	while ((c = getopt(argc, argv, "n:r:l:e:C:M:j:ch")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'l':
+			locale_list = optarg;
+			break;
+		case 'e':
+			if (!strcmp(optarg, "trie"))
+				engine = SYMENGINE_TRIE;
+			else if (!strcmp(optarg, "regex"))
+				engine = SYMENGINE_REGEX;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'C':
+			symbols_set_cache_dir(optarg);
+			break;
+		case 'M':
+			symbols_set_text_cache_size((size_t) atoi(optarg) * 1024);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			check = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (iterations <= 0 || repeat <= 0 || threads <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(symbols_files); i++)
+		symbols_preprocessing_add_file(symbols_files[i]);
+
+	locales = g_strsplit(locale_list, ",", 0);
+
+	if (check) {
+		int differences;
+
+		/* Make sure both engines really process the texts */
+		symbols_set_text_cache_size(0);
+		differences = check_engines(locales);
+
+		g_strfreev(locales);
+		return differences ? 1 : 0;
+	}
+
+	symbols_set_engine(engine);
+	symbols_set_threads(threads);
+
+	/* Loading is done once per locale, so report it separately */
+	for (j = 0; locales[j]; j++) {
+		TSpeechDMessage first;
+		gint64 start;
+
+		init_message(&first, "a", locales[j], SPD_DATA_TEXT);
+		start = now_ns();
+		insert_symbols(&first, 0);
+		printf("loading %-6s %10.3f ms\n", locales[j],
+		       (now_ns() - start) / 1e6);
+		g_free(first.buf);
+	}
+
+	printf("%-18s %-6s %-5s %-6s %7s %10s %10s\n", "stage", "locale",
+	       "level", "input", "bytes", "ns/byte", "allocs/msg");
+
+	for (i = 0; i < G_N_ELEMENTS(corpus); i++) {
+		const BenchInput *input = &corpus[i];
+		GString *text = g_string_new(NULL);
+
+		for (j = 0; j < repeat; j++)
+			g_string_append(text, input->text);
+
+		bench_escaping(input, text->str);
+		bench_normalize(input, text->str);
+
+		for (j = 0; locales[j]; j++) {
+			for (l = 0; l < G_N_ELEMENTS(levels); l++) {
+				/* Don't measure loading the locale */
+				TSpeechDMessage warmup;
+
+				init_message(&warmup, text->str, locales[j],
+					     input->ssml_mode);
+				insert_symbols(&warmup, 0);
+				g_free(warmup.buf);
+
+				bench_symbols(input, text->str, locales[j], l);
+			}
+			bench_chars(input, text->str, locales[j]);
+		}
+
+		bench_index_marks(input, text->str);
+
+		g_string_free(text, TRUE);
+	}
+
+	g_strfreev(locales);
+
+	return 0;
+}
@@ -29,9 +29,18 @@
 #include "speaking.h"
 #include "sem_functions.h"
 #include "history.h"
+#include "flight_recorder.h"
+#include <spd_probes.h>
 
 int last_message_id = 0;
 
+/* Protects the state of all streams, which the speak thread updates */
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Text appended to a stream without ending a sentence is held back up to
+   this many bytes, and then queued up to its last whitespace */
+#define STREAM_MAX_PENDING 512
+
 /* Put a message into its queue.
  *
  * Parameters:
@@ -113,11 +122,20 @@ queue_message(TSpeechDMessage * new, int fd, int history_flag,
 		COPY_SET_STR(audio_nas_server);
 		COPY_SET_STR(audio_pulse_server);
 		COPY_SET_STR(audio_pulse_device);
+		COPY_SET_STR(audio_null_file);
 
 		/* And we set the global id (note that this is really global, not
-		 * depending on the particular client, but unique) */
-		last_message_id++;
-		new->id = last_message_id;
+		 * depending on the particular client, but unique).  The
+		 * sentences of a stream all have the id of the stream. */
+		if (new->stream != NULL) {
+			new->id = new->stream->id;
+			pthread_mutex_lock(&stream_mutex);
+			new->stream->pending++;
+			pthread_mutex_unlock(&stream_mutex);
+		} else {
+			last_message_id++;
+			new->id = last_message_id;
+		}
 		new->time = time(NULL);
 
 		new->settings.paused_while_speaking = 0;
@@ -178,6 +196,9 @@ queue_message(TSpeechDMessage * new, int fd, int history_flag,
 	default:
 		FATAL("Nonexistent priority given");
 	}
+	SPD_PROBE3(message_queued, new->id, settings->priority, new->settings.uid);
+	flight_recorder_record(FR_MSG_QUEUED, new->id, settings->priority,
+			       NULL, 0);
 
 	/* Look what is the highest priority of waiting
 	 * messages and take the desired actions on other
@@ -198,6 +219,173 @@ queue_message(TSpeechDMessage * new, int fd, int history_flag,
 
 #undef COPY_SET_STR
 
+TSpeechDStream *stream_new(int fd)
+{
+	TSpeechDStream *stream = g_new0(TSpeechDStream, 1);
+
+	stream->id = ++last_message_id;
+	stream->fd = fd;
+	stream->refs = 1;
+	return stream;
+}
+
+TSpeechDStream *stream_ref(TSpeechDStream * stream)
+{
+	pthread_mutex_lock(&stream_mutex);
+	stream->refs++;
+	pthread_mutex_unlock(&stream_mutex);
+	return stream;
+}
+
+void stream_unref(TSpeechDStream * stream)
+{
+	int refs;
+
+	pthread_mutex_lock(&stream_mutex);
+	refs = --stream->refs;
+	pthread_mutex_unlock(&stream_mutex);
+	if (refs == 0)
+		g_free(stream);
+}
+
+/* Return how much of the stream text in _buf_ is ready to be queued: up to
+   the whitespace after the last sentence end, or 0 if there is none yet */
+static size_t stream_cut(const char *buf, size_t len)
+{
+	size_t i, space = 0;
+
+	for (i = len; i > 1; i--) {
+		if (!g_ascii_isspace(buf[i - 1]))
+			continue;
+		if (space == 0)
+			space = i;
+		if (buf[i - 2] == '.' || buf[i - 2] == '?' || buf[i - 2] == '!')
+			return i;
+	}
+	if (len > STREAM_MAX_PENDING)
+		return space;
+	return 0;
+}
+
+int stream_append(int fd, TSpeechDSock * speechd_socket, const char *text,
+		  int final)
+{
+	TSpeechDStream *stream = speechd_socket->stream;
+	GString *buf = speechd_socket->stream_buf;
+	TFDSetElement *settings;
+	TSpeechDMessage *new;
+	size_t cut, i;
+	int canceled;
+
+	pthread_mutex_lock(&stream_mutex);
+	canceled = stream->canceled;
+	pthread_mutex_unlock(&stream_mutex);
+	if (canceled) {
+		g_string_truncate(buf, 0);
+		return 0;
+	}
+
+	g_string_append(buf, text);
+
+	/* SSML can only be cut where the client cut it */
+	settings = get_client_settings_by_fd(fd);
+	if (final || settings->ssml_mode == SPD_DATA_SSML)
+		cut = buf->len;
+	else
+		cut = stream_cut(buf->str, buf->len);
+	if (cut == 0)
+		return stream->id;
+
+	for (i = 0; i < cut && g_ascii_isspace(buf->str[i]); i++) ;
+	if (i < cut) {
+		new = (TSpeechDMessage *) g_malloc(sizeof(TSpeechDMessage));
+		new->buf = g_strndup(buf->str, cut);
+		new->bytes = cut;
+		new->stream = stream_ref(stream);
+		if (queue_message(new, fd, 1, SPD_MSGTYPE_TEXT,
+				  speechd_socket->inside_block) <= 0) {
+			stream_unref(stream);
+			g_free(new->buf);
+			g_free(new);
+			return -1;
+		}
+	}
+	g_string_erase(buf, 0, cut);
+
+	return stream->id;
+}
+
+void stream_close(int fd, TSpeechDSock * speechd_socket)
+{
+	TSpeechDStream *stream = speechd_socket->stream;
+	TSpeechDMessage msg;
+	int done;
+
+	stream_append(fd, speechd_socket, "", 1);
+
+	/* If the speak thread is already done with all the sentences, it
+	   didn't report the END, so we do it */
+	pthread_mutex_lock(&stream_mutex);
+	stream->closed = 1;
+	done = stream->pending == 0 && stream->begun && !stream->canceled;
+	pthread_mutex_unlock(&stream_mutex);
+	if (done) {
+		msg.id = stream->id;
+		msg.settings = *get_client_settings_by_fd(fd);
+		if (msg.settings.notification & SPD_END)
+			report_end(&msg);
+	}
+
+	stream_unref(stream);
+	speechd_socket->stream = NULL;
+	g_string_free(speechd_socket->stream_buf, TRUE);
+	speechd_socket->stream_buf = NULL;
+	speechd_socket->inside_block = 0;
+}
+
+int stream_report(TSpeechDMessage * msg, SPDNotification event)
+{
+	TSpeechDStream *stream = msg->stream;
+	int report = 1;
+
+	if (stream != NULL) {
+		pthread_mutex_lock(&stream_mutex);
+		switch (event) {
+		case SPD_BEGIN:
+			report = !stream->begun && !stream->canceled;
+			stream->begun = 1;
+			break;
+		case SPD_END:
+			stream->pending--;
+			report = stream->closed && stream->pending == 0
+			    && !stream->canceled;
+			break;
+		case SPD_CANCEL:
+			stream->pending--;
+			report = !stream->canceled;
+			stream->canceled = 1;
+			break;
+		default:
+			break;
+		}
+		pthread_mutex_unlock(&stream_mutex);
+	}
+
+	if (!report || !(msg->settings.notification & event))
+		return 0;
+
+	switch (event) {
+	case SPD_BEGIN:
+		return report_begin(msg);
+	case SPD_END:
+		return report_end(msg);
+	case SPD_CANCEL:
+		return report_cancel(msg);
+	default:
+		return 0;
+	}
+}
+
 /* Switch data mode on for the particular client. */
 void server_data_on(int fd)
 {
@@ -260,6 +448,11 @@ int serve(int fd)
 
 		/* Parse the data and read the reply */
 		MSG2(5, "protocol", "%d:DATA:|%s| (%lu)", fd, buf, (unsigned long) bytes);
+		/* Not the text to be spoken, nor what the user types */
+		flight_recorder_record_command(FR_CLIENT_DATA, fd,
+					       speechd_socket_get_by_fd(fd)->
+					       awaiting_data ? NULL : buf,
+					       bytes);
 		reply = parse(buf, bytes, fd);
 		g_free(buf);
 	}
@@ -275,6 +468,7 @@ int serve(int fd)
 	if (reply[0] != '9') {	/* Don't reply to data etc. */
 		pthread_mutex_lock(&socket_com_mutex);
 		MSG2(5, "protocol", "%d:REPLY:|%s|", fd, reply);
+		flight_recorder_record(FR_CLIENT_REPLY, fd, 0, reply, -1);
 		ret = write(fd, reply, strlen(reply));
 		g_free(reply);
 		pthread_mutex_unlock(&socket_com_mutex);
@@ -34,4 +34,23 @@ void server_data_off(int fd);
 int queue_message(TSpeechDMessage * new, int fd, int history_flag,
 		  SPDMessageType type, int reparted);
 
+/* Open a stream for the client on _fd_, see TSpeechDStream */
+TSpeechDStream *stream_new(int fd);
+TSpeechDStream *stream_ref(TSpeechDStream * stream);
+void stream_unref(TSpeechDStream * stream);
+
+/* Append _text_ to the open stream of the client on _fd_ and queue the
+   sentences it completes, or all of it if _final_.  Return the stream
+   id, 0 if it was canceled, or -1 on error. */
+int stream_append(int fd, TSpeechDSock * speechd_socket, const char *text,
+		  int final);
+
+/* Close the open stream of the client on _fd_ */
+void stream_close(int fd, TSpeechDSock * speechd_socket);
+
+/* Report the _event_ (SPD_BEGIN, SPD_END or SPD_CANCEL) of _msg_ to its
+   client if it asked for it.  For the sentences of a stream, BEGIN is
+   reported for the first one, and END or CANCEL when the stream is done. */
+int stream_report(TSpeechDMessage * msg, SPDNotification event);
+
 #endif
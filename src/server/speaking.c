@@ -28,6 +28,7 @@
 #include <poll.h>
 #include <unistd.h>
 #include <safe_io.h>
+#include <spd_probes.h>
 #include "speechd.h"
 #include "server.h"
 #include "index_marking.h"
@@ -39,6 +40,7 @@
 #include "output.h"
 #include "speaking.h"
 #include "sem_functions.h"
+#include "flight_recorder.h"
 
 TSpeechDMessage *current_message = NULL;
 static SPDPriority highest_priority = 0;
@@ -57,6 +59,30 @@ int pause_requested_fd;
 int pause_requested_uid;
 int resume_requested;
 
+/* Whether the client of _msg_ makes use of sentence index marks, to
+   resume within the message after a pause, or whether output_speak() needs
+   them to send it in segments.  Without them, a pause only takes effect at
+   the end of the message. */
+static int message_needs_index_marks(TSpeechDMessage * msg)
+{
+	if (!SpeechdOptions.index_marks_on_demand)
+		return 1;
+
+	return msg->settings.pause_context != 0
+	    || (SpeechdOptions.message_segment_length > 0
+		&& strlen(msg->buf) > SpeechdOptions.message_segment_length);
+}
+
+/* Free _msg_ dropped from the queues without being spoken.  The sentences
+   of a stream are reported canceled, like in queue_remove_message(), so
+   that its client still gets its CANCEL. */
+static void drop_message(TSpeechDMessage * msg)
+{
+	if (msg->stream != NULL)
+		stream_report(msg, SPD_CANCEL);
+	mem_free_message(msg);
+}
+
 /*
   Speak() is responsible for getting right text from right
   queue in right time and saying it loud through the corresponding
@@ -160,6 +186,16 @@ void *speak(void *data)
 					pthread_mutex_unlock
 					    (&element_free_mutex);
 					if ((gl != NULL) && (gl->data != NULL)) {
+						if (resume_kept_message
+						    ((TSpeechDMessage *)
+						     gl->data)) {
+							poll_fds[1].fd =
+							    speaking_module->pipe_speak
+							    [0];
+							poll_count = 2;
+							g_list_free1(gl);
+							continue;
+						}
 						MSG(5, "Reloading message");
 						reload_message((TSpeechDMessage
 								*) gl->data);
@@ -176,6 +212,8 @@ void *speak(void *data)
 			}
 			MSG(5, "End of resume processing");
 			resume_requested = 0;
+			if (SPEAKING)
+				continue;
 		}
 
 		MSG(5, "Locking element_free_mutex in speak()");
@@ -214,6 +252,12 @@ void *speak(void *data)
 				MSG(5, "No message in the queue");
 				continue;
 			}
+			SPD_PROBE3(message_dequeued, message->id,
+				   message->settings.priority,
+				   message->settings.uid);
+			flight_recorder_record(FR_MSG_DEQUEUED, message->id,
+					       message->settings.priority,
+					       NULL, 0);
 		}
 
 		/* Isn't the parent client of this message paused?
@@ -247,29 +291,41 @@ void *speak(void *data)
 			/* FIXME: rather make them express it */
 			punct_missing = 1;
 
-		if (message->settings.type == SPD_MSGTYPE_TEXT ||
-		    message->settings.type == SPD_MSGTYPE_CHAR) {
-			gchar *normalized = g_utf8_normalize(message->buf, -1,
-					G_NORMALIZE_ALL_COMPOSE);
-			if (!normalized) {
+		if (message->settings.type == SPD_MSGTYPE_CHAR) {
+			/* Usually already seen, and then quickly described */
+			if (!insert_char_description(message, punct_missing)) {
 				MSG(2, "Error: Not UTF-8 valid");
 				pthread_mutex_unlock(&element_free_mutex);
 				continue;
 			}
-			if (strcmp(message->buf, normalized)) {
-				MSG(5, "text: Normalized '%s' to '%s'", message->buf, normalized);
+		} else if (message->settings.type == SPD_MSGTYPE_TEXT) {
+			/* Most texts are already normalized, avoid copying them */
+			if (!spd_utf8_is_normalized(message->buf)) {
+				gchar *normalized = g_utf8_normalize(message->buf, -1,
+						G_NORMALIZE_ALL_COMPOSE);
+				if (!normalized) {
+					MSG(2, "Error: Not UTF-8 valid");
+					pthread_mutex_unlock(&element_free_mutex);
+					continue;
+				}
+				if (strcmp(message->buf, normalized)) {
+					MSG(5, "text: Normalized '%s' to '%s'", message->buf, normalized);
+				}
+				g_free(message->buf);
+				message->buf = normalized;
 			}
-			g_free(message->buf);
-			message->buf = normalized;
 			insert_symbols(message, punct_missing);
 		}
 
 		/* Insert index marks into textual messages */
 		if (message->settings.type == SPD_MSGTYPE_TEXT) {
 			insert_index_marks(message,
-					   message->settings.ssml_mode);
+					   message->settings.ssml_mode,
+					   message_needs_index_marks(message));
 		}
 
+		SPD_PROBE1(message_preprocessed, message->id);
+
 		/* Write the message to the output layer. */
 		ret = output_speak(message, output);
 
@@ -287,6 +343,7 @@ void *speak(void *data)
 			pthread_mutex_unlock(&element_free_mutex);
 			continue;
 		}
+		SPD_PROBE2(message_sent, message->id, output->name);
 		SPEAKING = 1;
 
 		if (speaking_module != NULL) {
@@ -337,7 +394,7 @@ void *speak(void *data)
 				if (p5_message->settings.reparted ==
 				    message->settings.reparted) {
 					g_list_foreach(last_p5_block,
-						       (GFunc) mem_free_message,
+						       (GFunc) drop_message,
 						       NULL);
 					g_list_free(last_p5_block);
 					last_p5_block = NULL;
@@ -349,6 +406,26 @@ void *speak(void *data)
 	}
 }
 
+int resume_kept_message(TSpeechDMessage * msg)
+{
+	TFDSetElement *client_settings;
+
+	if (current_message != NULL || SPEAKING)
+		return 0;
+	/* The context before the pause has to be synthesized again */
+	client_settings = get_client_settings_by_uid(msg->settings.uid);
+	if (client_settings == NULL || client_settings->pause_context != 0)
+		return 0;
+	if (output_resume(msg) != 0)
+		return 0;
+
+	MSG(5, "Resuming message %d with its kept audio", msg->id);
+	SPEAKING = 1;
+	speaking_uid = msg->settings.uid;
+	current_message = msg;
+	return 1;
+}
+
 int reload_message(TSpeechDMessage * msg)
 {
 	TFDSetElement *client_settings;
@@ -473,7 +550,7 @@ void speaking_stop(int uid)
 			    && (msg->settings.uid == uid)) {
 				queue = g_list_remove_link(queue, gl);
 				assert(gl->data != NULL);
-				mem_free_message(gl->data);
+				drop_message(gl->data);
 			} else {
 				speaking_set_queue(highest_priority, queue);
 				return;
@@ -517,7 +594,7 @@ void speaking_stop_all()
 		if (msg->settings.reparted == 1) {
 			queue = g_list_remove_link(queue, gl);
 			assert(gl->data != NULL);
-			mem_free_message(gl->data);
+			drop_message(gl->data);
 		} else {
 			speaking_set_queue(highest_priority, queue);
 			return;
@@ -652,6 +729,7 @@ int socket_send_msg(int fd, const char *msg)
 	assert(msg != NULL);
 	pthread_mutex_lock(&socket_com_mutex);
 	MSG2(5, "protocol", "%d:REPLY:|%s|", fd, msg);
+	flight_recorder_record(FR_CLIENT_REPLY, fd, 0, msg, -1);
 	ret = write(fd, msg, strlen(msg));
 	pthread_mutex_unlock(&socket_com_mutex);
 	if (ret < 0) {
@@ -671,6 +749,8 @@ int report_index_mark(TSpeechDMessage * msg, const char *index_mark)
 			      EVENT_INDEX_MARK_C "-%s\r\n"
 			      EVENT_INDEX_MARK,
 			      msg->id, msg->settings.uid, index_mark);
+	SPD_PROBE2(index_mark, msg->id, index_mark);
+	flight_recorder_record(FR_INDEX_MARK, msg->id, 0, index_mark, -1);
 	ret = socket_send_msg(msg->settings.fd, cmd);
 	if (ret) {
 		MSG(1, "ERROR: Can't report index mark!");
@@ -735,8 +815,7 @@ int is_sb_speaking(void)
 		if (!strcmp(index_mark, SD_MARK_BODY "begin")) {
 			SPEAKING = 1;
 			if (!settings->paused_while_speaking) {
-				if (settings->notification & SPD_BEGIN)
-					report_begin(current_message);
+				stream_report(current_message, SPD_BEGIN);
 			} else {
 				if (settings->notification & SPD_RESUME)
 					report_resume(current_message);
@@ -745,9 +824,19 @@ int is_sb_speaking(void)
 		} else if (!strcmp(index_mark, SD_MARK_BODY "end")) {
 			SPEAKING = 0;
 			poll_count = 1;
-			if (settings->notification & SPD_END)
-				report_end(current_message);
+			stream_report(current_message, SPD_END);
 			speaking_semaphore_post();
+		} else if (!strcmp(index_mark, SD_MARK_BODY "segment")) {
+			/* The module is done with one segment of a long
+			   message, the client doesn't need to know */
+			if (output_speak_segment() < 0) {
+				MSG(2,
+				    "Error: Output module failed to take the next segment");
+				SPEAKING = 0;
+				poll_count = 1;
+				stream_report(current_message, SPD_CANCEL);
+				speaking_semaphore_post();
+			}
 		} else if (!strcmp(index_mark, SD_MARK_BODY "paused")) {
 			SPEAKING = 0;
 			poll_count = 1;
@@ -759,8 +848,7 @@ int is_sb_speaking(void)
 		} else if (!strcmp(index_mark, SD_MARK_BODY "stopped")) {
 			SPEAKING = 0;
 			poll_count = 1;
-			if (settings->notification & SPD_CANCEL)
-				report_cancel(current_message);
+			stream_report(current_message, SPD_CANCEL);
 			speaking_semaphore_post();
 		} else if (index_mark != NULL) {
 			if (strncmp(index_mark, SD_MARK_BODY, SD_MARK_BODY_LEN)) {
@@ -811,8 +899,7 @@ GList *queue_remove_message(GList * queue, GList * gl)
 	assert(gl != NULL);
 	assert(gl->data != NULL);
 	msg = (TSpeechDMessage *) gl->data;
-	if (msg->settings.notification & SPD_CANCEL)
-		report_cancel(msg);
+	stream_report(msg, SPD_CANCEL);
 	mem_free_message(gl->data);
 	queue = g_list_delete_link(queue, gl);
 	return queue;
@@ -974,7 +1061,7 @@ void stop_priority_except_first(SPDPriority priority)
 				TSpeechDMessage *msgg = gl->data;
 				if (msgg->settings.reparted != gid) {
 					queue = g_list_remove_link(queue, gl);
-					mem_free_message(msgg);
+					drop_message(msgg);
 				}
 			}
 			gl = gl_next;
@@ -45,6 +45,10 @@ void *speak(void *data);
 /* Put this message into queue again, stripping index marks etc. */
 int reload_message(TSpeechDMessage * msg);
 
+/* Continue this paused message with the audio kept by output_pause(), if
+   possible.  Returns 1 if it is speaking again. */
+int resume_kept_message(TSpeechDMessage * msg);
+
 /* Speech flow control functions */
 void speaking_stop(int uid);
 void speaking_stop_all(void);
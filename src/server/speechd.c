@@ -45,9 +45,12 @@
 #include "sem_functions.h"
 #include "speaking.h"
 #include "speak_queue.h"
+#include "sound_icons.h"
 #include "set.h"
 #include "options.h"
 #include "server.h"
+#include "flight_recorder.h"
+#include "symbols.h"
 
 #include <i18n.h>
 
@@ -102,6 +105,7 @@ TSpeechDMode spd_mode;
 static gboolean speechd_client_terminate(gpointer key, gpointer value, gpointer user);
 static gboolean speechd_reload_dead_modules(gpointer user_data);
 static gboolean speechd_load_configuration(gpointer user_data);
+static gboolean speechd_dump_flight_recorder(gpointer user_data);
 static gboolean speechd_quit(gpointer user_data);
 
 static gboolean server_process_incoming (gint          fd,
@@ -340,6 +344,8 @@ int speechd_socket_register(int fd)
 	speechd_socket->o_bytes = 0;
 	speechd_socket->awaiting_data = 0;
 	speechd_socket->inside_block = 0;
+	speechd_socket->stream = NULL;
+	speechd_socket->stream_buf = NULL;
 	fd_key = g_malloc(sizeof(int));
 	*fd_key = fd;
 	g_hash_table_insert(speechd_sockets_status, fd_key, speechd_socket);
@@ -351,6 +357,10 @@ void speechd_socket_free(TSpeechDSock * speechd_socket)
 {
 	if (speechd_socket->o_buf)
 		g_string_free(speechd_socket->o_buf, 1);
+	if (speechd_socket->stream)
+		stream_unref(speechd_socket->stream);
+	if (speechd_socket->stream_buf)
+		g_string_free(speechd_socket->stream_buf, 1);
 	g_free(speechd_socket);
 }
 
@@ -559,6 +569,12 @@ static gboolean speechd_reload_dead_modules(gpointer user_data)
 	return TRUE;
 }
 
+static gboolean speechd_dump_flight_recorder(gpointer user_data)
+{
+	flight_recorder_dump(SpeechdOptions.log_dir, "SIGUSR2");
+	return TRUE;
+}
+
 void speechd_modules_debug(void)
 {
 	/* Redirect output to debug for all modules */
@@ -664,6 +680,8 @@ void speechd_init()
 
 	logging_init();
 
+	flight_recorder_init(SpeechdOptions.flight_recorder_size);
+
 	/* Check for output modules */
 	if (g_list_length(output_modules) == 0) {
 		DIE("No speech output modules were loaded - aborting...");
@@ -741,6 +759,18 @@ static gboolean speechd_load_configuration(gpointer user_data)
 
 	free_config_options(spd_options, &spd_num_options);
 
+	/* This also drops texts processed with the previous tables */
+	symbols_set_text_cache_size((size_t) SpeechdOptions.symbols_cache_size
+				    * 1024);
+	/* And sound icons, for server audio */
+	sound_icons_set_cache_size((size_t) GlobalFDSet.sound_icon_cache_size
+				   * 1024);
+	/* In 16bit samples, for server audio */
+	module_speak_queue_set_pause_keep(MIN((gint64)
+					      SpeechdOptions.paused_audio_size
+					      * 1024 / 2, G_MAXINT));
+	flight_recorder_set_watchdog(SpeechdOptions.flight_recorder_watchdog);
+
 	return TRUE;
 }
 
@@ -1037,6 +1067,7 @@ int main(int argc, char *argv[])
 		const char *user_runtime_dir;
 		const char *user_config_dir;
 		char *test_speechd_conf_file = NULL;
+		char *cache_dir;
 
 		user_runtime_dir = g_get_user_runtime_dir();
 		user_config_dir = g_get_user_config_dir();
@@ -1083,6 +1114,13 @@ int main(int argc, char *argv[])
 		}
 		SpeechdOptions.conf_file =
 		    g_strdup_printf("%s/speechd.conf", SpeechdOptions.conf_dir);
+
+		/* Compiled symbols files, so that switching language is quick */
+		cache_dir = g_build_filename(g_get_user_cache_dir(),
+					     "speech-dispatcher", "symbols",
+					     NULL);
+		symbols_set_cache_dir(cache_dir);
+		g_free(cache_dir);
 	}
 
 	/* Check for PID file or create a new one or exit if Speech Dispatcher
@@ -1238,6 +1276,7 @@ int main(int argc, char *argv[])
 	g_unix_signal_add(SIGTERM, speechd_quit, NULL);
 	g_unix_signal_add(SIGHUP, speechd_load_configuration, NULL);
 	g_unix_signal_add(SIGUSR1, speechd_reload_dead_modules, NULL);
+	g_unix_signal_add(SIGUSR2, speechd_dump_flight_recorder, NULL);
 	(void)signal(SIGPIPE, SIG_IGN);
 
 	MSG(4, "Creating new thread for speak()");
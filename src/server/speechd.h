@@ -102,6 +102,11 @@ typedef struct {
 	char *audio_pulse_server;
 	char *audio_pulse_device;
 	int audio_pulse_min_length;
+	char *audio_null_file;
+	int audio_null_speed;
+	int audio_output_rate;
+	int audio_output_channels;
+	int sound_icon_cache_size;	/* KiB of decoded sound icons kept */
 	int log_level;
 
 	/* TODO: Should be moved out */
@@ -136,6 +141,20 @@ typedef struct {
 	GList *p5;		/* progress */
 } TSpeechDQueue;
 
+/*  TSpeechDStream is a message opened by STREAM BEGIN, which the
+    client appends text to until STREAM END.  Its complete sentences
+    are queued as separate messages with the same id, which the client
+    gets events for as if they were one message. */
+typedef struct {
+	guint id;		/* id of the message for the client */
+	int fd;			/* the client connection */
+	int refs;		/* the connection and each queued sentence */
+	int pending;		/* sentences queued and not said yet */
+	int begun;		/* BEGIN was reported */
+	int closed;		/* STREAM END was received */
+	int canceled;		/* CANCEL was reported, text is now dropped */
+} TSpeechDStream;
+
 /*  TSpeechDMessage is an element of TSpeechDQueue,
     that is, some text with or without index marks
     inside  and it's configuration. */
@@ -145,6 +164,7 @@ typedef struct {
 	char *buf;		/* the actual text */
 	int bytes;		/* number of bytes in buf */
 	TFDSetElement settings;	/* settings of the client when queueing this message */
+	TSpeechDStream *stream;	/* the stream this is a sentence of, or NULL */
 } TSpeechDMessage;
 
 #include "alloc.h"
@@ -173,6 +193,12 @@ extern struct SpeechdOptions {
 	int max_queue_size;
 	int server_timeout;
 	int server_timeout_set;
+	int flight_recorder_size;	/* Number of events kept in memory */
+	int flight_recorder_watchdog;	/* Seconds without module progress before dumping */
+	int symbols_cache_size;	/* KiB of texts processed by insert_symbols() kept */
+	int index_marks_on_demand;	/* Only mark sentences for clients using them */
+	int message_segment_length;	/* Bytes above which messages are sent in segments */
+	int paused_audio_size;	/* KiB of audio a pause keeps for the resume */
 } SpeechdOptions;
 
 extern struct SpeechdStatus {
@@ -222,6 +248,8 @@ typedef struct {
 	int inside_block;
 	size_t o_bytes;
 	GString *o_buf;
+	TSpeechDStream *stream;	/* open stream, its block is inside_block */
+	GString *stream_buf;	/* text appended to it and not queued yet */
 } TSpeechDSock;
 int speechd_sockets_status_init(void);
 int speechd_socket_register(int fd);
@@ -39,6 +39,13 @@
  * are then usable to pre-process an input text with
  * speech_symbols_processor_process_text().
  *
+ * NVDA compiles all symbols into one big regular expression.  As most symbols
+ * are plain strings, by default we only use a regular expression for the few
+ * complex symbols, and look the simple ones up in a trie while walking the
+ * text, see speech_symbols_processor_match().  It gives exactly the same
+ * result as the big regular expression, which is kept as SYMENGINE_REGEX for
+ * comparison, see "make bench-check" in this directory.
+ *
  * The loading steps are automatically handled when calling
  * speech_symbols_processor_new().  To avoid re-processing files more than
  * once even if they are used by different SpeechSymbolProcessor, the loaded
@@ -52,10 +59,14 @@
  * This loading is aware of locale strings syntax and will fallback on the
  * language code alone if the language-country combo isn't found.
  *
- * WARNING: this module is NOT thread-safe.  Most notably, the caches are not
- * thread-safe, so the public API insert_symbols() shouldn't be balled from
- * several threads at once.  This should not be an issue, as it is supposed to
- * be called from the speak thread only.
+ * insert_symbols() can be called from several threads at once.  The
+ * processors are read-only once built, the state of each call is kept in a
+ * SpeechSymbolContext, and the caches are filled under symbols_lock.
+ * insert_symbols_parallel() uses this to process several messages at once
+ * with a pool of threads.
+ *
+ * Last, the results of insert_symbols() for short texts are kept in a size
+ * bounded cache, see symbols_text_cache_lookup().
  *
  * This file is mostly a 1:1 translation of NVDA's python code doing the same
  * thing, with slight simplifications or adaptations for C, and removal of
@@ -72,7 +83,10 @@
 #include <config.h>
 #endif
 
+#include <sys/stat.h>
+
 #include "symbols.h"
+#include "flight_recorder.h"
 
 /* This denotes the position of some SSML tags */
 struct tags {
@@ -121,25 +135,65 @@ typedef struct {
 	int value;
 } IntFieldDesc;
 
+/* A node of the trie of simple symbols, linked to its siblings.
+ * It only holds indexes, so that the trie can be mapped from the cache. */
+typedef struct {
+	guint8 c;		/* The byte leading to this node */
+	guint8 terminal;	/* Whether a simple symbol ends here */
+	guint16 unused;
+	guint32 child;		/* First child node, 0 if none */
+	guint32 next;		/* Next sibling node, 0 if none */
+	guint32 sym;		/* Index + 1 of the symbol ending here in
+				   ssp->syms, 0 if it got dropped */
+} SymTrieNode;
+
 /* Represents a loaded and cached set of symbols in a usable form */
 typedef struct {
 	gchar *source;
 
-	struct tags *tags; /* tags attached to the text */
-	gint ntags; /* number of elements in tags array */
-
-	GRegex *regex; /* compiled regular expression for parsing input */
 	/* Table of identifier(string):symbol(SpeechSymbol).
 	 * Indexes are pointers to symbol->identifier. */
 	GHashTable *symbols;
 	/* list of SpeechSymbol (weak pointers to entries in @c symbols) */
 	GSList *complex_list;
 
+	/* All symbols, the complex ones first in complex_list order */
+	SpeechSymbol **syms;
+	guint nsyms;
+	guint ncomplex;
+
+	/* SYMENGINE_TRIE data */
+	gchar *complex_pattern; /* rstripSpace and complex symbols only */
+	GRegex *complex_regex; /* compiled complex_pattern */
+	gint *complex_groups; /* group number of each complex symbol */
+	const SymTrieNode *trie; /* simple symbols, node 0 is unused */
+	guint ntrie;
+	guint32 trie_first[256]; /* trie node of each first byte, 0 if none */
+	GArray *trie_array; /* storage of the trie when not mapped */
+
+	/* SYMENGINE_REGEX data */
+	gchar *pattern; /* regular expression equivalent to the above */
+	GRegex *regex; /* compiled pattern, only when actually used */
+
+	/* When loaded from the cache, the symbols strings and the trie point
+	 * into the mapped file */
+	GMappedFile *mapped;
+	SpeechSymbol *mapped_syms;
+} SpeechSymbolProcessor;
+
+/* State of one processing of a text by a SpeechSymbolProcessor, which stays
+ * read-only so that several texts can be processed at once */
+typedef struct {
+	SpeechSymbolProcessor *ssp;
+
+	struct tags *tags; /* tags attached to the text */
+	gint ntags; /* number of elements in tags array */
+
 	/* Level requested by user */
 	SymLvl level;
 	/* Level to be supported */
 	SymLvl support_level;
-} SpeechSymbolProcessor;
+} SpeechSymbolContext;
 
 /* Map of locale code to arbitrary data. */
 typedef GHashTable LocaleMap;
@@ -155,6 +209,21 @@ static LocaleMap *G_processors = NULL;
 /* List of files to load */
 static GSList *symbols_files;
 
+/* Protects the above and G_locale_processors: the tables are loaded under
+ * the write lock and looked up under the read lock.  They are never freed,
+ * so texts are then processed without holding it. */
+static pthread_rwlock_t symbols_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* The result of get_locale_speech_symbols_processor() for each locale
+ * asked for, NULL if none, without owning them.  Emptied when files are
+ * added, so that locales without processors get another chance. */
+static GHashTable *G_locale_processors = NULL;
+
+/* How symbols are matched */
+static SymEngine symbols_engine = SYMENGINE_TRIE;
+
+static void symbols_text_cache_flush(void);
+static void symbols_char_table_flush(void);
+
 SymLvl str2SymLvl(const char *str)
 {
 	SymLvl punct;
@@ -750,7 +819,13 @@ static SpeechSymbols *get_locale_speech_symbols(const gchar *locale, const gchar
 void symbols_preprocessing_add_file(const char *name)
 {
 	MSG2(5, "symbols", "Will load symbol file %s", name);
+	pthread_rwlock_wrlock(&symbols_lock);
 	symbols_files = g_slist_append(symbols_files, g_strdup(name));
+	if (G_locale_processors)
+		g_hash_table_remove_all(G_locale_processors);
+	pthread_rwlock_unlock(&symbols_lock);
+	symbols_text_cache_flush();
+	symbols_char_table_flush();
 }
 
 /*------------------ Speech symbol compilation & processing -----------------*/
@@ -765,6 +840,17 @@ static void speech_symbols_processor_free(SpeechSymbolProcessor *ssp)
 {
 	if (ssp->regex)
 		g_regex_unref(ssp->regex);
+	g_free(ssp->pattern);
+	if (ssp->complex_regex)
+		g_regex_unref(ssp->complex_regex);
+	g_free(ssp->complex_pattern);
+	g_free(ssp->complex_groups);
+	g_free(ssp->syms);
+	if (ssp->trie_array)
+		g_array_free(ssp->trie_array, TRUE);
+	g_free(ssp->mapped_syms);
+	if (ssp->mapped)
+		g_mapped_file_unref(ssp->mapped);
 	g_slist_free(ssp->complex_list);
 	if (ssp->symbols)
 		g_hash_table_unref(ssp->symbols);
@@ -772,6 +858,103 @@ static void speech_symbols_processor_free(SpeechSymbolProcessor *ssp)
 	g_free(ssp);
 }
 
+/* Adds a node for byte @p c to the trie, returns its index */
+static guint sym_trie_node_new(GArray *trie, guchar c)
+{
+	SymTrieNode node = { c, 0, 0, 0, 0, 0 };
+
+	g_array_append_val(trie, node);
+	return trie->len - 1;
+}
+
+/* Adds a simple symbol to the trie, @p indexes maps identifiers to their
+ * index + 1 in ssp->syms.  The symbol may have been dropped for lack of a
+ * replacement, it still needs to be matched. */
+static void speech_symbols_processor_add_simple(SpeechSymbolProcessor *ssp, GHashTable *indexes,
+						const gchar *identifier)
+{
+	GArray *trie = ssp->trie_array;
+	const guchar *p = (const guchar *) identifier;
+	SymTrieNode *n;
+	guint node, child;
+
+	node = ssp->trie_first[*p];
+	if (!node) {
+		node = sym_trie_node_new(trie, *p);
+		ssp->trie_first[*p] = node;
+	}
+	for (p++; *p; p++) {
+		for (child = g_array_index(trie, SymTrieNode, node).child;
+		     child;
+		     child = g_array_index(trie, SymTrieNode, child).next) {
+			if (g_array_index(trie, SymTrieNode, child).c == *p)
+				break;
+		}
+		if (!child) {
+			child = sym_trie_node_new(trie, *p);
+			n = &g_array_index(trie, SymTrieNode, node);
+			g_array_index(trie, SymTrieNode, child).next = n->child;
+			n->child = child;
+		}
+		node = child;
+	}
+
+	n = &g_array_index(trie, SymTrieNode, node);
+	n->terminal = 1;
+	n->sym = GPOINTER_TO_UINT(g_hash_table_lookup(indexes, identifier));
+}
+
+/* Compiles ssp->complex_pattern for SYMENGINE_TRIE */
+static gboolean speech_symbols_processor_compile_complex(SpeechSymbolProcessor *ssp, const char *locale)
+{
+	GError *error = NULL;
+	guint i;
+
+	MSG2(5, "symbols", "building regex: %s", ssp->complex_pattern);
+	ssp->complex_regex = g_regex_new(ssp->complex_pattern, G_REGEX_OPTIMIZE, 0, &error);
+	if (!ssp->complex_regex) {
+		MSG2(1, "symbols", "ERROR compiling regular expression: %s. "
+				   "This is likely due to an invalid complex "
+				   "symbol regular expression in locale %s.",
+				   error->message, locale);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	ssp->complex_groups = g_new(gint, ssp->ncomplex);
+	for (i = 0; i < ssp->ncomplex; i++) {
+		gchar *group_name = g_strdup_printf("c%u", i);
+		ssp->complex_groups[i] = g_regex_get_string_number(ssp->complex_regex, group_name);
+		g_free(group_name);
+	}
+
+	return TRUE;
+}
+
+/* Returns ssp->regex for SYMENGINE_REGEX, compiling ssp->pattern the first
+ * time, or NULL on error */
+static GRegex *speech_symbols_processor_get_regex(SpeechSymbolProcessor *ssp)
+{
+	static pthread_mutex_t regex_mutex = PTHREAD_MUTEX_INITIALIZER;
+	GError *error = NULL;
+	GRegex *regex;
+
+	pthread_mutex_lock(&regex_mutex);
+	if (!ssp->regex) {
+		MSG2(5, "symbols", "building regex: %s", ssp->pattern);
+		ssp->regex = g_regex_new(ssp->pattern, G_REGEX_OPTIMIZE, 0, &error);
+		if (!ssp->regex) {
+			MSG2(1, "symbols", "ERROR compiling regular expression: %s",
+			     error->message);
+			g_error_free(error);
+		}
+	}
+	regex = ssp->regex;
+	pthread_mutex_unlock(&regex_mutex);
+
+	return regex;
+}
+
 static void speech_symbols_processor_list_free(GSList *sspl)
 {
 	GSList *e;
@@ -792,9 +975,11 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 	gchar *escaped;
 	GString *escaped_multi;
 	GString *pattern;
-	GError *error = NULL;
+	GString *complex_pattern;
+	GHashTable *indexes;
 	GSList *sources = NULL;
 	GSList *node;
+	guint i;
 	int has_dash = 0;
 	int has_rbracket = 0;
 	int has_circum = 0;
@@ -805,7 +990,7 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 	if (ssbase)
 		sources = g_slist_append(sources, ssbase);
 
-	ssp = g_malloc(sizeof *ssp);
+	ssp = g_malloc0(sizeof *ssp);
 	ssp->source = g_strdup(syms->source);
 	/* The computed symbol information from all sources. */
 	ssp->symbols = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -870,7 +1055,7 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 						g_string_append_c(characters, sym->identifier[0]);
 					}
 				} else {
-					multi_chars_list = g_slist_prepend(multi_chars_list, sym->identifier);
+					multi_chars_list = g_slist_prepend(multi_chars_list, g_strdup(sym->identifier));
 				}
 			}
 			/* If fields weren't explicitly specified, inherit the value from later sources. */
@@ -907,6 +1092,43 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 			sym->display_name = g_strdup(sym->identifier);
 	}
 
+	/* Index the symbols, complex ones first. */
+	ssp->ncomplex = g_slist_length(ssp->complex_list);
+	ssp->syms = g_new(SpeechSymbol *, g_hash_table_size(ssp->symbols));
+	indexes = g_hash_table_new(g_str_hash, g_str_equal);
+	for (node = ssp->complex_list; node; node = node->next) {
+		SpeechSymbol *sym = node->data;
+		ssp->syms[ssp->nsyms++] = sym;
+	}
+	g_hash_table_iter_init(&iter, ssp->symbols);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		SpeechSymbol *sym = value;
+		if (!sym->pattern) {
+			ssp->syms[ssp->nsyms++] = sym;
+			g_hash_table_insert(indexes, sym->identifier, GUINT_TO_POINTER(ssp->nsyms));
+		}
+	}
+
+	/* build the trie of simple symbols. */
+	ssp->trie_array = g_array_new(FALSE, FALSE, sizeof(SymTrieNode));
+	/* node 0 is the root, so that 0 can mean "no node" */
+	sym_trie_node_new(ssp->trie_array, 0);
+	for (i = 0; i < characters->len; i++) {
+		gchar id[2] = { characters->str[i], 0 };
+		speech_symbols_processor_add_simple(ssp, indexes, id);
+	}
+	if (has_dash)
+		speech_symbols_processor_add_simple(ssp, indexes, "-");
+	if (has_rbracket)
+		speech_symbols_processor_add_simple(ssp, indexes, "]");
+	if (has_circum)
+		speech_symbols_processor_add_simple(ssp, indexes, "^");
+	for (node = multi_chars_list; node; node = node->next)
+		speech_symbols_processor_add_simple(ssp, indexes, node->data);
+	ssp->trie = (const SymTrieNode *) ssp->trie_array->data;
+	ssp->ntrie = ssp->trie_array->len;
+	g_hash_table_destroy(indexes);
+
 	/* build the regex. */
 
 	/* Make characters into a regexp character set. */
@@ -929,8 +1151,10 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 
 	/* TODO: check the syntax is compatible with GLib */
 	pattern = g_string_new(NULL);
+	complex_pattern = g_string_new(NULL);
 	/* Strip repeated spaces from the end of the line to stop them from being picked up by repeated. */
 	g_string_append(pattern, "(?P<rstripSpace>  +$)");
+	g_string_append(complex_pattern, "(?P<rstripSpace>  +$)");
 	/* Repeated characters: more than 3 repeats. */
 	if (characters->len) {
 		g_string_append_c(pattern, '|');
@@ -938,11 +1162,12 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 	}
 	/* Complex symbols.
 	 * Each complex symbol has its own named group so we know which symbol matched. */
-	guint i = 0;
-	for (node = ssp->complex_list; node; node = node->next, i++) {
+	for (node = ssp->complex_list, i = 0; node; node = node->next, i++) {
 		SpeechSymbol *sym = node->data;
 		g_string_append_c(pattern, '|');
 		g_string_append_printf(pattern, "(?P<c%u>%s)", i, sym->pattern);
+		g_string_append_c(complex_pattern, '|');
+		g_string_append_printf(complex_pattern, "(?P<c%u>%s)", i, sym->pattern);
 	}
 	/* Simple symbols.
 	 * These are all handled in one named group.
@@ -968,27 +1193,336 @@ static SpeechSymbolProcessor *speech_symbols_processor_new(const char *locale, S
 	}
 	g_string_free(escaped_multi, TRUE);
 
-	MSG2(5, "symbols", "building regex: %s", pattern->str);
-	ssp->regex = g_regex_new(pattern->str, G_REGEX_OPTIMIZE, 0, &error);
-	if (!ssp->regex) {
+	/* The whole regex is only compiled if SYMENGINE_REGEX gets used */
+	ssp->pattern = g_string_free(pattern, FALSE);
+	ssp->complex_pattern = g_string_free(complex_pattern, FALSE);
+
+	if (!speech_symbols_processor_compile_complex(ssp, locale)) {
 		/* if regex compilation failed, bail out */
-		MSG2(1, "symbols", "ERROR compiling regular expression: %s. "
-				   "This is likely due to an invalid complex "
-				   "symbol regular expression in locale %s.",
-				   error->message, locale);
-		g_error_free(error);
 		speech_symbols_processor_free(ssp);
 		ssp = NULL;
 	}
 
-	g_string_free(pattern, TRUE);
 	g_string_free(characters, TRUE);
-	g_slist_free(multi_chars_list);
+	g_slist_free_full(multi_chars_list, g_free);
 	g_slist_free(sources);
 
 	return ssp;
 }
 
+/*------------------------- Compiled symbols cache --------------------------*/
+
+/*
+ * Loading the symbols files and building the processor takes tens of
+ * milliseconds for big files, which delays the first message in a language.
+ * The result of speech_symbols_processor_new() is thus saved to the cache
+ * directory, and mapped back on next use as long as the locale and base
+ * files have the same modification time and size.  The trie is used right
+ * from the mapping; only the regex of complex symbols has to be compiled.
+ *
+ * A cache file is laid out in native byte order as:
+ *   SymCacheHeader
+ *   SymCacheSymbol[nsyms]
+ *   SymTrieNode[ntrie]
+ *   guint32 trie_first[256]
+ *   gchar strings[strings_len], in which offset 0 means NULL
+ */
+
+#define SYMBOLS_CACHE_MAGIC "SPDSYMB1"
+
+typedef struct {
+	gchar magic[8];
+	gint64 mtime[2];	/* Of the locale and base files, -1 if missing */
+	gint64 size[2];
+	guint32 path[2];	/* String offsets of their paths */
+	guint32 pattern;	/* String offsets of ssp->pattern */
+	guint32 complex_pattern;	/* and ssp->complex_pattern */
+	guint32 nsyms;
+	guint32 ncomplex;
+	guint32 ntrie;
+	guint32 strings_len;
+} SymCacheHeader;
+
+typedef struct {
+	guint32 identifier;	/* String offsets */
+	guint32 pattern;
+	guint32 replacement;
+	guint32 display_name;
+	gint32 level;
+	gint32 preserve;
+} SymCacheSymbol;
+
+/* The files a processor is built from */
+typedef struct {
+	gchar *path[2];		/* Locale and base files */
+	gint64 mtime[2];
+	gint64 size[2];
+} SymCacheKey;
+
+/* Where to cache compiled symbols, NULL to disable */
+static gchar *symbols_cache_dir;
+
+/* Finds the locale and base files that speech_symbols_processor_new() would
+ * use for @p locale and @p file, and the corresponding cache file.
+ * Returns FALSE if there is no such locale file. */
+static gboolean symbols_cache_key(const gchar *locale, const gchar *file,
+				  SymCacheKey *key, gchar **cache_path)
+{
+	gchar **parts = g_strsplit_set(locale, "_-", 2);
+	const gchar *locales[2] = { locale, parts[0] && parts[1] ? parts[0] : NULL };
+	gchar *name = NULL;
+	struct stat st;
+	guint i;
+
+	/* Same fallback as locale_map_fetch() */
+	key->path[0] = NULL;
+	for (i = 0; i < 2 && locales[i] && !key->path[0]; i++) {
+		gchar *path = g_build_filename(LOCALE_DATA, locales[i], file, NULL);
+
+		if (stat(path, &st) == 0) {
+			key->path[0] = path;
+			key->mtime[0] = st.st_mtime;
+			key->size[0] = st.st_size;
+			name = g_strdup_printf("%s-%s.bin", locales[i], file);
+		} else {
+			g_free(path);
+		}
+	}
+	g_strfreev(parts);
+	if (!key->path[0])
+		return FALSE;
+
+	key->path[1] = g_build_filename(LOCALE_DATA, "base", file, NULL);
+	if (stat(key->path[1], &st) == 0) {
+		key->mtime[1] = st.st_mtime;
+		key->size[1] = st.st_size;
+	} else {
+		key->mtime[1] = -1;
+		key->size[1] = -1;
+	}
+
+	g_strdelimit(name, G_DIR_SEPARATOR_S, '_');
+	*cache_path = g_build_filename(symbols_cache_dir, name, NULL);
+	g_free(name);
+
+	return TRUE;
+}
+
+static void symbols_cache_key_clear(SymCacheKey *key)
+{
+	g_free(key->path[0]);
+	g_free(key->path[1]);
+}
+
+/* Checks that @p data is a sound cache file for @p key */
+static gboolean symbols_cache_check(const gchar *data, gsize len, const SymCacheKey *key)
+{
+	const SymCacheHeader *h = (const SymCacheHeader *) data;
+	const SymCacheSymbol *cs;
+	const SymTrieNode *trie;
+	const guint32 *first;
+	const gchar *strings;
+	guint i;
+
+	if (len < sizeof(*h) || memcmp(h->magic, SYMBOLS_CACHE_MAGIC, sizeof(h->magic)))
+		return FALSE;
+	/* These bounds also avoid overflows below */
+	if (h->nsyms > len || h->ncomplex > h->nsyms || h->ntrie > len
+	    || h->ntrie == 0 || h->strings_len > len || h->strings_len == 0)
+		return FALSE;
+	if (len != sizeof(*h) + h->nsyms * sizeof(*cs) + h->ntrie * sizeof(*trie)
+		   + 256 * sizeof(*first) + h->strings_len)
+		return FALSE;
+
+	cs = (const SymCacheSymbol *) (h + 1);
+	trie = (const SymTrieNode *) (cs + h->nsyms);
+	first = (const guint32 *) (trie + h->ntrie);
+	strings = (const gchar *) (first + 256);
+	if (strings[h->strings_len - 1] != '\0')
+		return FALSE;
+
+#define VALID_STRING(off) ((off) != 0 && (off) < h->strings_len)
+	for (i = 0; i < 2; i++) {
+		if (h->mtime[i] != key->mtime[i] || h->size[i] != key->size[i]
+		    || !VALID_STRING(h->path[i])
+		    || strcmp(strings + h->path[i], key->path[i]))
+			return FALSE;
+	}
+	if (!VALID_STRING(h->pattern) || !VALID_STRING(h->complex_pattern))
+		return FALSE;
+	for (i = 0; i < h->nsyms; i++) {
+		if (!VALID_STRING(cs[i].identifier)
+		    || !VALID_STRING(cs[i].replacement)
+		    || !VALID_STRING(cs[i].display_name)
+		    || (cs[i].pattern && !VALID_STRING(cs[i].pattern))
+		    || (i < h->ncomplex && !cs[i].pattern))
+			return FALSE;
+	}
+#undef VALID_STRING
+	for (i = 0; i < h->ntrie; i++) {
+		if (trie[i].child >= h->ntrie || trie[i].next >= h->ntrie
+		    || trie[i].sym > h->nsyms)
+			return FALSE;
+	}
+	for (i = 0; i < 256; i++) {
+		if (first[i] >= h->ntrie)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Maps the cached processor for @p key, returns NULL if it is missing or
+ * out of date */
+static SpeechSymbolProcessor *speech_symbols_processor_load_cache(const char *locale, const char *file,
+								  const SymCacheKey *key,
+								  const gchar *cache_path)
+{
+	SpeechSymbolProcessor *ssp;
+	GMappedFile *mapped;
+	const SymCacheHeader *h;
+	const SymCacheSymbol *cs;
+	const guint32 *first;
+	const gchar *data, *strings;
+	guint i;
+
+	mapped = g_mapped_file_new(cache_path, FALSE, NULL);
+	if (!mapped)
+		return NULL;
+
+	data = g_mapped_file_get_contents(mapped);
+	if (!data || !symbols_cache_check(data, g_mapped_file_get_length(mapped), key)) {
+		MSG2(4, "symbols", "Cache %s is out of date", cache_path);
+		g_mapped_file_unref(mapped);
+		return NULL;
+	}
+
+	h = (const SymCacheHeader *) data;
+	cs = (const SymCacheSymbol *) (h + 1);
+	first = (const guint32 *) ((const SymTrieNode *) (cs + h->nsyms) + h->ntrie);
+	strings = (const gchar *) (first + 256);
+
+	ssp = g_malloc0(sizeof *ssp);
+	ssp->source = g_strdup(file);
+	ssp->mapped = mapped;
+
+	/* The strings stay in the mapping */
+	ssp->symbols = g_hash_table_new(g_str_hash, g_str_equal);
+	ssp->nsyms = h->nsyms;
+	ssp->ncomplex = h->ncomplex;
+	ssp->mapped_syms = g_new(SpeechSymbol, h->nsyms);
+	ssp->syms = g_new(SpeechSymbol *, h->nsyms);
+	for (i = 0; i < h->nsyms; i++) {
+		SpeechSymbol *sym = &ssp->mapped_syms[i];
+
+		sym->identifier = (char *) strings + cs[i].identifier;
+		sym->pattern = cs[i].pattern ? (char *) strings + cs[i].pattern : NULL;
+		sym->replacement = (char *) strings + cs[i].replacement;
+		sym->display_name = (char *) strings + cs[i].display_name;
+		sym->level = cs[i].level;
+		sym->preserve = cs[i].preserve;
+
+		ssp->syms[i] = sym;
+		g_hash_table_insert(ssp->symbols, sym->identifier, sym);
+		if (i < h->ncomplex)
+			ssp->complex_list = g_slist_prepend(ssp->complex_list, sym);
+	}
+	ssp->complex_list = g_slist_reverse(ssp->complex_list);
+
+	ssp->trie = (const SymTrieNode *) (cs + h->nsyms);
+	ssp->ntrie = h->ntrie;
+	memcpy(ssp->trie_first, first, sizeof(ssp->trie_first));
+
+	ssp->pattern = g_strdup(strings + h->pattern);
+	ssp->complex_pattern = g_strdup(strings + h->complex_pattern);
+	if (!speech_symbols_processor_compile_complex(ssp, locale)) {
+		speech_symbols_processor_free(ssp);
+		return NULL;
+	}
+
+	MSG2(5, "symbols", "Loaded %s for '%s' from %s", file, locale, cache_path);
+
+	return ssp;
+}
+
+/* Appends @p str to the string pool, returns its offset */
+static guint32 symbols_cache_string(GString *strings, const gchar *str)
+{
+	guint32 offset = strings->len;
+
+	if (!str)
+		return 0;
+	g_string_append_len(strings, str, strlen(str) + 1);
+
+	return offset;
+}
+
+/* Writes @p ssp to the cache for next time */
+static void speech_symbols_processor_save_cache(const SpeechSymbolProcessor *ssp,
+						const SymCacheKey *key,
+						const gchar *cache_path)
+{
+	SymCacheHeader h;
+	SymCacheSymbol *cs;
+	GString *strings, *out;
+	GError *error = NULL;
+	guint i;
+
+	/* Offset 0 is NULL */
+	strings = g_string_new_len("", 1);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SYMBOLS_CACHE_MAGIC, sizeof(h.magic));
+	for (i = 0; i < 2; i++) {
+		h.mtime[i] = key->mtime[i];
+		h.size[i] = key->size[i];
+		h.path[i] = symbols_cache_string(strings, key->path[i]);
+	}
+	h.pattern = symbols_cache_string(strings, ssp->pattern);
+	h.complex_pattern = symbols_cache_string(strings, ssp->complex_pattern);
+	h.nsyms = ssp->nsyms;
+	h.ncomplex = ssp->ncomplex;
+	h.ntrie = ssp->ntrie;
+
+	cs = g_new0(SymCacheSymbol, ssp->nsyms);
+	for (i = 0; i < ssp->nsyms; i++) {
+		const SpeechSymbol *sym = ssp->syms[i];
+
+		cs[i].identifier = symbols_cache_string(strings, sym->identifier);
+		cs[i].pattern = symbols_cache_string(strings, sym->pattern);
+		cs[i].replacement = symbols_cache_string(strings, sym->replacement);
+		cs[i].display_name = symbols_cache_string(strings, sym->display_name);
+		cs[i].level = sym->level;
+		cs[i].preserve = sym->preserve;
+	}
+	h.strings_len = strings->len;
+
+	out = g_string_sized_new(sizeof(h) + ssp->nsyms * sizeof(*cs)
+				 + ssp->ntrie * sizeof(SymTrieNode)
+				 + sizeof(ssp->trie_first) + strings->len);
+	g_string_append_len(out, (const gchar *) &h, sizeof(h));
+	g_string_append_len(out, (const gchar *) cs, ssp->nsyms * sizeof(*cs));
+	g_string_append_len(out, (const gchar *) ssp->trie, ssp->ntrie * sizeof(SymTrieNode));
+	g_string_append_len(out, (const gchar *) ssp->trie_first, sizeof(ssp->trie_first));
+	g_string_append_len(out, strings->str, strings->len);
+
+	/* This writes to a temporary file and renames it, so that processors
+	 * mapping the previous version keep a consistent view */
+	if (g_mkdir_with_parents(symbols_cache_dir, S_IRWXU) != 0
+	    || !g_file_set_contents(cache_path, out->str, out->len, &error)) {
+		MSG2(2, "symbols", "Can't write symbols cache %s: %s", cache_path,
+		     error ? error->message : g_strerror(errno));
+		if (error)
+			g_error_free(error);
+	} else {
+		MSG2(5, "symbols", "Saved symbols cache %s", cache_path);
+	}
+
+	g_free(cs);
+	g_string_free(strings, TRUE);
+	g_string_free(out, TRUE);
+}
+
 /* Loads and compiles speech symbols conversions for @p locale.
  * Returns a SpeechSymbolProcessor*, or NULL on error */
 static gpointer speech_symbols_processor_list_new(const char *locale, const char *file)
@@ -1001,14 +1535,35 @@ static gpointer speech_symbols_processor_list_new(const char *locale, const char
 	/* TODO: load user custom symbols? */
 
 	for (node = symbols_files; node; node = node->next) {
-		ss = get_locale_speech_symbols(locale, node->data);
-		if (!ss) {
-			MSG2(1, "symbols", "Failed to load symbols '%s' for locale '%s'",
-					   (char*) node->data, locale);
-		} else {
-			ssp = speech_symbols_processor_new(locale, ss);
-			if (ssp)
-				sspl = g_slist_prepend(sspl, ssp);
+		SymCacheKey key;
+		gchar *cache_path = NULL;
+		gboolean have_key = FALSE;
+
+		ssp = NULL;
+		if (symbols_cache_dir) {
+			have_key = symbols_cache_key(locale, node->data, &key, &cache_path);
+			if (have_key)
+				ssp = speech_symbols_processor_load_cache(locale, node->data,
+									  &key, cache_path);
+		}
+
+		if (!ssp) {
+			ss = get_locale_speech_symbols(locale, node->data);
+			if (!ss) {
+				MSG2(1, "symbols", "Failed to load symbols '%s' for locale '%s'",
+						   (char*) node->data, locale);
+			} else {
+				ssp = speech_symbols_processor_new(locale, ss);
+				if (ssp && have_key)
+					speech_symbols_processor_save_cache(ssp, &key, cache_path);
+			}
+		}
+		if (ssp)
+			sspl = g_slist_prepend(sspl, ssp);
+
+		if (have_key) {
+			symbols_cache_key_clear(&key);
+			g_free(cache_path);
 		}
 	}
 
@@ -1065,7 +1620,11 @@ static gint find_nexttag(struct tags *tags, gint pos, gint firsttag, gint endtag
 		return find_nexttag(tags, pos, middletag, endtag);
 }
 
-static int replace_groups(const GMatchInfo *match_info, GString *result, char *replacement, gint pos)
+/* Appends @p replacement, substituting \N references with the groups of the
+ * complex symbol match that starts at group @p pos.  Simple symbols have no
+ * @p match_info, only \0 is then available, as @p capture. */
+static int replace_groups(const GMatchInfo *match_info, const gchar *capture, gsize capture_len,
+			  GString *result, char *replacement, gint pos)
 {
 	int in_escape = 0;
 	char c;
@@ -1080,11 +1639,17 @@ static int replace_groups(const GMatchInfo *match_info, GString *result, char *r
 			if (c == '\\')
 				g_string_append_c(result, '\\');
 			else if (c >= '0' && c <= '9') {
-				gchar *res = g_match_info_fetch(match_info, pos + (c - '0'));
+				gchar *res = NULL;
+
+				if (match_info)
+					res = g_match_info_fetch(match_info, pos + (c - '0'));
+				else if (c == '0')
+					res = g_strndup(capture, capture_len);
 				if (res)
 					g_string_append(result, res);
 				else
 					MSG2(1, "symbols", "Unmatched reference \\%c", c);
+				g_free(res);
 			} else {
 				MSG2(1, "symbols", "Invalid reference \\%c", c);
 				g_string_append_c(result, c);
@@ -1098,80 +1663,30 @@ static int replace_groups(const GMatchInfo *match_info, GString *result, char *r
 	return 1;
 }
 
-/* Regular expression callback for applying replacements */
-static gboolean regex_eval(const GMatchInfo *match_info, GString *result, gpointer user_data)
+/* Appends to @p result the replacement for @p sym, which matched @p capture,
+ * from @p start to @p end of the text being processed.  @p match_info and
+ * @p pos are only needed for complex symbols. */
+static void symbol_replace(SpeechSymbolContext *ctx, GString *result,
+			   enum group captured_group, const SpeechSymbol *sym,
+			   const gchar *capture, gint start, gint end,
+			   const GMatchInfo *match_info, gint pos)
 {
-	SpeechSymbolProcessor *ssp = user_data;
-	gchar *capture;
-	enum group captured_group;
-	gchar *group_0;
-	gint start = -1, end = -1;
+	gsize capture_len = end - start;
 	gint prevlen = result->len, shift;
 	gint nexttag, curtag, deferrable;
-	guint i = 0;
-	SpeechSymbol *sym = NULL;
-	gint pos = 0;
-
-	/* First see what we captured */
-
-	/* FIXME: Python regex API allows to find the name of the group that
-	 *        matched.  As GRegex doesn't have that, what we do here is try
-	 *        and fetch the groups we know, and see if they matched.
-	 *        This is not very optimal, but how can we avoid that? */
-
-	if ((capture = fetch_named_matching(match_info, "rstripSpace"))) {
-		captured_group = RSTRIPSPACE;
-	} else if ((capture = fetch_named_matching(match_info, "repeated"))) {
-		captured_group = REPEATED;
-	} else if ((capture = fetch_named_matching(match_info, "simple"))) {
-		captured_group = SIMPLE;
-	} else {
-		/* Complex symbol. */
-		GSList *node;
-
-		for (node = ssp->complex_list; !sym && node; node = node->next, i++) {
-			gchar *group_name = g_strdup_printf("c%u", i);
-
-			if ((capture = fetch_named_matching(match_info, group_name))) {
-				gchar **all = g_match_info_fetch_all(match_info);
-				gint i;
-
-				pos = -1;
-				/* Find out the index of the match */
-				for (i = 1; all[i]; i++) {
-					if (all[i][0]) {
-						pos = i;
-						break;
-					}
-				}
-				g_strfreev(all);
-
-				if (pos != -1)
-					sym = node->data;
-			}
-			g_free(group_name);
-
-			if (sym)
-				break;
-		}
 
-		captured_group = COMPLEX;
-	}
-
-	/* Now check where that lies among tags */
-
-	g_match_info_fetch_pos(match_info, 0, &start, &end);
+	/* First check where that lies among tags */
 
-	nexttag = find_nexttag(ssp->tags, start, 0, ssp->ntags);
+	nexttag = find_nexttag(ctx->tags, start, 0, ctx->ntags);
 
 	/* Check whether the contained tags are deferrable */
 	deferrable = 1;
-	for (curtag = nexttag; curtag < ssp->ntags; curtag++) {
-		if (ssp->tags[curtag].pos >= end)
+	for (curtag = nexttag; curtag < ctx->ntags; curtag++) {
+		if (ctx->tags[curtag].pos >= end)
 			/* Don't care about the rest */
 			break;
 		/* This block of tags is within the group */
-		if (!ssp->tags[curtag].deferrable) {
+		if (!ctx->tags[curtag].deferrable) {
 			/* Oops, these tags can't be deferred */
 			deferrable = 0;
 			break;
@@ -1179,25 +1694,22 @@ static gboolean regex_eval(const GMatchInfo *match_info, GString *result, gpoint
 	}
 
 	if (!deferrable) {
-		group_0 = g_match_info_fetch(match_info, 0);
-		MSG2(1, "symbols", "tags '%s' within group |%s| (at %d..%d), not replacing group :/",
-				   ssp->tags[curtag].tags, group_0, start, end);
-		g_free(group_0);
+		MSG2(1, "symbols", "tags '%s' within group |%.*s| (at %d..%d), not replacing group :/",
+				   ctx->tags[curtag].tags, (int) capture_len, capture, start, end);
 
-		g_string_append(result, capture);
-		g_free(capture);
+		g_string_append_len(result, capture, capture_len);
 
-		return FALSE;
+		return;
 	}
 
 	/* Defer these tags */
-	for (curtag = nexttag; curtag < ssp->ntags; curtag++) {
-		if (ssp->tags[curtag].pos >= end)
+	for (curtag = nexttag; curtag < ctx->ntags; curtag++) {
+		if (ctx->tags[curtag].pos >= end)
 			/* Don't care about the rest */
 			break;
 		/* This block of tags is within the group, defer it after the group */
-		MSG2(5, "symbols", "deferring tags '%s' to %d", ssp->tags[curtag].tags, end);
-		ssp->tags[curtag].pos = end;
+		MSG2(5, "symbols", "deferring tags '%s' to %d", ctx->tags[curtag].tags, end);
+		ctx->tags[curtag].pos = end;
 	}
 
 	/* Ok, now replace */
@@ -1206,32 +1718,27 @@ static gboolean regex_eval(const GMatchInfo *match_info, GString *result, gpoint
 		/* nothing to do, just don't add it in the result */
 	} else if (captured_group == REPEATED) {
 		/* Repeated character. */
-		char ch[2] = { capture[0], 0 };
-		SpeechSymbol *sym = g_hash_table_lookup(ssp->symbols, ch);
-
 		MSG2(5, "symbols", "replacing <repeated>");
 
 		/* this should never happen, but be on the safe side and check it */
 		if (!sym)
 			goto symbol_error;
 
-		if (ssp->level >= sym->level) {
-			g_string_append_printf(result, " %lu %s ", (unsigned long) strlen(capture), sym->replacement);
+		if (ctx->level >= sym->level) {
+			g_string_append_printf(result, " %lu %s ", (unsigned long) capture_len, sym->replacement);
 		} else {
 			g_string_append_c(result, ' ');
 		}
 	} else {
 		const gchar *prefix, *suffix;
+		gsize suffix_len;
 
 		/* One of the defined symbols. **/
 		if (captured_group == SIMPLE) {
-			/* Simple symbol. */
-			sym = g_hash_table_lookup(ssp->symbols, capture);
 			MSG2(5, "symbols", "replacing <simple>");
 		} else {
 			g_assert(captured_group == COMPLEX);
-			/* Complex symbol, sym and i already set */
-			MSG2(5, "symbols", "replacing <c%u> (complex symbol)", i);
+			MSG2(5, "symbols", "replacing <c> (complex symbol)");
 		}
 
 		/* this should never happen, but be on the safe side and check it */
@@ -1247,47 +1754,282 @@ static gboolean regex_eval(const GMatchInfo *match_info, GString *result, gpoint
 			prefix = " ";
 
 		if (sym->preserve == SYMPRES_ALWAYS ||
-		    (sym->preserve == SYMPRES_NOREP && ssp->level < sym->level))
+		    (sym->preserve == SYMPRES_NOREP && ctx->level < sym->level)) {
 			suffix = capture;
-		else if (sym->preserve == SYMPRES_LITERAL)
+			suffix_len = capture_len;
+		} else if (sym->preserve == SYMPRES_LITERAL) {
 			suffix = "";
-		else
+			suffix_len = 0;
+		} else {
 			suffix = " ";
+			suffix_len = 1;
+		}
 
-		if (sym->level > ssp->support_level) {
+		if (sym->level > ctx->support_level) {
 			/* Leave it to the module */
-			g_string_append(result, capture);
-		} else if (ssp->level >= sym->level && sym->replacement) {
+			g_string_append_len(result, capture, capture_len);
+		} else if (ctx->level >= sym->level && sym->replacement) {
 			g_string_append(result, prefix);
 			MSG2(5, "symbols", "replacing with %s", sym->replacement);
-			replace_groups(match_info, result, sym->replacement, pos);
-			g_string_append(result, suffix);
+			replace_groups(match_info, capture, capture_len, result, sym->replacement, pos);
+			g_string_append_len(result, suffix, suffix_len);
 		} else {
-			g_string_append(result, suffix);
+			g_string_append_len(result, suffix, suffix_len);
 		}
 	}
 
 	goto out;
 
 symbol_error:
-	group_0 = g_match_info_fetch(match_info, 0);
-	MSG2(1, "symbols", "WARNING: no symbol for match |%s| (at %d..%d), this shouldn't happen.",
-	     group_0, start, end);
-	g_free(group_0);
+	MSG2(1, "symbols", "WARNING: no symbol for match |%.*s| (at %d..%d), this shouldn't happen.",
+	     (int) capture_len, capture, start, end);
 
 out:
 	/* content has grown (or shrunk) by this amount */
-	shift = (result->len - prevlen) - strlen(capture);
+	shift = (result->len - prevlen) - capture_len;
 
-	if (nexttag < ssp->ntags)
+	if (nexttag < ctx->ntags)
 		/* Update positions of tags beyond this */
-		ssp->tags[nexttag].shift += shift;
+		ctx->tags[nexttag].shift += shift;
+}
+
+/* Regular expression callback for applying replacements with SYMENGINE_REGEX */
+static gboolean regex_eval(const GMatchInfo *match_info, GString *result, gpointer user_data)
+{
+	SpeechSymbolContext *ctx = user_data;
+	SpeechSymbolProcessor *ssp = ctx->ssp;
+	gchar *capture;
+	enum group captured_group;
+	gint start = -1, end = -1;
+	guint i = 0;
+	SpeechSymbol *sym = NULL;
+	gint pos = 0;
+
+	/* First see what we captured */
 
-	g_free(capture);
+	/* FIXME: Python regex API allows to find the name of the group that
+	 *        matched.  As GRegex doesn't have that, what we do here is try
+	 *        and fetch the groups we know, and see if they matched.
+	 *        This is not very optimal, but how can we avoid that? */
+
+	if ((capture = fetch_named_matching(match_info, "rstripSpace"))) {
+		captured_group = RSTRIPSPACE;
+	} else if ((capture = fetch_named_matching(match_info, "repeated"))) {
+		char ch[2] = { capture[0], 0 };
+
+		captured_group = REPEATED;
+		sym = g_hash_table_lookup(ssp->symbols, ch);
+	} else if ((capture = fetch_named_matching(match_info, "simple"))) {
+		captured_group = SIMPLE;
+		sym = g_hash_table_lookup(ssp->symbols, capture);
+	} else {
+		/* Complex symbol. */
+		GSList *node;
+
+		for (node = ssp->complex_list; !sym && node; node = node->next, i++) {
+			gchar *group_name = g_strdup_printf("c%u", i);
+
+			if ((capture = fetch_named_matching(match_info, group_name))) {
+				gchar **all = g_match_info_fetch_all(match_info);
+				gint i;
+
+				pos = -1;
+				/* Find out the index of the match */
+				for (i = 1; all[i]; i++) {
+					if (all[i][0]) {
+						pos = i;
+						break;
+					}
+				}
+				g_strfreev(all);
+
+				if (pos != -1)
+					sym = node->data;
+				g_free(capture);
+			}
+			g_free(group_name);
+
+			if (sym)
+				break;
+		}
+
+		captured_group = COMPLEX;
+	}
+	/* The named group is the whole match */
+	if (captured_group != COMPLEX)
+		g_free(capture);
+
+	g_match_info_fetch_pos(match_info, 0, &start, &end);
+
+	symbol_replace(ctx, result, captured_group, sym,
+		       g_match_info_get_string(match_info) + start, start, end,
+		       match_info, pos);
 
 	return FALSE;
 }
 
+/* Looks for the next non-empty match of ssp->complex_regex from @p from.
+ * Sets @p start to G_MAXINT if there is none. */
+static void complex_regex_search(SpeechSymbolProcessor *ssp, const gchar *text, gsize len, gsize from,
+				 GMatchInfo **match_info, gint *start, gint *end, gboolean *rstrip)
+{
+	if (*match_info)
+		g_match_info_free(*match_info);
+
+	if (g_regex_match_full(ssp->complex_regex, text, len, from, 0, match_info, NULL)) {
+		do {
+			g_match_info_fetch_pos(*match_info, 0, start, end);
+			if (*end > *start) {
+				gint rstart = -1, rend = -1;
+
+				g_match_info_fetch_pos(*match_info, 1, &rstart, &rend);
+				*rstrip = rstart != -1;
+				return;
+			}
+		} while (g_match_info_next(*match_info, NULL));
+	}
+
+	*start = *end = G_MAXINT;
+}
+
+/* Finds which complex symbol matched, and the number of its group */
+static SpeechSymbol *complex_regex_symbol(SpeechSymbolProcessor *ssp, const GMatchInfo *match_info, gint *pos)
+{
+	gint count = g_match_info_get_match_count(match_info);
+	gint start = -1, end = -1;
+	guint lo = 0, hi = ssp->ncomplex, i;
+
+	/* Only one complex group can be set, and the match count tells the
+	 * highest group set, which is the complex group or one of its own. */
+	while (hi - lo > 1) {
+		guint mid = (lo + hi) / 2;
+
+		if (ssp->complex_groups[mid] < count)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (lo < ssp->ncomplex
+	    && g_match_info_fetch_pos(match_info, ssp->complex_groups[lo], &start, &end)
+	    && start != -1) {
+		*pos = ssp->complex_groups[lo];
+		return ssp->syms[lo];
+	}
+
+	/* Should not happen, but look at all of them */
+	for (i = 0; i < ssp->ncomplex; i++) {
+		if (g_match_info_fetch_pos(match_info, ssp->complex_groups[i], &start, &end)
+		    && start != -1) {
+			*pos = ssp->complex_groups[i];
+			return ssp->syms[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns the end of the repetition of a single-character symbol at @p q,
+ * or 0 if there isn't one */
+static gsize trie_match_repeated(SpeechSymbolProcessor *ssp, const gchar *text, gsize q, SpeechSymbol **sym)
+{
+	guint node = ssp->trie_first[(guchar) text[q]];
+	const SymTrieNode *n;
+	gsize end;
+
+	if (!node)
+		return 0;
+	n = &ssp->trie[node];
+	if (!n->terminal)
+		return 0;
+
+	for (end = q + 1; text[end] == text[q]; end++)
+		;
+	if (end - q < 4)
+		return 0;
+
+	*sym = n->sym ? ssp->syms[n->sym - 1] : NULL;
+	return end;
+}
+
+/* Returns the end of the longest simple symbol at @p q, or 0 if there isn't
+ * one */
+static gsize trie_match_simple(SpeechSymbolProcessor *ssp, const gchar *text, gsize q, SpeechSymbol **sym)
+{
+	guint node = ssp->trie_first[(guchar) text[q]];
+	gsize i = q, end = 0;
+
+	while (node) {
+		const SymTrieNode *n = &ssp->trie[node];
+
+		i++;
+		if (n->terminal) {
+			end = i;
+			*sym = n->sym ? ssp->syms[n->sym - 1] : NULL;
+		}
+		for (node = n->child; node; node = ssp->trie[node].next) {
+			if (ssp->trie[node].c == (guchar) text[i])
+				break;
+		}
+	}
+
+	return end;
+}
+
+/* Applies the symbols to @p text with SYMENGINE_TRIE.
+ *
+ * This gives the same result as g_regex_replace_eval() with ssp->pattern:
+ * at each position, that one tries rstripSpace, repeated, the complex symbols
+ * in order, and then the longest simple symbol.  We keep the next match of
+ * ssp->complex_regex (rstripSpace and the complex symbols) and check repeated
+ * and simple symbols with the trie at each position until we reach it. */
+static gchar *speech_symbols_processor_match(SpeechSymbolContext *ctx, const gchar *text)
+{
+	SpeechSymbolProcessor *ssp = ctx->ssp;
+	gsize len = strlen(text);
+	GString *result = g_string_sized_new(len);
+	GMatchInfo *match_info = NULL;
+	gint rstart = -1, rend = -1;	/* next match of complex_regex */
+	gboolean rstrip = FALSE;	/* whether that is rstripSpace */
+	gsize q = 0, copied = 0;
+
+	while (q < len) {
+		enum group captured_group;
+		SpeechSymbol *sym = NULL;
+		gint pos = 0;
+		gsize end;
+
+		if (rstart < (gint) q)
+			complex_regex_search(ssp, text, len, q, &match_info, &rstart, &rend, &rstrip);
+
+		if (rstart == (gint) q && rstrip) {
+			captured_group = RSTRIPSPACE;
+			end = rend;
+		} else if ((end = trie_match_repeated(ssp, text, q, &sym))) {
+			captured_group = REPEATED;
+		} else if (rstart == (gint) q) {
+			captured_group = COMPLEX;
+			sym = complex_regex_symbol(ssp, match_info, &pos);
+			end = rend;
+		} else if ((end = trie_match_simple(ssp, text, q, &sym))) {
+			captured_group = SIMPLE;
+		} else {
+			q += g_utf8_skip[(guchar) text[q]];
+			continue;
+		}
+
+		g_string_append_len(result, text + copied, q - copied);
+		symbol_replace(ctx, result, captured_group, sym, text + q, q, end,
+			       match_info, pos);
+		q = copied = end;
+	}
+	g_string_append_len(result, text + copied, len - copied);
+
+	if (match_info)
+		g_match_info_free(match_info);
+
+	return g_string_free(result, FALSE);
+}
+
 /* Processes some input and converts symbols in it */
 static gchar *speech_symbols_processor_process_text(GSList *sspl, const gchar *input, SymLvl level, SymLvl support_level, SPDDataMode ssml_mode)
 {
@@ -1296,6 +2038,7 @@ static gchar *speech_symbols_processor_process_text(GSList *sspl, const gchar *i
 	struct tags *tags = NULL;
 	gint ntags = 0, i;
 	GError *error = NULL;
+	SpeechSymbolContext ctx;
 
 	if (ssml_mode == SPD_DATA_SSML) {
 		text = escape_ssml_text(input, &tags, &ntags);
@@ -1304,20 +2047,27 @@ static gchar *speech_symbols_processor_process_text(GSList *sspl, const gchar *i
 		text = g_strdup(input);
 	}
 
+	ctx.tags = tags;
+	ctx.ntags = ntags;
+	ctx.level = level;
+	ctx.support_level = support_level;
+
 	for ( ; sspl; sspl = sspl->next) {
 		SpeechSymbolProcessor *ssp = sspl->data;
 
-		if (ssml_mode == SPD_DATA_SSML) {
-			for (i = 0; i < ntags; i++)
-				tags[i].shift = 0;
-			ssp->tags = tags;
-			ssp->ntags = ntags;
-		} else
-			ssp->ntags = 0;
-
-		ssp->level = level;
-		ssp->support_level = support_level;
-		processed = g_regex_replace_eval(ssp->regex, text, -1, 0, 0, regex_eval, ssp, &error);
+		ctx.ssp = ssp;
+		for (i = 0; i < ntags; i++)
+			tags[i].shift = 0;
+
+		if (symbols_engine == SYMENGINE_REGEX) {
+			GRegex *regex = speech_symbols_processor_get_regex(ssp);
+
+			if (!regex)
+				continue;
+			processed = g_regex_replace_eval(regex, text, -1, 0, 0, regex_eval, &ctx, &error);
+		} else {
+			processed = speech_symbols_processor_match(&ctx, text);
+		}
 		if (!processed) {
 			MSG2(1, "symbols", "ERROR applying regex: %s", error->message);
 			g_error_free(error);
@@ -1353,22 +2103,394 @@ static gchar *speech_symbols_processor_process_text(GSList *sspl, const gchar *i
 	return processed;
 }
 
-/* Gets a possibly cached processor for the given locale */
+/* Gets a possibly cached processor for the given locale.  Processors are
+ * never freed, so the result stays valid after releasing the lock. */
 static GSList *get_locale_speech_symbols_processor(const gchar *locale)
 {
+	GSList *sspl = NULL;
+	gboolean found = FALSE;
+
+	/* Usually it was already loaded, don't block other threads */
+	pthread_rwlock_rdlock(&symbols_lock);
+	if (G_locale_processors)
+		found = g_hash_table_lookup_extended(G_locale_processors, locale,
+						     NULL, (gpointer *) &sspl);
+	pthread_rwlock_unlock(&symbols_lock);
+	if (found)
+		return sspl;
+
+	pthread_rwlock_wrlock(&symbols_lock);
 	if (!G_processors) {
 		G_processors = locale_map_new((GDestroyNotify) speech_symbols_processor_list_free);
+		G_locale_processors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	}
+
+	/* Another thread may have loaded it meanwhile */
+	if (!g_hash_table_lookup_extended(G_locale_processors, locale, NULL, (gpointer *) &sspl)) {
+		sspl = locale_map_fetch(G_processors, locale, NULL, speech_symbols_processor_list_new);
+		g_hash_table_insert(G_locale_processors, g_strdup(locale), sspl);
+	}
+	pthread_rwlock_unlock(&symbols_lock);
+
+	return sspl;
+}
+
+/*--------------------------- Processed text cache --------------------------*/
+
+/*
+ * Screen readers keep sending the same short strings (role names, menu
+ * items, single characters...), so the results of process_speech_symbols()
+ * are kept in a least recently used cache, within symbols_text_cache_budget
+ * bytes.  It is flushed whenever the loaded tables may change.
+ *
+ * Unlike the rest of this module, this cache is locked, since it is
+ * configured and flushed from the main thread.
+ */
+
+/* Longer texts are unlikely to be sent again, and would evict many entries */
+#define SYMBOLS_TEXT_CACHE_MAX_TEXT 256
+
+typedef struct {
+	GList link;		/* In symbols_text_cache_lru, data points to us */
+	guint hash;
+	SymLvl level;
+	SymLvl support_level;
+	SPDDataMode ssml_mode;
+	gchar *locale;
+	gchar *text;
+	gchar *processed;
+	gsize size;
+} SymTextCacheEntry;
+
+static pthread_mutex_t symbols_text_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* SymTextCacheEntry, indexed by themselves */
+static GHashTable *symbols_text_cache;
+/* Most recently used first */
+static GQueue symbols_text_cache_lru = G_QUEUE_INIT;
+static gsize symbols_text_cache_size;
+static gsize symbols_text_cache_budget;
+
+static guint sym_text_cache_entry_hash(gconstpointer p)
+{
+	return ((const SymTextCacheEntry *) p)->hash;
+}
+
+static gboolean sym_text_cache_entry_equal(gconstpointer pa, gconstpointer pb)
+{
+	const SymTextCacheEntry *a = pa, *b = pb;
+
+	return a->hash == b->hash && a->level == b->level
+	    && a->support_level == b->support_level
+	    && a->ssml_mode == b->ssml_mode && !strcmp(a->text, b->text)
+	    && !strcmp(a->locale, b->locale);
+}
+
+static void sym_text_cache_entry_free(SymTextCacheEntry *entry)
+{
+	g_free(entry->locale);
+	g_free(entry->text);
+	g_free(entry->processed);
+	g_free(entry);
+}
+
+/* Removes @p entry from the cache and frees it, with the lock held */
+static void symbols_text_cache_remove(SymTextCacheEntry *entry)
+{
+	g_hash_table_remove(symbols_text_cache, entry);
+	g_queue_unlink(&symbols_text_cache_lru, &entry->link);
+	symbols_text_cache_size -= entry->size;
+	sym_text_cache_entry_free(entry);
+}
+
+/* Evicts entries until the cache fits in @p budget, with the lock held */
+static void symbols_text_cache_trim(gsize budget)
+{
+	while (symbols_text_cache_size > budget)
+		symbols_text_cache_remove(symbols_text_cache_lru.tail->data);
+}
+
+/* Returns a copy of the cached result, or NULL if it isn't cached */
+static gchar *symbols_text_cache_lookup(const gchar *locale, const gchar *text,
+					SymLvl level, SymLvl support_level,
+					SPDDataMode ssml_mode, guint *hash)
+{
+	SymTextCacheEntry key, *entry;
+	gchar *processed = NULL;
+
+	*hash = g_str_hash(text);
+	*hash = *hash * 31 + g_str_hash(locale);
+	*hash = *hash * 31 + level;
+	*hash = *hash * 31 + support_level;
+	*hash = *hash * 31 + ssml_mode;
+
+	key.hash = *hash;
+	key.level = level;
+	key.support_level = support_level;
+	key.ssml_mode = ssml_mode;
+	key.locale = (gchar *) locale;
+	key.text = (gchar *) text;
+
+	pthread_mutex_lock(&symbols_text_cache_mutex);
+	if (symbols_text_cache) {
+		entry = g_hash_table_lookup(symbols_text_cache, &key);
+		if (entry) {
+			g_queue_unlink(&symbols_text_cache_lru, &entry->link);
+			g_queue_push_head_link(&symbols_text_cache_lru, &entry->link);
+			processed = g_strdup(entry->processed);
+		}
 	}
+	pthread_mutex_unlock(&symbols_text_cache_mutex);
 
-	return locale_map_fetch(G_processors, locale, NULL, speech_symbols_processor_list_new);
+	return processed;
+}
+
+/* Caches @p processed as the result for @p text */
+static void symbols_text_cache_insert(const gchar *locale, const gchar *text,
+				      SymLvl level, SymLvl support_level,
+				      SPDDataMode ssml_mode, guint hash,
+				      const gchar *processed)
+{
+	SymTextCacheEntry *entry, *old;
+	gsize text_len = strlen(text);
+	gsize size;
+
+	if (text_len > SYMBOLS_TEXT_CACHE_MAX_TEXT)
+		return;
+	size = sizeof(*entry) + strlen(locale) + 1 + text_len + 1
+	       + strlen(processed) + 1;
+
+	pthread_mutex_lock(&symbols_text_cache_mutex);
+	if (size > symbols_text_cache_budget) {
+		pthread_mutex_unlock(&symbols_text_cache_mutex);
+		return;
+	}
+	if (!symbols_text_cache)
+		symbols_text_cache = g_hash_table_new(sym_text_cache_entry_hash,
+						      sym_text_cache_entry_equal);
+
+	entry = g_new0(SymTextCacheEntry, 1);
+	entry->link.data = entry;
+	entry->hash = hash;
+	entry->level = level;
+	entry->support_level = support_level;
+	entry->ssml_mode = ssml_mode;
+	entry->locale = g_strdup(locale);
+	entry->text = g_strdup(text);
+	entry->processed = g_strdup(processed);
+	entry->size = size;
+
+	/* Another thread may have inserted it meanwhile */
+	old = g_hash_table_lookup(symbols_text_cache, entry);
+	if (old)
+		symbols_text_cache_remove(old);
+
+	symbols_text_cache_trim(symbols_text_cache_budget - size);
+	g_hash_table_add(symbols_text_cache, entry);
+	g_queue_push_head_link(&symbols_text_cache_lru, &entry->link);
+	symbols_text_cache_size += size;
+	pthread_mutex_unlock(&symbols_text_cache_mutex);
+}
+
+/* Drops all cached results */
+static void symbols_text_cache_flush(void)
+{
+	pthread_mutex_lock(&symbols_text_cache_mutex);
+	symbols_text_cache_trim(0);
+	pthread_mutex_unlock(&symbols_text_cache_mutex);
+}
+
+/*------------------------- Character descriptions --------------------------*/
+
+/*
+ * Key echo and spelling send one character at a time, and have to be spoken
+ * as soon as possible.  So the description of each character message, as
+ * received, is kept for good in a table, and later messages for the same
+ * character skip normalization and matching altogether.  Unlike the text
+ * cache, nothing is ever evicted, as there are only so many characters
+ * users type.
+ */
+
+/* Texts that long are not characters */
+#define SYMBOLS_CHAR_MAX_TEXT 32
+/* Stop adding to the table if a client sends all sorts of characters */
+#define SYMBOLS_CHAR_TABLE_MAX 8192
+
+static pthread_mutex_t symbols_char_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* SymTextCacheEntry, indexed by themselves, processed is NULL if the
+ * character is left as it is */
+static GHashTable *symbols_char_table;
+
+/* Fills @p key to look up @p msg with @p support_level */
+static void symbols_char_key(SymTextCacheEntry *key, TSpeechDMessage *msg, SymLvl support_level)
+{
+	const gchar *locale = msg->settings.msg_settings.voice.language;
+
+	key->level = SYMLVL_CHAR;
+	key->support_level = support_level;
+	key->ssml_mode = msg->settings.ssml_mode;
+	key->locale = (gchar *) locale;
+	key->text = msg->buf;
+	key->hash = g_str_hash(msg->buf) * 31 + g_str_hash(locale);
+	key->hash = key->hash * 31 + support_level;
+	key->hash = key->hash * 31 + key->ssml_mode;
+}
+
+/* Looks @p key up, returns whether it is known and sets @p processed to a
+ * copy of its description */
+static gboolean symbols_char_lookup(const SymTextCacheEntry *key, gchar **processed)
+{
+	SymTextCacheEntry *entry = NULL;
+
+	pthread_mutex_lock(&symbols_char_mutex);
+	if (symbols_char_table)
+		entry = g_hash_table_lookup(symbols_char_table, key);
+	if (entry)
+		*processed = g_strdup(entry->processed);
+	pthread_mutex_unlock(&symbols_char_mutex);
+
+	return entry != NULL;
+}
+
+/* Remembers that @p key is described as @p processed */
+static void symbols_char_insert(const SymTextCacheEntry *key, const gchar *processed)
+{
+	SymTextCacheEntry *entry;
+
+	if (strlen(key->text) > SYMBOLS_CHAR_MAX_TEXT)
+		return;
+
+	pthread_mutex_lock(&symbols_char_mutex);
+	if (!symbols_char_table)
+		symbols_char_table = g_hash_table_new_full(sym_text_cache_entry_hash,
+							   sym_text_cache_entry_equal,
+							   (GDestroyNotify) sym_text_cache_entry_free,
+							   NULL);
+	if (g_hash_table_size(symbols_char_table) < SYMBOLS_CHAR_TABLE_MAX
+	    && !g_hash_table_contains(symbols_char_table, key)) {
+		entry = g_new0(SymTextCacheEntry, 1);
+		*entry = *key;
+		entry->link.data = entry;
+		entry->locale = g_strdup(key->locale);
+		entry->text = g_strdup(key->text);
+		entry->processed = g_strdup(processed);
+		g_hash_table_add(symbols_char_table, entry);
+	}
+	pthread_mutex_unlock(&symbols_char_mutex);
+}
+
+/* Drops all known descriptions */
+static void symbols_char_table_flush(void)
+{
+	pthread_mutex_lock(&symbols_char_mutex);
+	if (symbols_char_table)
+		g_hash_table_remove_all(symbols_char_table);
+	pthread_mutex_unlock(&symbols_char_mutex);
+}
+
+/*------------------------------- Worker pool -------------------------------*/
+
+/* Messages processed by insert_symbols_parallel() */
+typedef struct {
+	TSpeechDMessage **msgs;
+	gint n;
+	int punct_missing;
+	gint next;		/* Next message to process */
+	gint workers;		/* Pool threads still working on the batch */
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+} SymbolsBatch;
+
+static pthread_mutex_t symbols_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GThreadPool *symbols_pool;
+static int symbols_threads = 1;
+
+/* Processes the messages of @p batch nobody took yet */
+static void symbols_batch_run(SymbolsBatch *batch)
+{
+	gint i;
+
+	while ((i = g_atomic_int_add(&batch->next, 1)) < batch->n)
+		insert_symbols(batch->msgs[i], batch->punct_missing);
+}
+
+static void symbols_pool_work(gpointer data, gpointer user_data)
+{
+	SymbolsBatch *batch = data;
+
+	symbols_batch_run(batch);
+
+	pthread_mutex_lock(&batch->mutex);
+	if (--batch->workers == 0)
+		pthread_cond_signal(&batch->done);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+/* Returns the pool, creating it the first time, or NULL if we only use the
+ * calling thread */
+static GThreadPool *symbols_pool_get(void)
+{
+	GError *error = NULL;
+	GThreadPool *pool;
+
+	pthread_mutex_lock(&symbols_pool_mutex);
+	if (!symbols_pool && symbols_threads > 1) {
+		symbols_pool = g_thread_pool_new(symbols_pool_work, NULL,
+						 symbols_threads - 1, FALSE, &error);
+		if (!symbols_pool) {
+			MSG2(1, "symbols", "Can't create symbols threads: %s", error->message);
+			g_error_free(error);
+			symbols_threads = 1;
+		}
+	}
+	pool = symbols_pool;
+	pthread_mutex_unlock(&symbols_pool_mutex);
+
+	return pool;
 }
 
 /*----------------------------------- API -----------------------------------*/
 
+void symbols_set_engine(SymEngine engine)
+{
+	symbols_engine = engine;
+}
+
+void symbols_set_cache_dir(const char *dir)
+{
+	g_free(symbols_cache_dir);
+	symbols_cache_dir = g_strdup(dir);
+}
+
+void symbols_set_threads(int threads)
+{
+	pthread_mutex_lock(&symbols_pool_mutex);
+	symbols_threads = MAX(threads, 1);
+	if (symbols_pool)
+		g_thread_pool_set_max_threads(symbols_pool, MAX(symbols_threads - 1, 1), NULL);
+	pthread_mutex_unlock(&symbols_pool_mutex);
+}
+
+void symbols_set_text_cache_size(size_t size)
+{
+	pthread_mutex_lock(&symbols_text_cache_mutex);
+	symbols_text_cache_budget = size;
+	/* The configuration may have changed the tables as well */
+	symbols_text_cache_trim(0);
+	pthread_mutex_unlock(&symbols_text_cache_mutex);
+
+	symbols_char_table_flush();
+}
+
 /* Process some text, converting symbols according to desired pronunciation. */
 static gchar *process_speech_symbols(const gchar *locale, const gchar *text, SymLvl level, SymLvl support_level, SPDDataMode ssml_mode)
 {
 	GSList *sspl;
+	gchar *processed;
+	guint hash;
+
+	processed = symbols_text_cache_lookup(locale, text, level, support_level, ssml_mode, &hash);
+	if (processed)
+		return processed;
 
 	sspl = get_locale_speech_symbols_processor(locale);
 	/* fallback to English if there's no processor for the locale */
@@ -1377,13 +2499,16 @@ static gchar *process_speech_symbols(const gchar *locale, const gchar *text, Sym
 	if (!sspl)
 		return NULL;
 
-	return speech_symbols_processor_process_text(sspl, text, level, support_level, ssml_mode);
+	processed = speech_symbols_processor_process_text(sspl, text, level, support_level, ssml_mode);
+	if (processed)
+		symbols_text_cache_insert(locale, text, level, support_level, ssml_mode, hash, processed);
+
+	return processed;
 }
 
-void insert_symbols(TSpeechDMessage *msg, int punct_missing)
+/* Returns the level at which symbols of @p msg have to be supported */
+static SymLvl insert_symbols_support_level(TSpeechDMessage *msg, int punct_missing)
 {
-	gchar *processed;
-	SymLvl level = SYMLVL_NONE;
 	SymLvl support_level = msg->settings.symbols_preprocessing;
 
 	if (punct_missing && support_level < SYMLVL_ALL)
@@ -1391,6 +2516,32 @@ void insert_symbols(TSpeechDMessage *msg, int punct_missing)
 		 * but this module doesn't support it, so force handling it ourself. */
 		support_level = SYMLVL_ALL;
 
+	return support_level;
+}
+
+/* Replaces the text of @p msg with @p processed */
+static void insert_symbols_apply(TSpeechDMessage *msg, gchar *processed, SymLvl level, SymLvl support_level)
+{
+	MSG2(5, "symbols", "before: |%s|", msg->buf);
+	g_free(msg->buf);
+	msg->buf = processed;
+	MSG2(5, "symbols", "after: |%s|", msg->buf);
+	if (support_level >= level)
+		/* if we performed the replacement, don't let the module speak it again */
+		msg->settings.msg_settings.punctuation_mode = SPD_PUNCT_NONE;
+
+	/* if we provide a character description file, don't let the module spell it */
+	if (msg->settings.type == SPD_MSGTYPE_CHAR)
+		if (g_utf8_strlen(processed, -1) > 1)
+			msg->settings.type = SPD_MSGTYPE_TEXT;
+}
+
+void insert_symbols(TSpeechDMessage *msg, int punct_missing)
+{
+	gchar *processed;
+	SymLvl level = SYMLVL_NONE;
+	SymLvl support_level = insert_symbols_support_level(msg, punct_missing);
+
 	switch (msg->settings.msg_settings.punctuation_mode) {
 	case SPD_PUNCT_ALL: level = SYMLVL_ALL; break;
 	case SPD_PUNCT_MOST: level = SYMLVL_MOST; break;
@@ -1402,20 +2553,86 @@ void insert_symbols(TSpeechDMessage *msg, int punct_missing)
 		level = SYMLVL_CHAR;
 
 	MSG2(5, "symbols", "processing at level %d, supporting level %d", level, support_level);
+	flight_recorder_record(FR_SYMBOLS, level, support_level, NULL, 0);
 	processed = process_speech_symbols(msg->settings.msg_settings.voice.language,
 		msg->buf, level, support_level, msg->settings.ssml_mode);
+	if (processed)
+		insert_symbols_apply(msg, processed, level, support_level);
+}
+
+int insert_char_description(TSpeechDMessage *msg, int punct_missing)
+{
+	SymLvl support_level = insert_symbols_support_level(msg, punct_missing);
+	SymTextCacheEntry key;
+	gchar *processed = NULL;
+	gchar *normalized;
+
+	flight_recorder_record(FR_SYMBOLS, SYMLVL_CHAR, support_level, NULL, 0);
+	symbols_char_key(&key, msg, support_level);
+	if (symbols_char_lookup(&key, &processed)) {
+		MSG2(5, "symbols", "character |%s| described as |%s|", msg->buf,
+		     processed ? processed : msg->buf);
+		if (processed)
+			insert_symbols_apply(msg, processed, SYMLVL_CHAR, support_level);
+		return 1;
+	}
+
+	/* Not known yet, do it the long way */
+	normalized = g_utf8_normalize(msg->buf, -1, G_NORMALIZE_ALL_COMPOSE);
+	if (!normalized)
+		return 0;
+
+	processed = process_speech_symbols(key.locale, normalized, SYMLVL_CHAR,
+					   support_level, key.ssml_mode);
 	if (processed) {
-		MSG2(5, "symbols", "before: |%s|", msg->buf);
+		symbols_char_insert(&key, processed);
+		insert_symbols_apply(msg, processed, SYMLVL_CHAR, support_level);
+		g_free(normalized);
+	} else if (strcmp(normalized, msg->buf)) {
+		/* No symbols for this language, only speak it normalized */
 		g_free(msg->buf);
-		msg->buf = processed;
-		MSG2(5, "symbols", "after: |%s|", msg->buf);
-		if (support_level >= level)
-			/* if we performed the replacement, don't let the module speak it again */
-			msg->settings.msg_settings.punctuation_mode = SPD_PUNCT_NONE;
+		msg->buf = normalized;
+	} else {
+		symbols_char_insert(&key, NULL);
+		g_free(normalized);
+	}
 
-		/* if we provide a character description file, don't let the module spell it */
-		if (msg->settings.type == SPD_MSGTYPE_CHAR)
-			if (g_utf8_strlen(processed, -1) > 1)
-				msg->settings.type = SPD_MSGTYPE_TEXT;
+	return 1;
+}
+
+void insert_symbols_parallel(TSpeechDMessage **msgs, int n, int punct_missing)
+{
+	SymbolsBatch batch;
+	GThreadPool *pool = NULL;
+	gint i;
+
+	if (n > 1)
+		pool = symbols_pool_get();
+	if (!pool) {
+		for (i = 0; i < n; i++)
+			insert_symbols(msgs[i], punct_missing);
+		return;
 	}
+
+	batch.msgs = msgs;
+	batch.n = n;
+	batch.punct_missing = punct_missing;
+	batch.next = 0;
+	batch.workers = MIN(symbols_threads, n) - 1;
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.done, NULL);
+
+	/* Each worker takes messages until there are none left, and so do we */
+	for (i = batch.workers; i > 0; i--)
+		g_thread_pool_push(pool, &batch, NULL);
+
+	symbols_batch_run(&batch);
+
+	pthread_mutex_lock(&batch.mutex);
+	while (batch.workers > 0)
+		pthread_cond_wait(&batch.done, &batch.mutex);
+	pthread_mutex_unlock(&batch.mutex);
+
+	pthread_mutex_destroy(&batch.mutex);
+	pthread_cond_destroy(&batch.done);
 }
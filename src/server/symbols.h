@@ -29,6 +29,19 @@ void symbols_preprocessing_add_file(const char *name);
 /* Converts symbols to words corresponding to a level into a message. */
 void insert_symbols(TSpeechDMessage *msg, int punct_missing);
 
+/* Same for a SPD_MSGTYPE_CHAR message, also normalizing it, but looking the
+   description of the character up in a table when it was already seen.
+   Returns 0 if the text is not valid UTF-8. */
+int insert_char_description(TSpeechDMessage *msg, int punct_missing);
+
+/* Same for _n_ messages, spread over the threads set with
+   symbols_set_threads().  Returns once they are all processed. */
+void insert_symbols_parallel(TSpeechDMessage **msgs, int n, int punct_missing);
+
+/* Use up to _threads_ threads in insert_symbols_parallel(), including the
+   calling one.  The default is 1, i.e. no other thread. */
+void symbols_set_threads(int threads);
+
 /* Speech symbols punctuation levels */
 typedef enum {
 	SYMLVL_INVALID = -1,
@@ -43,4 +56,20 @@ typedef enum {
 /* Convert a string to a symbol level */
 extern SymLvl str2SymLvl(const char *str);
 
+/* Ways to match symbols in the text, they give the same result */
+typedef enum {
+	SYMENGINE_TRIE,		/* trie of simple symbols, regex of complex ones */
+	SYMENGINE_REGEX		/* one regex of all symbols, as NVDA does */
+} SymEngine;
+
+/* Select how symbols are matched, mostly for comparing them */
+void symbols_set_engine(SymEngine engine);
+
+/* Cache compiled symbols files in this directory, NULL to disable */
+void symbols_set_cache_dir(const char *dir);
+
+/* Keep up to size bytes of processed texts, 0 to disable.  This also
+   drops the texts processed so far. */
+void symbols_set_text_cache_size(size_t size);
+
 #endif /* SYMBOLS_H */
@@ -0,0 +1,395 @@
+/*
+ * key_echo_bench.c - Measure key echo latency through Speech Dispatcher
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This times what a screen reader does on each keystroke: spd_char() or
+ * spd_key(), and then waits for the character to be heard.  Each echo is
+ * stamped at these stages:
+ *
+ *   queued  spd_char()/spd_key() returned, i.e. the server parsed the
+ *           command and queue_message() accepted it
+ *   begin   the BEGIN event reached us, i.e. the speak() thread sent the
+ *           message through insert_symbols() and output_speak(), the module
+ *           synthesized it and audio playback started
+ *   sound   the null audio sink played the first non-silent sample
+ *   end     the END event reached us
+ *
+ * all measured from just before the spd_char()/spd_key() call.  The same
+ * is then measured again while another connection floods the server with
+ * PROGRESS messages.
+ *
+ * The server is expected to be already running with the null audio output,
+ * and with the sound log of the null sink enabled, e.g.:
+ *
+ *   SPEECHD_NULL_SOUND_LOG=/tmp/sound.log speech-dispatcher -t 0 -s
+ *   key_echo_bench -s /tmp/sound.log
+ *
+ * with "AudioOutputMethod null" in speechd.conf.  Without -s, the sound
+ * stage is not measured.  The per-stage breakdown inside the server can be
+ * obtained from the speechd USDT probes, see include/spd_probes.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "speechd_types.h"
+#include "libspeechd.h"
+
+/* How long we wait for an event before giving up on an echo */
+#define EVENT_TIMEOUT_NS (5 * (gint64) 1000000000)
+
+typedef enum {
+	STAGE_QUEUED,
+	STAGE_BEGIN,
+	STAGE_SOUND,
+	STAGE_END,
+	STAGE_COUNT
+} Stage;
+
+static const char *stage_names[STAGE_COUNT] = {
+	"queued", "begin", "sound", "end"
+};
+
+typedef struct {
+	gint64 *samples[STAGE_COUNT];
+	int count[STAGE_COUNT];
+	int missed;
+} Results;
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond;	/* on CLOCK_MONOTONIC */
+static gint64 event_begin;
+static gint64 event_end;
+
+static volatile int flood_running;
+static int flood_interval = 20;
+static int flood_sent;
+
+static const char *sound_log;
+static long sound_log_offset;
+
+static gint64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	gint64 t = now_ns();
+
+	pthread_mutex_lock(&event_mutex);
+	if (type == SPD_EVENT_BEGIN)
+		event_begin = t;
+	else
+		event_end = t;
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait until *event is set, up to the deadline.  END and CANCEL also end the
+   wait for BEGIN, since a cancelled message never begins. */
+static int wait_event(gint64 *event, gint64 deadline)
+{
+	struct timespec ts;
+	int ret;
+
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+
+	pthread_mutex_lock(&event_mutex);
+	while (*event == 0 && event_end == 0) {
+		if (pthread_cond_timedwait(&event_cond, &event_mutex, &ts)) {
+			if (now_ns() >= deadline)
+				break;
+		}
+	}
+	ret = *event != 0;
+	pthread_mutex_unlock(&event_mutex);
+	return ret;
+}
+
+/* Return the time of the last sound started before `end' and after `start'
+   according to the null sink log, or 0 */
+static gint64 read_sound_log(gint64 start, gint64 end)
+{
+	FILE *f;
+	char line[32];
+	gint64 t, found = 0;
+
+	f = fopen(sound_log, "r");
+	if (f == NULL)
+		return 0;
+	fseek(f, sound_log_offset, SEEK_SET);
+	while (fgets(line, sizeof(line), f)) {
+		t = g_ascii_strtoll(line, NULL, 10);
+		if (t >= start && t <= end)
+			found = t;
+	}
+	sound_log_offset = ftell(f);
+	fclose(f);
+	return found;
+}
+
+static void skip_sound_log(void)
+{
+	FILE *f;
+
+	if (sound_log == NULL)
+		return;
+	f = fopen(sound_log, "r");
+	if (f == NULL) {
+		sound_log_offset = 0;
+		return;
+	}
+	fseek(f, 0, SEEK_END);
+	sound_log_offset = ftell(f);
+	fclose(f);
+}
+
+static void add_sample(Results *res, Stage stage, gint64 t0, gint64 t)
+{
+	res->samples[stage][res->count[stage]++] = t - t0;
+}
+
+static int compare_gint64(const void *a, const void *b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Echo `iterations' keystrokes, using spd_key() if key, spd_char() otherwise */
+static void run(SPDConnection *conn, int key, int iterations, int gap,
+		Results *res)
+{
+	char name[2] = "a";
+	gint64 t0, t;
+	int i, ret;
+
+	for (i = 0; i < STAGE_COUNT; i++) {
+		res->samples[i] = g_new(gint64, iterations);
+		res->count[i] = 0;
+	}
+	res->missed = 0;
+
+	skip_sound_log();
+
+	for (i = 0; i < iterations; i++) {
+		name[0] = 'a' + i % 26;
+
+		pthread_mutex_lock(&event_mutex);
+		event_begin = 0;
+		event_end = 0;
+		pthread_mutex_unlock(&event_mutex);
+
+		t0 = now_ns();
+		if (key)
+			ret = spd_key(conn, SPD_TEXT, name);
+		else
+			ret = spd_char(conn, SPD_TEXT, name);
+		t = now_ns();
+		if (ret) {
+			fprintf(stderr, "Could not send %s\n", name);
+			exit(1);
+		}
+		add_sample(res, STAGE_QUEUED, t0, t);
+
+		if (!wait_event(&event_begin, t0 + EVENT_TIMEOUT_NS)
+		    || !wait_event(&event_end, t0 + EVENT_TIMEOUT_NS)) {
+			res->missed++;
+			skip_sound_log();
+			continue;
+		}
+		add_sample(res, STAGE_BEGIN, t0, event_begin);
+		add_sample(res, STAGE_END, t0, event_end);
+
+		if (sound_log != NULL) {
+			t = read_sound_log(t0, event_end);
+			if (t)
+				add_sample(res, STAGE_SOUND, t0, t);
+		}
+
+		g_usleep(gap * 1000);
+	}
+}
+
+static void report(const char *scenario, Results *res)
+{
+	int i, n;
+
+	for (i = 0; i < STAGE_COUNT; i++) {
+		gint64 *s = res->samples[i];
+
+		n = res->count[i];
+		if (n == 0) {
+			printf("%-12s %-7s %9s %9s %9s %9s\n", scenario,
+			       stage_names[i], "-", "-", "-", "-");
+			g_free(s);
+			continue;
+		}
+		qsort(s, n, sizeof(*s), compare_gint64);
+		printf("%-12s %-7s %9.3f %9.3f %9.3f %9.3f\n", scenario,
+		       stage_names[i], s[0] / 1e6, s[n / 2] / 1e6,
+		       s[(n - 1) * 95 / 100] / 1e6, s[n - 1] / 1e6);
+		g_free(s);
+	}
+	if (res->missed)
+		printf("%-12s %d echoes got no BEGIN or END within %ds\n",
+		       scenario, res->missed,
+		       (int)(EVENT_TIMEOUT_NS / 1000000000));
+}
+
+static void *flood(void *data)
+{
+	SPDConnection *conn = data;
+	char text[32];
+
+	while (flood_running) {
+		snprintf(text, sizeof(text), "%d percent",
+			 flood_sent % 100);
+		if (spd_say(conn, SPD_PROGRESS, text) < 0) {
+			fprintf(stderr, "Could not send progress message\n");
+			break;
+		}
+		flood_sent++;
+		g_usleep(flood_interval * 1000);
+	}
+	return NULL;
+}
+
+static SPDConnection *bench_connect(const char *name, const char *module)
+{
+	SPDConnection *conn;
+
+	conn = spd_open("key_echo_bench", name, NULL, SPD_MODE_THREADED);
+	if (conn == NULL) {
+		fprintf(stderr, "Could not connect to Speech Dispatcher\n");
+		exit(1);
+	}
+	if (module != NULL && spd_set_output_module(conn, module)) {
+		fprintf(stderr, "Could not set output module %s\n", module);
+		exit(1);
+	}
+	return conn;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-n iterations] [-g gap_ms] [-f flood_interval_ms]\n"
+		"       [-m module] [-s null_sound_log]\n"
+		"Use -f 0 to skip the PROGRESS flood case.\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	SPDConnection *conn, *flood_conn;
+	pthread_t flood_thread;
+	pthread_condattr_t attr;
+	Results res;
+	const char *module = NULL;
+	int iterations = 100;
+	int gap = 100;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:g:f:m:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'g':
+			gap = atoi(optarg);
+			break;
+		case 'f':
+			flood_interval = atoi(optarg);
+			break;
+		case 'm':
+			module = optarg;
+			break;
+		case 's':
+			sound_log = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (iterations <= 0 || gap < 0 || flood_interval < 0)
+		usage(argv[0]);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&event_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	conn = bench_connect("echo", module);
+	conn->callback_begin = event_cb;
+	conn->callback_end = event_cb;
+	conn->callback_cancel = event_cb;
+	if (spd_set_notification_on(conn, SPD_BEGIN)
+	    || spd_set_notification_on(conn, SPD_END)
+	    || spd_set_notification_on(conn, SPD_CANCEL)) {
+		fprintf(stderr, "Could not enable notifications\n");
+		exit(1);
+	}
+
+	printf("%-12s %-7s %9s %9s %9s %9s  (ms after the call)\n",
+	       "scenario", "stage", "min", "median", "p95", "max");
+
+	run(conn, 0, iterations, gap, &res);
+	report("char", &res);
+	run(conn, 1, iterations, gap, &res);
+	report("key", &res);
+
+	if (flood_interval > 0) {
+		flood_conn = bench_connect("progress", module);
+		flood_running = 1;
+		if (pthread_create(&flood_thread, NULL, flood, flood_conn)) {
+			fprintf(stderr, "Could not start the flood thread\n");
+			exit(1);
+		}
+
+		run(conn, 0, iterations, gap, &res);
+		report("char+flood", &res);
+		run(conn, 1, iterations, gap, &res);
+		report("key+flood", &res);
+
+		flood_running = 0;
+		pthread_join(flood_thread, NULL);
+		printf("%d progress messages sent every %dms\n", flood_sent,
+		       flood_interval);
+		spd_cancel(flood_conn);
+		spd_close(flood_conn);
+	}
+
+	spd_close(conn);
+	return 0;
+}
@@ -1,6 +1,6 @@
 
 /*
- * long_message.c - Two testing messages for Speech Dispatcher test
+ * long_message.c - Long messages test for Speech Dispatcher
  *
  * Copyright (C) 2001, 2002, 2003 Brailcom, o.p.s.
  *
@@ -20,25 +20,128 @@
  * $Id: long_message.c,v 1.13 2006-07-11 16:12:28 hanke Exp $
  */
 
+/*
+ * Both messages are much longer than what synthesizers take at once.  With
+ * MessageSegmentLength set in speechd.conf, the server sends them to the
+ * output module in segments, and this checks that the client still sees
+ * each of them as one message: exactly one BEGIN, then its index marks in
+ * order, then exactly one END.  The third message checks the ordering of
+ * index marks across segments.
+ */
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <glib.h>
 
 #include "speechd_types.h"
 #include "libspeechd.h"
 
+/* How long a message may take to be spoken */
+#define MESSAGE_TIMEOUT 300
+
+#define MARKS 40
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static size_t event_msg_id;	/* Id of the message the events are about */
+static int begins, ends, cancels, marks, last_mark, bad_events;
+
+/* Each message is waited for before sending the next one, so all events
+   must be about the same message */
+static void check_id(size_t msg_id)
+{
+	if (event_msg_id == 0)
+		event_msg_id = msg_id;
+	else if (msg_id != event_msg_id)
+		bad_events++;
+}
+
+static void event_cb(size_t msg_id, size_t client_id, SPDNotificationType type)
+{
+	pthread_mutex_lock(&event_mutex);
+	check_id(msg_id);
+	if (type == SPD_EVENT_BEGIN) {
+		begins++;
+		if (ends || cancels || marks)
+			bad_events++;
+	} else if (type == SPD_EVENT_END) {
+		ends++;
+	} else {
+		cancels++;
+	}
+	pthread_cond_signal(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+static void mark_cb(size_t msg_id, size_t client_id, SPDNotificationType type,
+		    char *index_mark)
+{
+	int mark = last_mark;
+
+	pthread_mutex_lock(&event_mutex);
+	check_id(msg_id);
+	/* Marks are m0, m1, ..., they must come once each, in order, between
+	   BEGIN and END */
+	if (sscanf(index_mark, "m%d", &mark) != 1 || mark != last_mark + 1
+	    || !begins || ends)
+		bad_events++;
+	last_mark = mark;
+	marks++;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Wait for the end of message _msg_id_, and check its events */
+static void check_message(int msg_id, int expected_marks)
+{
+	struct timespec ts;
+
+	if (msg_id == -1) {
+		printf("spd_say failed\n");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += MESSAGE_TIMEOUT;
+
+	pthread_mutex_lock(&event_mutex);
+	while (!ends && !cancels)
+		if (pthread_cond_timedwait(&event_cond, &event_mutex, &ts))
+			break;
+
+	printf("%d BEGIN, %d END, %d CANCEL, %d index marks\n", begins, ends,
+	       cancels, marks);
+	if (begins != 1 || ends != 1 || cancels != 0 || bad_events
+	    || event_msg_id != msg_id
+	    || (marks != 0 && marks != expected_marks)) {
+		printf("Wrong events for message %d\n", msg_id);
+		exit(1);
+	}
+
+	/* Get ready for the next message */
+	begins = ends = cancels = marks = bad_events = 0;
+	last_mark = -1;
+	event_msg_id = 0;
+	pthread_mutex_unlock(&event_mutex);
+}
+
 int main()
 {
 	SPDConnection *sockfd;
+	GString *ssml;
 	int ret;
+	int i;
 
 	printf("Start of the test.\n");
 
 	printf("Trying to initialize Speech Dispatcher...");
-	sockfd = spd_open("test", NULL, NULL, SPD_MODE_SINGLE);
+	sockfd = spd_open("test", NULL, NULL, SPD_MODE_THREADED);
 	if (sockfd == 0) {
 		printf("Speech Dispatcher failed");
 		exit(1);
@@ -51,6 +154,19 @@ int main()
 		exit(1);
 	}
 
+	last_mark = -1;
+	sockfd->callback_begin = event_cb;
+	sockfd->callback_end = event_cb;
+	sockfd->callback_cancel = event_cb;
+	sockfd->callback_im = mark_cb;
+	if (spd_set_notification_on(sockfd, SPD_BEGIN)
+	    || spd_set_notification_on(sockfd, SPD_END)
+	    || spd_set_notification_on(sockfd, SPD_CANCEL)
+	    || spd_set_notification_on(sockfd, SPD_INDEX_MARKS)) {
+		printf("spd_set_notification_on failed");
+		exit(1);
+	}
+
 	printf("Sending message number 1, text \n");
 	ret = spd_say(sockfd, SPD_MESSAGE, ""
 		      "						\n"
@@ -273,10 +389,7 @@ int main()
 		      "\n"
 		      "  So she set to work, and very soon finished off the cake. ");
 
-	if (ret == -1) {
-		printf("spd_say failed");
-		exit(1);
-	}
+	check_message(ret, 0);
 
 	printf("Sending message number 2, code (ugly characters) \n");
 	ret = spd_say(sockfd, SPD_MESSAGE, "\n"
@@ -391,17 +504,27 @@ int main()
 		      "	if (!global_settings->paused) return 0;\n"
 		      "	else return 1;\n"
 		      "}\n" "					");
-	if (ret == -1) {
-		printf("spd_say failed");
+	check_message(ret, 0);
+
+	printf("Sending message number 3, SSML with index marks\n");
+	ssml = g_string_new("<speak>");
+	for (i = 0; i < MARKS; i++)
+		g_string_append_printf(ssml,
+				       "This is sentence number %d of the third"
+				       " message. <mark name=\"m%d\"/>", i, i);
+	g_string_append(ssml, "</speak>");
+	if (spd_set_data_mode(sockfd, SPD_DATA_SSML)) {
+		printf("spd_set_data_mode failed");
 		exit(1);
 	}
+	ret = spd_say(sockfd, SPD_MESSAGE, ssml->str);
+	check_message(ret, MARKS);
+	g_string_free(ssml, TRUE);
 
 	printf("Trying to close Speech Dispatcher connection...");
 	spd_close(sockfd);
 	printf("OK\n");
 
-	printf("Speech Dispatcher should continue saying both messages...\n");
-
 	printf("End of the test.\n");
 	exit(0);
 }
@@ -0,0 +1,98 @@
+/*
+ * spd_resample_check.c - test the resampler across rate changes
+ *
+ * Copyright (C) 2026 Brailcom, o.p.s.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Playbacks alternate between a track that has to be resampled and one
+ * already at the output rate, with spd_resampler_reset() between them like
+ * spd_audio does for each new playback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include "spd_resample.h"
+
+#define OUT_RATE 44100
+#define FRAMES 4000
+#define LEVEL 8000
+
+static int16_t samples[FRAMES];
+
+/* Play FRAMES frames of a constant level at rate, return 0 if they came
+   out at OUT_RATE and at the same level */
+static int play(SPDResampler * r, int rate)
+{
+	AudioTrack track, out;
+	int expected = (gint64) FRAMES * OUT_RATE / rate;
+	int i;
+
+	track.bits = 16;
+	track.num_channels = 1;
+	track.sample_rate = rate;
+	track.num_samples = FRAMES;
+	track.samples = samples;
+
+	spd_resampler_reset(r);
+	out = spd_resampler_process(r, track);
+
+	if (out.sample_rate != OUT_RATE || out.num_channels != 1) {
+		printf("%d Hz: got a track of %d Hz and %d channels\n",
+		       rate, out.sample_rate, out.num_channels);
+		return 1;
+	}
+	/* The filter delays the output, the end of the input is kept for
+	   the next track */
+	if (out.num_samples > expected + 1
+	    || out.num_samples < expected - 128) {
+		printf("%d Hz: got %d samples instead of about %d\n",
+		       rate, out.num_samples, expected);
+		return 1;
+	}
+	/* Past the ramp from the silence before the first track */
+	for (i = out.num_samples / 2; i < out.num_samples; i++)
+		if (abs(out.samples[i] - LEVEL) > LEVEL / 100) {
+			printf("%d Hz: sample %d is %d instead of %d\n",
+			       rate, i, out.samples[i], LEVEL);
+			return 1;
+		}
+	return 0;
+}
+
+int main(void)
+{
+	static const int rates[] = { 16000, OUT_RATE, 22050, OUT_RATE,
+		48000, 16000, OUT_RATE, OUT_RATE, 16000
+	};
+	SPDResampler *r;
+	int i, failed = 0;
+
+	for (i = 0; i < FRAMES; i++)
+		samples[i] = LEVEL;
+
+	r = spd_resampler_new(OUT_RATE, 1);
+	for (i = 0; i < G_N_ELEMENTS(rates); i++)
+		failed |= play(r, rates[i]);
+	spd_resampler_free(r);
+
+	if (failed)
+		return 1;
+	printf("%s: OK\n", __FILE__);
+	return 0;
+}